@@ -0,0 +1,304 @@
+#include "access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/*
+    与logger相同的单生产者单消费者环形缓冲区，内容是连续的记录，记录可能在缓冲区末尾环绕
+*/
+struct access_log::ring {
+    char* data;
+    unsigned long mask;
+    std::atomic<unsigned long> head;      // 工作线程写到的位置
+    std::atomic<unsigned long> tail;      // 后台线程写出到的位置
+    std::atomic<long> dropped;
+};
+
+bool access_log::m_enabled = false;
+std::atomic<bool> access_log::m_running(false);
+int access_log::m_format = access_log::BINARY;
+int access_log::m_buffer_size = 256 << 10;
+int access_log::m_fd = -1;
+char access_log::m_path[256] = "";
+std::atomic<access_log::ring*> access_log::m_rings[access_log::MAX_THREADS];
+std::atomic<int> access_log::m_ring_count(0);
+thread_local access_log::ring* access_log::m_local = NULL;
+pthread_t access_log::m_thread;
+sem access_log::m_wakeup;
+std::atomic<bool> access_log::m_wakeup_pending(false);
+locker access_log::m_file_lock;
+
+static const char* format_names[] = {"binary", "clf"};
+static const char* method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+static const int FLUSH_INTERVAL_MS = 200;   // 后台线程写出的间隔
+static const int CLF_BATCH = 64 << 10;      // clf格式每次write的文本量
+
+// 打开日志文件，新文件(二进制格式)先写入魔数
+static int open_log(const char* path, int format) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if(format == access_log::BINARY && fstat(fd, &st) == 0 && st.st_size == 0) {
+        if(write(fd, ACCESS_LOG_MAGIC, 8) != 8) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+bool access_log::init(const char* path, int format, int buffer_size) {
+    if(m_running || !path || !path[0]) {
+        return false;
+    }
+    if(strlen(path) >= sizeof(m_path)) {
+        printf("access log path too long: %s\n", path);
+        return false;
+    }
+    m_fd = open_log(path, format);
+    if(m_fd < 0) {
+        printf("cannot open access log %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    strcpy(m_path, path);
+    m_format = format;
+    int size = 4096;
+    while(size < buffer_size) {
+        size <<= 1;
+    }
+    m_buffer_size = size;
+
+    m_running = true;
+    if(pthread_create(&m_thread, NULL, flush_worker, NULL) != 0) {
+        m_running = false;
+        return false;
+    }
+    m_enabled = true;
+    static bool registered = false;
+    if(!registered) {
+        atexit(shutdown);
+        registered = true;
+    }
+    return true;
+}
+
+void access_log::shutdown() {
+    if(!m_running.exchange(false)) {
+        return;
+    }
+    m_wakeup.post();
+    pthread_join(m_thread, NULL);
+    flush();
+}
+
+bool access_log::reopen() {
+    if(!m_enabled) {
+        return true;
+    }
+    int fd = open_log(m_path, m_format);
+    if(fd < 0) {
+        return false;
+    }
+    m_file_lock.lock();
+    close(m_fd);
+    m_fd = fd;
+    m_file_lock.unlock();
+    return true;
+}
+
+uint64_t access_log::now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int access_log::parse_format(const char* name) {
+    for(int i = BINARY; i <= CLF; i++) {
+        if(strcmp(name, format_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* access_log::format_name(int format) {
+    return format_names[format];
+}
+
+long access_log::dropped() {
+    long total = 0;
+    int count = m_ring_count.load();
+    for(int i = 0; i < count && i < MAX_THREADS; i++) {
+        ring* r = m_rings[i].load(std::memory_order_acquire);
+        if(r) {
+            total += r->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+void access_log::print_stats() {
+    if(m_enabled) {
+        printf("access log: format=%s dropped=%ld\n", format_name(m_format), dropped());
+    }
+}
+
+access_log::ring* access_log::local_ring() {
+    if(m_local) {
+        return m_local;
+    }
+    static thread_local bool overflow = false;
+    if(overflow) {
+        return NULL;
+    }
+    int id = m_ring_count.fetch_add(1);
+    if(id >= MAX_THREADS) {
+        overflow = true;
+        return NULL;
+    }
+    ring* r = new ring;
+    r->data = new char[m_buffer_size];
+    r->mask = m_buffer_size - 1;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    m_rings[id].store(r, std::memory_order_release);
+    m_local = r;
+    return r;
+}
+
+void access_log::write(entry& e) {
+    ring* r = m_running.load(std::memory_order_relaxed) ? local_ring() : NULL;
+    if(!r) {
+        return;
+    }
+    int n = sizeof(record) + e.rec.url_len;
+    e.rec.size = n;
+    unsigned long size = r->mask + 1;
+    unsigned long head = r->head.load(std::memory_order_relaxed);
+    unsigned long tail = r->tail.load(std::memory_order_acquire);
+    if(head - tail + n > size) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // 记录和URL在entry中是连续的，可以一次拷贝
+    const char* src = (const char*)&e;
+    unsigned long offset = head & r->mask;
+    unsigned long first = size - offset < (unsigned long)n ? size - offset : n;
+    memcpy(r->data + offset, src, first);
+    memcpy(r->data, src + first, n - first);
+    r->head.store(head + n, std::memory_order_release);
+    if(head + n - tail > size / 2 && !m_wakeup_pending.exchange(true)) {
+        m_wakeup.post();
+    }
+}
+
+int access_log::format_clf(const record& rec, const char* url, char* buf, int size) {
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = rec.addr;
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    time_t sec = rec.time_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char date[40];
+    strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S %z", &tm);
+    const char* method = rec.method < sizeof(method_names) / sizeof(method_names[0]) ? method_names[rec.method] : "-";
+    int n = snprintf(buf, size, "%s - - [%s] \"%s %.*s HTTP/1.1\" %u %llu %u %u%s\n", addr, date, method,
+                     (int)rec.url_len, url, rec.status, (unsigned long long)rec.bytes, rec.ttfb_us, rec.ttlb_us,
+                     rec.complete ? "" : " aborted");
+    return n < size ? n : size - 1;
+}
+
+void* access_log::flush_worker(void*) {
+    while(m_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        m_wakeup.timedwait(deadline);
+        m_wakeup_pending = false;
+        flush();
+    }
+    return NULL;
+}
+
+bool access_log::write_file(const char* data, long len) {
+    while(len > 0) {
+        ssize_t n = ::write(m_fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 二进制格式把[tail, head)原样写出(环绕时分两段)，clf格式逐条转换成文本后批量写出
+void access_log::flush() {
+    static char text[CLF_BATCH + 512];
+    m_file_lock.lock();
+    int count = m_ring_count.load();
+    int text_len = 0;
+    for(int i = 0; i < count && i < MAX_THREADS; i++) {
+        ring* r = m_rings[i].load(std::memory_order_acquire);
+        if(!r) {
+            continue;
+        }
+        unsigned long head = r->head.load(std::memory_order_acquire);
+        unsigned long tail = r->tail.load(std::memory_order_relaxed);
+        if(head == tail) {
+            continue;
+        }
+        unsigned long size = r->mask + 1;
+        if(m_format == BINARY) {
+            unsigned long offset = tail & r->mask;
+            unsigned long len = head - tail;
+            unsigned long first = size - offset < len ? size - offset : len;
+            write_file(r->data + offset, first);
+            if(len > first) {
+                write_file(r->data, len - first);
+            }
+        } else {
+            for(unsigned long pos = tail; pos < head; ) {
+                entry e;
+                unsigned long offset = pos & r->mask;
+                unsigned long first = size - offset < sizeof(record) ? size - offset : sizeof(record);
+                memcpy(&e.rec, r->data + offset, first);
+                memcpy((char*)&e.rec + first, r->data, sizeof(record) - first);
+                int url_len = e.rec.url_len;
+                offset = (pos + sizeof(record)) & r->mask;
+                first = size - offset < (unsigned long)url_len ? size - offset : url_len;
+                memcpy(e.url, r->data + offset, first);
+                memcpy(e.url + first, r->data, url_len - first);
+                pos += sizeof(record) + url_len;
+                text_len += format_clf(e.rec, e.url, text + text_len, sizeof(text) - text_len);
+                if(text_len >= CLF_BATCH) {
+                    write_file(text, text_len);
+                    text_len = 0;
+                }
+            }
+        }
+        r->tail.store(head, std::memory_order_release);
+    }
+    if(text_len > 0) {
+        write_file(text, text_len);
+    }
+    m_file_lock.unlock();
+}
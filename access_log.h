@@ -0,0 +1,83 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+#include <atomic>
+#include <pthread.h>
+#include "locker.h"
+
+/*
+    访问日志: 每个应答发送完(或连接中途关闭)时记录一条
+    1. 工作线程只把定长的二进制记录(加上URL)拷贝到本线程的无锁环形缓冲区，不做格式化，也没有系统调用
+    2. 后台线程定期把所有缓冲区批量写出: binary格式原样写出，clf格式在后台线程中转换成文本
+    3. 缓冲区满时丢弃记录并计数
+    二进制文件以8字节的魔数ACCESS_LOG_MAGIC开头，之后是连续的记录，用access_log_dump转换成文本
+*/
+#define ACCESS_LOG_MAGIC "SWSACC01"
+
+class access_log {
+public:
+    enum FORMAT {BINARY = 0, CLF};
+
+    static const int URL_MAX = 200;           // 记录的URL最大长度，超过时截断
+    static const int MAX_THREADS = 256;
+
+    // 二进制格式中的一条记录(小端)，URL紧跟在后面，size是包括URL的总字节数
+    struct record {
+        uint16_t size;
+        uint16_t status;                      // 应答的状态码
+        uint8_t method;                       // http_conn::METHOD
+        uint8_t complete;                     // 1为应答全部发送完，0为连接中途关闭
+        uint16_t url_len;
+        uint32_t addr;                        // 客户端IPv4地址(网络字节序)
+        uint32_t ttfb_us;                     // 从收到请求的第一个字节到发出应答的第一个字节(微秒)
+        uint32_t ttlb_us;                     // 到发出应答的最后一个字节(微秒)
+        uint64_t time_us;                     // 收到请求的时间(Unix时间，微秒)
+        uint64_t bytes;                       // 发送的字节数(头部 + 消息体)
+    } __attribute__((packed));
+
+    // 一个连接上还没有完成的应答的记录
+    struct entry {
+        record rec;
+        char url[URL_MAX];
+    };
+
+    // path为空时不记录；buffer_size为每个线程缓冲区的字节数，向上取2的幂
+    static bool init(const char* path, int format, int buffer_size);
+    static void shutdown();                   // 写出缓冲区中剩下的记录并停止后台线程，进程退出时自动调用
+    static bool reopen();                     // 重新打开日志文件(日志被外部轮转之后)
+    static bool enabled() { return m_enabled; }
+    static uint64_t now_us();                 // 当前的Unix时间(微秒)
+    static void write(entry& e);              // 填写e.rec.size后放入本线程的缓冲区
+
+    static int parse_format(const char* name);  // binary/clf，无法识别时返回-1
+    static const char* format_name(int format);
+    // 把一条记录格式化成一行CLF文本(后面附加ttfb和ttlb微秒)，返回长度
+    static int format_clf(const record& rec, const char* url, char* buf, int size);
+    static long dropped();
+    static void print_stats();
+
+private:
+    struct ring;
+    static ring* local_ring();
+    static void* flush_worker(void*);
+    static void flush();
+    static bool write_file(const char* data, long len);
+
+private:
+    static bool m_enabled;                    // 启动后不再改变，不需要原子操作
+    static std::atomic<bool> m_running;
+    static int m_format;
+    static int m_buffer_size;
+    static int m_fd;
+    static char m_path[256];
+    static std::atomic<ring*> m_rings[MAX_THREADS];
+    static std::atomic<int> m_ring_count;
+    static thread_local ring* m_local;
+    static pthread_t m_thread;
+    static sem m_wakeup;
+    static std::atomic<bool> m_wakeup_pending;
+    static locker m_file_lock;                // 后台线程写文件和reopen互斥
+};
+
+#endif
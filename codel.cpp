@@ -0,0 +1,58 @@
+#include "codel.h"
+#include <stdio.h>
+#include <time.h>
+#include "log.h"
+
+codel::codel(int target_ms, int interval_ms):
+    m_target((uint64_t)target_ms * 1000), m_interval((uint64_t)interval_ms * 1000),
+    m_first_above(0), m_dropping(false), m_max_sojourn(0), m_episodes(0), m_shed(0) {
+}
+
+uint64_t codel::now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void codel::observe(uint64_t sojourn_us, uint64_t now) {
+    if(sojourn_us > m_max_sojourn.load(std::memory_order_relaxed)) {
+        m_max_sojourn.store(sojourn_us, std::memory_order_relaxed);
+    }
+    if(sojourn_us < m_target) {
+        idle();
+        return;
+    }
+    uint64_t first_above = m_first_above.load(std::memory_order_relaxed);
+    if(first_above == 0) {
+        m_first_above.store(now + m_interval, std::memory_order_relaxed);
+    } else if(now >= first_above && !m_dropping.load(std::memory_order_relaxed)) {
+        m_dropping.store(true, std::memory_order_relaxed);
+        m_episodes.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("overloaded: queueing delay %lu us above target for %lu ms, shedding new requests",
+                 (unsigned long)sojourn_us, (unsigned long)(m_interval / 1000));
+    }
+}
+
+// 先读再写，不过载时不修改共享的cache line
+void codel::idle() {
+    if(m_first_above.load(std::memory_order_relaxed) != 0) {
+        m_first_above.store(0, std::memory_order_relaxed);
+    }
+    if(m_dropping.load(std::memory_order_relaxed)) {
+        m_dropping.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool codel::admit() {
+    if(!m_dropping.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    m_shed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void codel::print_stats() const {
+    printf("codel: target=%lums interval=%lums dropping=%d episodes=%ld shed=%ld max_sojourn=%luus\n",
+           (unsigned long)(m_target / 1000), (unsigned long)(m_interval / 1000), (int)dropping(),
+           m_episodes.load(), m_shed.load(), (unsigned long)m_max_sojourn.load());
+}
@@ -0,0 +1,40 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+    基于排队时延的过载控制(CoDel): 不看队列长度，看任务在队列中等待的时间(sojourn time)
+    1. 工作线程取出任务时报告它的等待时间(observe)；等待时间持续超过target达到一个interval，
+       说明队列不是突发造成的短暂排队，而是处理能力跟不上的持续排队，进入过载(dropping)状态
+    2. 过载期间reactor不再把新请求放进队列，直接回答503(admit返回false)，已经排队的请求照常处理，
+       队列很快排空，被接受的请求的排队时延不超过target加上一个interval
+    3. 取出的任务等待时间回到target以下，或者队列空了(idle)，立即退出过载状态
+    和路由器中的CoDel不同，过载期间拒绝所有新请求，不按控制律逐个丢弃: 请求不会像TCP那样因丢包而降低发送速率，
+    逐个丢弃无法让队列排空
+    多个工作线程同时修改状态，只用relaxed的原子操作，状态短暂不一致只影响个别请求是否被拒绝
+*/
+class codel {
+public:
+    codel(int target_ms, int interval_ms);
+
+    static uint64_t now_us();                      // 单调时钟(微秒)
+
+    void observe(uint64_t sojourn_us, uint64_t now);  // 工作线程取出任务时调用
+    void idle();                                   // 工作线程发现队列为空时调用
+    bool admit();                                  // reactor放入任务之前调用，过载时返回false并计数
+    bool dropping() const { return m_dropping.load(std::memory_order_relaxed); }
+    void print_stats() const;
+
+private:
+    uint64_t m_target;                             // 目标排队时延(微秒)
+    uint64_t m_interval;                           // 持续超过目标多久才算过载(微秒)
+    std::atomic<uint64_t> m_first_above;           // 等待时间超过target之后，到这个时间还没有降下来就进入过载，0为没有超过
+    std::atomic<bool> m_dropping;                  // 是否处于过载状态
+    std::atomic<uint64_t> m_max_sojourn;           // 观察到的最长等待时间
+    std::atomic<long> m_episodes;                  // 进入过载状态的次数
+    std::atomic<long> m_shed;                      // 拒绝的请求数
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "config.h"
+#include "log.h"
+#include "access_log.h"
+
+config::config():
+    port(10000), listen_et(false), conn_et(true),
+    max_fd(65535), max_events(10000), backlog(1024), accept_batch(64),
+    threads(8), max_requests(10000), pool_mode(POOL_FIFO),
+    codel_target(5), codel_interval(100), retry_after(1),
+    reactor_threads(0), use_uring(false), numa_local(false),
+    read_buffer_size(2048), read_buffer_max(65536), write_buffer_size(1024),
+    file_cache_entries(1024),
+    response_cache_size(32 << 20), response_cache_max_object(64 << 10),
+    send_mode(SEND_WRITEV), zerocopy_threshold(64 << 10), stream_window(1 << 20), notsent_lowat(0),
+    keepalive_timeout(60), header_timeout(10), send_timeout(60),
+    log_level(logger::INFO), log_file_size(64 << 20), log_files(5), log_buffer_size(256 << 10),
+    access_log_format(access_log::BINARY), access_log_buffer_size(256 << 10) {
+    strcpy(doc_root, "/home/admin1/Simple-Web-Server/resources");
+    log_file[0] = '\0';
+    access_log_file[0] = '\0';
+    reactor_cpus[0] = '\0';
+    worker_cpus[0] = '\0';
+    set_listen_profile(PROFILE_DEFAULT);
+}
+
+// 解析正整数，范围[min, max]
+static bool parse_int(const char* value, int min, int max, int* out) {
+    char* end = NULL;
+    long v = strtol(value, &end, 10);
+    if(end == value || *end != '\0' || v < min || v > max) {
+        return false;
+    }
+    *out = (int)v;
+    return true;
+}
+
+// 解析触发模式: LT为水平触发，ET为边缘触发
+static bool parse_trigger(const char* value, bool* et) {
+    if(strcasecmp(value, "ET") == 0) {
+        *et = true;
+    } else if(strcasecmp(value, "LT") == 0) {
+        *et = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 解析开关: on/off
+static bool parse_switch(const char* value, bool* on) {
+    if(strcasecmp(value, "on") == 0) {
+        *on = true;
+    } else if(strcasecmp(value, "off") == 0) {
+        *on = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char* send_mode_names[] = {"writev", "sendfile", "zerocopy"};
+
+// 解析文件内容的发送方式
+static bool parse_send_mode(const char* value, int* mode) {
+    for(int i = 0; i < 3; i++) {
+        if(strcmp(value, send_mode_names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* listen_profile_names[] = {"kernel", "default", "latency", "storm"};
+
+static const char* pool_mode_names[] = {"fifo", "steal"};
+
+// 解析线程池的调度方式
+static bool parse_pool_mode(const char* value, int* mode) {
+    for(int i = 0; i < 2; i++) {
+        if(strcmp(value, pool_mode_names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void config::set_listen_profile(int profile) {
+    listen_profile = profile;
+    tcp_nodelay = profile != PROFILE_KERNEL;
+    fastopen = profile >= PROFILE_LATENCY ? 256 : 0;
+    defer_accept = profile == PROFILE_STORM ? 1 : 0;
+    listen_sndbuf = 0;
+    listen_rcvbuf = 0;
+}
+
+bool config::set(const char* key, const char* value) {
+    bool ok = false;
+    if(strcmp(key, "port") == 0) {
+        ok = parse_int(value, 1, 65535, &port);
+    } else if(strcmp(key, "doc_root") == 0) {
+        ok = strlen(value) < PATH_LEN;
+        if(ok) {
+            strcpy(doc_root, value);
+        }
+    } else if(strcmp(key, "listen_trigger") == 0) {
+        ok = parse_trigger(value, &listen_et);
+    } else if(strcmp(key, "conn_trigger") == 0) {
+        ok = parse_trigger(value, &conn_et);
+    } else if(strcmp(key, "max_fd") == 0) {
+        ok = parse_int(value, 16, 1 << 24, &max_fd);
+    } else if(strcmp(key, "max_events") == 0) {
+        ok = parse_int(value, 1, 1 << 20, &max_events);
+    } else if(strcmp(key, "backlog") == 0) {
+        ok = parse_int(value, 1, 1 << 20, &backlog);
+    } else if(strcmp(key, "accept_batch") == 0) {
+        ok = parse_int(value, 1, 1 << 16, &accept_batch);
+    } else if(strcmp(key, "listen_profile") == 0) {
+        for(int i = 0; i < 4 && !ok; i++) {
+            if(strcmp(value, listen_profile_names[i]) == 0) {
+                set_listen_profile(i);
+                ok = true;
+            }
+        }
+    } else if(strcmp(key, "tcp_nodelay") == 0) {
+        ok = parse_switch(value, &tcp_nodelay);
+    } else if(strcmp(key, "defer_accept") == 0) {
+        ok = parse_int(value, 0, 3600, &defer_accept);
+    } else if(strcmp(key, "fastopen") == 0) {
+        ok = parse_int(value, 0, 1 << 16, &fastopen);
+    } else if(strcmp(key, "listen_sndbuf") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &listen_sndbuf);
+    } else if(strcmp(key, "listen_rcvbuf") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &listen_rcvbuf);
+    } else if(strcmp(key, "threads") == 0) {
+        ok = parse_int(value, 1, 1024, &threads);
+    } else if(strcmp(key, "max_requests") == 0) {
+        ok = parse_int(value, 1, 1 << 24, &max_requests);
+    } else if(strcmp(key, "pool_mode") == 0) {
+        ok = parse_pool_mode(value, &pool_mode);
+    } else if(strcmp(key, "codel_target") == 0) {
+        ok = parse_int(value, 0, 60000, &codel_target);
+    } else if(strcmp(key, "codel_interval") == 0) {
+        ok = parse_int(value, 1, 60000, &codel_interval);
+    } else if(strcmp(key, "retry_after") == 0) {
+        ok = parse_int(value, 0, 86400, &retry_after);
+    } else if(strcmp(key, "reactor_threads") == 0) {
+        ok = parse_int(value, 0, 1024, &reactor_threads);
+    } else if(strcmp(key, "backend") == 0) {
+        ok = strcmp(value, "epoll") == 0 || strcmp(value, "uring") == 0;
+        use_uring = strcmp(value, "uring") == 0;
+    } else if(strcmp(key, "reactor_cpus") == 0) {
+        ok = strlen(value) < CPU_LIST_LEN;  // 在启动时按实际的拓扑检查
+        if(ok) {
+            strcpy(reactor_cpus, value);
+        }
+    } else if(strcmp(key, "worker_cpus") == 0) {
+        ok = strlen(value) < CPU_LIST_LEN;
+        if(ok) {
+            strcpy(worker_cpus, value);
+        }
+    } else if(strcmp(key, "numa_local") == 0) {
+        ok = parse_switch(value, &numa_local);
+    } else if(strcmp(key, "read_buffer_size") == 0) {
+        ok = parse_int(value, 256, 1 << 20, &read_buffer_size);
+    } else if(strcmp(key, "read_buffer_max") == 0) {
+        ok = parse_int(value, 256, 1 << 20, &read_buffer_max);
+    } else if(strcmp(key, "write_buffer_size") == 0) {
+        ok = parse_int(value, 256, 1 << 20, &write_buffer_size);
+    } else if(strcmp(key, "file_cache_entries") == 0) {
+        ok = parse_int(value, 0, 1 << 20, &file_cache_entries);
+    } else if(strcmp(key, "response_cache_size") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &response_cache_size);
+    } else if(strcmp(key, "response_cache_max_object") == 0) {
+        ok = parse_int(value, 1, 1 << 26, &response_cache_max_object);
+    } else if(strcmp(key, "send_mode") == 0) {
+        ok = parse_send_mode(value, &send_mode);
+    } else if(strcmp(key, "zerocopy_threshold") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &zerocopy_threshold);
+    } else if(strcmp(key, "stream_window") == 0) {
+        ok = parse_int(value, 64 << 10, 1 << 30, &stream_window);
+    } else if(strcmp(key, "notsent_lowat") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &notsent_lowat);
+    } else if(strcmp(key, "keepalive_timeout") == 0) {
+        ok = parse_int(value, 0, 86400, &keepalive_timeout);
+    } else if(strcmp(key, "header_timeout") == 0) {
+        ok = parse_int(value, 0, 86400, &header_timeout);
+    } else if(strcmp(key, "send_timeout") == 0) {
+        ok = parse_int(value, 0, 86400, &send_timeout);
+    } else if(strcmp(key, "log_file") == 0) {
+        ok = strlen(value) < PATH_LEN;
+        if(ok) {
+            strcpy(log_file, value);
+        }
+    } else if(strcmp(key, "log_level") == 0) {
+        log_level = logger::parse_level(value);
+        ok = log_level >= 0;
+    } else if(strcmp(key, "log_file_size") == 0) {
+        ok = parse_int(value, 0, 1 << 30, &log_file_size);
+    } else if(strcmp(key, "log_files") == 0) {
+        ok = parse_int(value, 0, 100, &log_files);
+    } else if(strcmp(key, "log_buffer_size") == 0) {
+        ok = parse_int(value, 4096, 1 << 28, &log_buffer_size);
+    } else if(strcmp(key, "access_log") == 0) {
+        ok = strlen(value) < PATH_LEN;
+        if(ok) {
+            strcpy(access_log_file, value);
+        }
+    } else if(strcmp(key, "access_log_format") == 0) {
+        access_log_format = access_log::parse_format(value);
+        ok = access_log_format >= 0;
+    } else if(strcmp(key, "access_log_buffer_size") == 0) {
+        ok = parse_int(value, 4096, 1 << 28, &access_log_buffer_size);
+    } else {
+        printf("unknown option: %s\n", key);
+        return false;
+    }
+    if(!ok) {
+        printf("invalid value for %s: %s\n", key, value);
+    }
+    return ok;
+}
+
+// 去掉字符串首尾的空白字符
+static char* trim(char* s) {
+    while(isspace((unsigned char)*s)) {
+        s++;
+    }
+    char* end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+bool config::load_file(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if(!fp) {
+        printf("cannot open config file %s\n", path);
+        return false;
+    }
+    char line[512];
+    int lineno = 0;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char* text = trim(line);
+        if(text[0] == '\0' || text[0] == '#') {  // 空行和注释
+            continue;
+        }
+        char* eq = strchr(text, '=');
+        if(!eq) {
+            printf("%s:%d: expected key = value\n", path, lineno);
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        ok = set(trim(text), trim(eq + 1));
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool config::parse_args(int argc, char* argv[]) {
+    // 先加载配置文件，使命令行参数无论写在-c前面还是后面都能覆盖配置文件
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--config") == 0) {
+            if(i + 1 >= argc || !load_file(argv[++i])) {
+                return false;
+            }
+        }
+    }
+
+    int positional = 0;
+    for(int i = 1; i < argc; i++) {
+        char* arg = argv[i];
+        if(strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            return false;
+        }
+        if(strcmp(arg, "-c") == 0 || strcmp(arg, "--config") == 0) {
+            i++;  // 已经加载过了
+            continue;
+        }
+        if(strncmp(arg, "--", 2) == 0) {
+            // --key=value 或 --key value，key中的'-'等同于'_'
+            char key[64];
+            const char* value = NULL;
+            const char* eq = strchr(arg + 2, '=');
+            size_t len = eq ? (size_t)(eq - arg - 2) : strlen(arg + 2);
+            if(len >= sizeof(key)) {
+                printf("unknown option: %s\n", arg);
+                return false;
+            }
+            memcpy(key, arg + 2, len);
+            key[len] = '\0';
+            for(char* p = key; *p; p++) {
+                if(*p == '-') {
+                    *p = '_';
+                }
+            }
+            if(eq) {
+                value = eq + 1;
+            } else if(i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                printf("option %s requires a value\n", arg);
+                return false;
+            }
+            if(!set(key, value)) {
+                return false;
+            }
+            continue;
+        }
+        // 兼容原来的用法: port [reactor_threads] [epoll|uring]
+        static const char* positional_keys[] = {"port", "reactor_threads", "backend"};
+        if(positional >= 3) {
+            printf("unexpected argument: %s\n", arg);
+            return false;
+        }
+        if(!set(positional_keys[positional++], arg)) {
+            return false;
+        }
+    }
+    // io_uring后端总是在reactor线程内处理请求，至少一个reactor线程
+    if(use_uring && reactor_threads == 0) {
+        reactor_threads = 1;
+    }
+    return true;
+}
+
+void config::print() const {
+    printf("port=%d doc_root=%s backend=%s reactor_threads=%d\n",
+           port, doc_root, use_uring ? "uring" : "epoll", reactor_threads);
+    printf("reactor_cpus=%s worker_cpus=%s numa_local=%s\n", reactor_cpus[0] ? reactor_cpus : "(off)",
+           worker_cpus[0] ? worker_cpus : "(off)", numa_local ? "on" : "off");
+    printf("listen_trigger=%s conn_trigger=%s backlog=%d accept_batch=%d max_fd=%d max_events=%d\n",
+           listen_et ? "ET" : "LT", conn_et ? "ET" : "LT", backlog, accept_batch, max_fd, max_events);
+    printf("listen_profile=%s tcp_nodelay=%s defer_accept=%d fastopen=%d listen_sndbuf=%d listen_rcvbuf=%d\n",
+           listen_profile_names[listen_profile], tcp_nodelay ? "on" : "off", defer_accept, fastopen, listen_sndbuf, listen_rcvbuf);
+    printf("threads=%d max_requests=%d pool_mode=%s read_buffer_size=%d read_buffer_max=%d write_buffer_size=%d\n",
+           threads, max_requests, pool_mode_names[pool_mode], read_buffer_size, read_buffer_max, write_buffer_size);
+    printf("codel_target=%d codel_interval=%d retry_after=%d\n", codel_target, codel_interval, retry_after);
+    printf("file_cache_entries=%d response_cache_size=%d response_cache_max_object=%d\n",
+           file_cache_entries, response_cache_size, response_cache_max_object);
+    printf("send_mode=%s zerocopy_threshold=%d stream_window=%d notsent_lowat=%d\n",
+           send_mode_names[send_mode], zerocopy_threshold, stream_window, notsent_lowat);
+    printf("keepalive_timeout=%d header_timeout=%d send_timeout=%d\n", keepalive_timeout, header_timeout, send_timeout);
+    printf("log_file=%s log_level=%s log_file_size=%d log_files=%d log_buffer_size=%d\n",
+           log_file[0] ? log_file : "(stdout)", logger::level_name(log_level), log_file_size, log_files, log_buffer_size);
+    printf("access_log=%s access_log_format=%s access_log_buffer_size=%d\n",
+           access_log_file[0] ? access_log_file : "(off)", access_log::format_name(access_log_format), access_log_buffer_size);
+}
+
+void config::usage(const char* prog) {
+    printf("usage: %s [-c config_file] [options] [port [reactor_threads [epoll|uring]]]\n", prog);
+    printf("options (also valid as 'key = value' lines in the config file):\n");
+    printf("  --port N                 listening port (10000)\n");
+    printf("  --doc_root PATH          website root directory\n");
+    printf("  --listen_trigger LT|ET   trigger mode of the listening socket (LT)\n");
+    printf("  --conn_trigger LT|ET     trigger mode of connection sockets (ET)\n");
+    printf("  --backlog N              listen() backlog, capped by net.core.somaxconn (1024)\n");
+    printf("  --accept_batch N         max connections accepted per listener wakeup (64)\n");
+    printf("  --listen_profile kernel|default|latency|storm  preset of the listener options below (default)\n");
+    printf("  --tcp_nodelay on|off     TCP_NODELAY on the listener, inherited by connections (on)\n");
+    printf("  --defer_accept N         TCP_DEFER_ACCEPT seconds, 0 disables (0)\n");
+    printf("  --fastopen N             TCP_FASTOPEN queue length, 0 disables (0)\n");
+    printf("  --listen_sndbuf N        SO_SNDBUF of the listener, 0 keeps autotuning (0)\n");
+    printf("  --listen_rcvbuf N        SO_RCVBUF of the listener, 0 keeps autotuning (0)\n");
+    printf("  --max_fd N               max file descriptors / connection slots (65535)\n");
+    printf("  --max_events N           max events per epoll_wait (10000)\n");
+    printf("  --threads N              worker threads of the threadpool (8)\n");
+    printf("  --max_requests N         max queued requests of the threadpool (10000)\n");
+    printf("  --pool_mode fifo|steal   one shared queue, or per-worker deques with work stealing (fifo)\n");
+    printf("  --codel_target N         shed requests with 503 when queueing delay stays above N ms, 0 disables (5)\n");
+    printf("  --codel_interval N       ms the delay must stay above the target before shedding (100)\n");
+    printf("  --retry_after N          Retry-After seconds of the overload 503 (1)\n");
+    printf("  --reactor_threads N      0: one reactor + threadpool, N: N reactors (0)\n");
+    printf("  --backend epoll|uring    event backend (epoll)\n");
+    printf("  --reactor_cpus LIST      pin reactor threads to cpus, e.g. 0-3,8 or auto (off)\n");
+    printf("  --worker_cpus LIST       pin threadpool workers to cpus, e.g. 4-7 or auto (off)\n");
+    printf("  --numa_local on|off      place the connection table on the reactors' numa nodes (off)\n");
+    printf("  --read_buffer_size N     initial per-request read buffer bytes (2048)\n");
+    printf("  --read_buffer_max N      read buffer limit for large request headers (65536)\n");
+    printf("  --write_buffer_size N    per-connection header buffer bytes (1024)\n");
+    printf("  --file_cache_entries N   open file / mmap cache entries, 0 disables (1024)\n");
+    printf("  --response_cache_size N  whole-response cache bytes, 0 disables (33554432)\n");
+    printf("  --response_cache_max_object N  largest cached response bytes (65536)\n");
+    printf("  --send_mode writev|sendfile|zerocopy  how file bodies are sent, epoll only (writev)\n");
+    printf("  --zerocopy_threshold N   min body bytes for MSG_ZEROCOPY in zerocopy mode (65536)\n");
+    printf("  --stream_window N        larger files are sent in mmap/sendfile windows of N bytes (1048576)\n");
+    printf("  --notsent_lowat N        TCP_NOTSENT_LOWAT of connections, 0 keeps the kernel default (0)\n");
+    printf("  --keepalive_timeout N    seconds an idle keep-alive connection is kept, 0 disables (60)\n");
+    printf("  --header_timeout N       seconds to receive a complete request header, 0 disables (10)\n");
+    printf("  --send_timeout N         seconds without write progress before closing, 0 disables (60)\n");
+    printf("  --log_file PATH          log file, empty for stdout (stdout)\n");
+    printf("  --log_level LEVEL        debug|info|warn|error|off (info)\n");
+    printf("  --log_file_size N        rotate the log file after N bytes, 0 disables (67108864)\n");
+    printf("  --log_files N            rotated log files to keep (5)\n");
+    printf("  --log_buffer_size N      per-thread log buffer bytes (262144)\n");
+    printf("  --access_log PATH        access log file, empty disables (off)\n");
+    printf("  --access_log_format binary|clf  binary records (see tools/access_log_dump) or text (binary)\n");
+    printf("  --access_log_buffer_size N  per-thread access log buffer bytes (262144)\n");
+}
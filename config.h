@@ -0,0 +1,88 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+    服务器的运行参数，所有影响性能的参数都可以在运行时调整，不需要重新编译
+    优先级: 默认值 < 配置文件(-c) < 命令行参数
+    配置文件每行一个 key = value，#开头为注释，key与命令行的长选项同名，例如:
+        port = 10000
+        conn_trigger = ET
+    命令行: ./server [-c file] [--key=value | --key value]... [port [reactor_threads [epoll|uring]]]
+*/
+class config {
+public:
+    static const int PATH_LEN = 200;  // doc_root的最大长度
+    static const int CPU_LIST_LEN = 256;  // CPU列表的最大长度
+
+    // 文件内容的发送方式: mmap + writev，头部MSG_MORE + sendfile，或对大文件使用MSG_ZEROCOPY
+    enum SEND_MODE {SEND_WRITEV = 0, SEND_SENDFILE, SEND_ZEROCOPY};
+    // 线程池的调度方式: 所有线程共用一个FIFO队列，或每个线程一个队列 + work stealing
+    enum POOL_MODE {POOL_FIFO = 0, POOL_STEAL};
+    /*
+        监听socket的选项组合(listen_profile)，设置时一次改写下面几个选项，写在它后面的单个选项再覆盖:
+        kernel  - 都不设置，全部用内核的默认值
+        default - 只开TCP_NODELAY
+        latency - TCP_NODELAY + TCP_FASTOPEN，重连的客户端在SYN中带上请求，省一个RTT
+        storm   - 在latency的基础上加TCP_DEFER_ACCEPT，大量短连接时请求到达之前不唤醒reactor
+    */
+    enum LISTEN_PROFILE {PROFILE_KERNEL = 0, PROFILE_DEFAULT, PROFILE_LATENCY, PROFILE_STORM};
+
+    config();
+
+    bool parse_args(int argc, char* argv[]);        // 解析命令行，遇到-c时先加载配置文件
+    bool load_file(const char* path);               // 加载配置文件
+    bool set(const char* key, const char* value);   // 设置一个参数，key不存在或value非法时返回false
+    void set_listen_profile(int profile);
+    void print() const;                             // 打印生效的参数
+    static void usage(const char* prog);
+
+public:
+    int port;                  // 监听端口
+    char doc_root[PATH_LEN];   // 网站根目录
+    bool listen_et;            // 监听socket是否使用边缘触发
+    bool conn_et;              // 连接socket是否使用边缘触发
+    int max_fd;                // 最大的文件描述符个数，也是http_conn数组的大小
+    int max_events;            // epoll_wait一次最多返回的事件个数
+    int backlog;               // listen()的监听队列长度，内核会截到net.core.somaxconn
+    int accept_batch;          // 监听socket每次就绪时最多accept的连接数，剩下的留到处理完这一批事件之后
+    int listen_profile;        // 最后设置的监听选项组合(LISTEN_PROFILE)，只用于打印
+    bool tcp_nodelay;          // 监听socket的TCP_NODELAY，accept到的连接继承它
+    int defer_accept;          // TCP_DEFER_ACCEPT(秒)，连接收到数据之后才能被accept，0为不设置
+    int fastopen;              // TCP_FASTOPEN的队列长度，0为不开启
+    int listen_sndbuf;         // 监听socket的SO_SNDBUF/SO_RCVBUF(字节)，连接继承它们，0为内核自动调整
+    int listen_rcvbuf;
+    int threads;               // 线程池的线程数量
+    int max_requests;          // 线程池请求队列的最大长度
+    int pool_mode;             // 线程池的调度方式(POOL_MODE)
+    int codel_target;          // 过载控制的目标排队时延(毫秒)，0为不控制
+    int codel_interval;        // 排队时延持续超过目标多久(毫秒)开始拒绝新请求
+    int retry_after;           // 过载时503应答的Retry-After(秒)
+    int reactor_threads;       // reactor线程数，0为单reactor + 线程池
+    bool use_uring;            // 是否使用io_uring后端
+    char reactor_cpus[CPU_LIST_LEN];  // reactor线程绑定的CPU列表("0-3,8"或auto)，为空时不绑定
+    char worker_cpus[CPU_LIST_LEN];   // 线程池的工作线程绑定的CPU列表，为空时不绑定
+    bool numa_local;           // 连接数组按reactor所在的NUMA节点分配
+    int read_buffer_size;      // 每个连接的读缓冲区的初始大小
+    int read_buffer_max;       // 请求头部较大时读缓冲区可以增长到的大小，请求行和头部超过它时关闭连接
+    int write_buffer_size;     // 每个连接的写缓冲区(应答头部)大小
+    int file_cache_entries;    // 文件描述符缓存的最大条目数，0为不使用缓存
+    int response_cache_size;   // 应答缓存的内存预算(字节)，0为不使用，依赖文件缓存的失效通知
+    int response_cache_max_object;  // 可以缓存的单个应答的最大字节数
+    int send_mode;             // 文件内容的发送方式(SEND_MODE)，只对epoll后端有效
+    int zerocopy_threshold;    // zerocopy模式下文件达到这个字节数才使用MSG_ZEROCOPY
+    int stream_window;         // 大于这个字节数的文件按窗口分段映射或sendfile发送
+    int notsent_lowat;         // 连接socket的TCP_NOTSENT_LOWAT(字节)，内核中还没发出的数据超过它时不再写入，0为不设置
+    int keepalive_timeout;     // 长连接等待下一个请求的秒数，0为不限
+    int header_timeout;        // 从连接建立或请求的第一个字节起收完请求头的秒数，0为不限
+    int send_timeout;          // 发送应答时两次有进展的写之间的最长秒数，0为不限
+    char log_file[PATH_LEN];   // 日志文件，为空时写到标准输出
+    int log_level;             // 日志级别(logger::LEVEL)
+    int log_file_size;         // 日志文件超过这个字节数时轮转，0为不轮转
+    int log_files;             // 轮转时保留的旧日志文件个数
+    int log_buffer_size;       // 每个线程的日志缓冲区字节数
+    char access_log_file[PATH_LEN];  // 访问日志文件(选项名access_log)，为空时不记录
+    int access_log_format;     // 访问日志格式(access_log::FORMAT)
+    int access_log_buffer_size;  // 每个线程的访问日志缓冲区字节数
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "conn_table.h"
+#include <stdio.h>
+#include <new>
+#include "topology.h"
+#include "locker.h"
+
+conn_table::conn_table(): m_users(NULL), m_size(0), m_chunk_count(0), m_chunks(NULL), m_constructed(0) {
+}
+
+conn_table::~conn_table() {
+    if(!m_users) {
+        return;
+    }
+    for(int c = 0; c < m_chunk_count; c++) {
+        if(m_chunks[c].load() != READY) {
+            continue;
+        }
+        int end = (c + 1) * CHUNK < m_size ? (c + 1) * CHUNK : m_size;
+        for(int i = c * CHUNK; i < end; i++) {
+            m_users[i].~http_conn();
+        }
+    }
+    topology::release(m_users, sizeof(http_conn) * m_size);
+    delete[] m_chunks;
+}
+
+bool conn_table::init(int max_fd, const int* nodes, int node_count) {
+    // 匿名映射在第一次写之前不占物理内存
+    m_users = (http_conn*) topology::alloc(sizeof(http_conn) * max_fd, nodes, node_count);
+    if(!m_users) {
+        return false;
+    }
+    m_size = max_fd;
+    m_chunk_count = (max_fd + CHUNK - 1) / CHUNK;
+    m_chunks = new std::atomic<char>[m_chunk_count];
+    for(int c = 0; c < m_chunk_count; c++) {
+        m_chunks[c].store(EMPTY, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// 抢到构造权的线程构造这一段，其它同时accept到这一段fd的线程等它完成
+void conn_table::construct(int chunk) {
+    char state = EMPTY;
+    if(!m_chunks[chunk].compare_exchange_strong(state, BUSY, std::memory_order_acquire)) {
+        while(m_chunks[chunk].load(std::memory_order_acquire) != READY) {
+            cpu_relax();
+        }
+        return;
+    }
+    int end = (chunk + 1) * CHUNK < m_size ? (chunk + 1) * CHUNK : m_size;
+    for(int i = chunk * CHUNK; i < end; i++) {
+        new(m_users + i) http_conn;
+    }
+    m_constructed.fetch_add(end - chunk * CHUNK, std::memory_order_relaxed);
+    m_chunks[chunk].store(READY, std::memory_order_release);
+}
+
+void conn_table::print_stats() const {
+    printf("connection table: slots=%d constructed=%ld (%ld KB) conn_size=%lu\n", m_size, resident(),
+           resident() * (long)sizeof(http_conn) >> 10, (unsigned long)sizeof(http_conn));
+}
@@ -0,0 +1,49 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stddef.h>
+#include <atomic>
+#include "http_conn.h"
+
+/*
+    以fd为下标的连接数组，所有reactor共用(fd在进程内唯一)
+    整个数组一次mmap出地址空间，但只在某一段fd第一次被accept时才构造这一段(CHUNK个连接)，
+    没有用到的fd不占物理内存，max_fd可以设到百万级；构造过的段一直保留到进程退出
+    http_conn本身只有连接一直需要的数据，请求状态和缓冲区在有请求时才从池中分配
+*/
+class conn_table {
+public:
+    static const int CHUNK = 256;                  // 一次构造的连接个数
+
+    conn_table();
+    ~conn_table();
+
+    // 分配max_fd个连接的地址空间，按nodes中的NUMA节点放置(见topology::alloc)
+    bool init(int max_fd, const int* nodes, int node_count);
+    http_conn* users() const { return m_users; }
+    int size() const { return m_size; }
+    // 新连接的fd在使用前调用，保证它所在的段已经构造，多个reactor可以同时调用
+    void prepare(int fd) {
+        if(m_chunks[fd / CHUNK].load(std::memory_order_acquire) != READY) {
+            construct(fd / CHUNK);
+        }
+    }
+    long resident() const { return m_constructed.load(); }                // 构造过的连接个数
+    void print_stats() const;
+
+private:
+    enum CHUNK_STATE {EMPTY = 0, BUSY, READY};
+
+    conn_table(const conn_table&);
+    conn_table& operator=(const conn_table&);
+    void construct(int chunk);
+
+private:
+    http_conn* m_users;
+    int m_size;
+    int m_chunk_count;
+    std::atomic<char>* m_chunks;                   // 每一段的构造状态(CHUNK_STATE)
+    std::atomic<long> m_constructed;
+};
+
+#endif
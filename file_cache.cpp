@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include "file_cache.h"
+#include "log.h"
+
+// inotify需要关注的事件: 内容或属性变化、删除、移动，以及新建(新建子目录时加入监视)
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                                 | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+file_cache::file_cache():
+    m_max_per_shard(1), m_max_map(0), m_inotify_fd(-1), m_thread(0), m_listener(NULL), m_listener_arg(NULL),
+    m_hits(0), m_misses(0), m_invalidations(0) {
+}
+
+file_cache::~file_cache() {
+    m_listener = NULL;
+    clear();
+    if(m_inotify_fd != -1) {
+        close(m_inotify_fd);
+    }
+}
+
+bool file_cache::init(const char* doc_root, int max_entries, long max_map) {
+    m_doc_root = doc_root;
+    m_max_map = max_map;
+    while(m_doc_root.size() > 1 && m_doc_root[m_doc_root.size() - 1] == '/') {
+        m_doc_root.erase(m_doc_root.size() - 1);
+    }
+    m_max_per_shard = (max_entries + SHARD_COUNT - 1) / SHARD_COUNT;
+    if(m_max_per_shard < 1) {
+        m_max_per_shard = 1;
+    }
+
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(m_inotify_fd < 0) {
+        LOG_ERROR("inotify_init1 failure: %s", strerror(errno));
+        return false;
+    }
+    add_watch("");
+    if(pthread_create(&m_thread, NULL, watcher, this) != 0) {
+        return false;
+    }
+    pthread_detach(m_thread);
+    return true;
+}
+
+bool file_cache::normalize(const char* url, char* out, int size) {
+    int len = 0;
+    const char* p = url;
+    while(*p) {
+        while(*p == '/') {
+            p++;
+        }
+        const char* seg = p;
+        while(*p && *p != '/') {
+            p++;
+        }
+        int seg_len = p - seg;
+        if(seg_len == 0 || (seg_len == 1 && seg[0] == '.')) {
+            continue;
+        }
+        if(seg_len == 2 && seg[0] == '.' && seg[1] == '.') {  // 回到上一级目录，不能越过根目录
+            if(len == 0) {
+                return false;
+            }
+            while(len > 0 && out[--len] != '/') {
+            }
+            continue;
+        }
+        if(len + 1 + seg_len >= size) {
+            return false;
+        }
+        out[len++] = '/';
+        memcpy(out + len, seg, seg_len);
+        len += seg_len;
+    }
+    if(len == 0) {
+        if(size < 2) {
+            return false;
+        }
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return true;
+}
+
+file_cache::shard& file_cache::get_shard(const std::string& key) {
+    return m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+}
+
+void file_cache::push_front(shard& s, file_entry* entry) {
+    entry->prev = NULL;
+    entry->next = s.head;
+    if(s.head) {
+        s.head->prev = entry;
+    }
+    s.head = entry;
+    if(!s.tail) {
+        s.tail = entry;
+    }
+}
+
+void file_cache::unlink(shard& s, file_entry* entry) {
+    s.map.erase(entry->key);
+    if(entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        s.head = entry->next;
+    }
+    if(entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        s.tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+    entry->cached = false;
+    s.count--;
+    release(entry);  // 释放缓存持有的引用，正在发送的连接仍然可以使用它
+}
+
+void file_cache::destroy(file_entry* entry) {
+    if(entry->addr) {
+        munmap(entry->addr, entry->st.st_size);
+    }
+    if(entry->fd != -1) {
+        close(entry->fd);
+    }
+    delete entry;
+}
+
+void file_cache::release(file_entry* entry) {
+    if(entry->refs.fetch_sub(1) == 1) {
+        destroy(entry);
+    }
+}
+
+// 与原来do_request中的检查相同: 文件存在、对所有用户可读、不是目录
+file_cache::RESULT file_cache::load(file_entry* entry) {
+    std::string path = m_doc_root + entry->key;
+    if(stat(path.c_str(), &entry->st) < 0) {
+        return FILE_NOT_FOUND;
+    }
+    if(!(entry->st.st_mode & S_IROTH)) {
+        return FILE_FORBIDDEN;
+    }
+    if(S_ISDIR(entry->st.st_mode)) {
+        return FILE_IS_DIR;
+    }
+    entry->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(entry->fd < 0) {
+        return FILE_FORBIDDEN;
+    }
+    if(entry->st.st_size > m_max_map) {  // 大文件只缓存fd，顺序读提示内核加大预读
+        posix_fadvise(entry->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    else if(entry->st.st_size > 0) {
+        void* addr = mmap(0, entry->st.st_size, PROT_READ, MAP_PRIVATE, entry->fd, 0);
+        if(addr == MAP_FAILED) {
+            return FILE_NOT_FOUND;
+        }
+        entry->addr = (char*)addr;
+    }
+    return FILE_OK;
+}
+
+file_entry* file_cache::acquire(const char* url, RESULT* result) {
+    char key[256];
+    if(!normalize(url, key, sizeof(key))) {
+        *result = FILE_BAD_PATH;
+        return NULL;
+    }
+    std::string k(key);
+    shard& s = get_shard(k);
+
+    s.lock.lock();
+    std::unordered_map<std::string, file_entry*>::iterator it = s.map.find(k);
+    if(it != s.map.end()) {
+        file_entry* entry = it->second;
+        entry->refs++;
+        // 其它线程正在加载同一个文件，等待它的结果而不是重复加载
+        while(entry->state == file_entry::LOADING) {
+            s.loaded.wait(s.lock.get());
+        }
+        if(entry->state == file_entry::READY) {
+            if(entry->cached && s.head != entry) {  // 移到LRU链表头部
+                file_entry* prev = entry->prev;
+                prev->next = entry->next;
+                if(entry->next) {
+                    entry->next->prev = prev;
+                } else {
+                    s.tail = prev;
+                }
+                push_front(s, entry);
+            }
+            s.lock.unlock();
+            m_hits++;
+            *result = FILE_OK;
+            return entry;
+        }
+        *result = (RESULT)entry->error;
+        s.lock.unlock();
+        release(entry);
+        return NULL;
+    }
+
+    // 未命中: 先放入一个LOADING状态的条目占位，再在锁外加载
+    m_misses++;
+    file_entry* entry = new file_entry;
+    entry->key = k;
+    entry->fd = -1;
+    entry->addr = NULL;
+    entry->state = file_entry::LOADING;
+    entry->error = FILE_OK;
+    entry->cached = true;
+    entry->refs = 2;  // 缓存一个，调用者一个
+    s.map[k] = entry;
+    push_front(s, entry);
+    s.count++;
+    while(s.count > m_max_per_shard && s.tail != entry) {  // 淘汰最久没有使用的条目
+        unlink(s, s.tail);
+    }
+    s.lock.unlock();
+
+    RESULT r = load(entry);
+
+    s.lock.lock();
+    entry->state = r == FILE_OK ? file_entry::READY : file_entry::FAILED;
+    entry->error = r;
+    if(r != FILE_OK && entry->cached) {  // 失败的结果不缓存
+        unlink(s, entry);
+    }
+    s.loaded.broadcast();
+    s.lock.unlock();
+
+    *result = r;
+    if(r != FILE_OK) {
+        release(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+void file_cache::invalidate(const char* key) {
+    std::string k(key);
+    shard& s = get_shard(k);
+    s.lock.lock();
+    std::unordered_map<std::string, file_entry*>::iterator it = s.map.find(k);
+    if(it != s.map.end()) {
+        unlink(s, it->second);
+        m_invalidations++;
+    }
+    s.lock.unlock();
+    // 不在文件缓存中的文件也可能有别的缓存数据，总是通知
+    if(m_listener) {
+        m_listener(key, m_listener_arg);
+    }
+}
+
+void file_cache::clear() {
+    for(int i = 0; i < SHARD_COUNT; i++) {
+        shard& s = m_shards[i];
+        s.lock.lock();
+        while(s.head) {
+            unlink(s, s.head);
+            m_invalidations++;
+        }
+        s.lock.unlock();
+    }
+    if(m_listener) {
+        m_listener(NULL, m_listener_arg);
+    }
+}
+
+void file_cache::set_listener(invalidate_fn fn, void* arg) {
+    m_listener = fn;
+    m_listener_arg = arg;
+}
+
+void file_cache::print_stats() const {
+    printf("file cache: hits=%ld misses=%ld invalidations=%ld\n",
+           m_hits.load(), m_misses.load(), m_invalidations.load());
+}
+
+// 监视目录dir(相对doc_root)及其所有子目录，inotify本身不递归
+void file_cache::add_watch(const std::string& dir) {
+    std::string full = m_doc_root + dir;
+    int wd = inotify_add_watch(m_inotify_fd, full.c_str(), WATCH_MASK);
+    if(wd < 0) {
+        return;
+    }
+    m_watch_dirs[wd] = dir;
+
+    DIR* dp = opendir(full.c_str());
+    if(!dp) {
+        return;
+    }
+    struct dirent* de;
+    while((de = readdir(dp)) != NULL) {
+        if(de->d_type != DT_DIR || strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        add_watch(dir + "/" + de->d_name);
+    }
+    closedir(dp);
+}
+
+void* file_cache::watcher(void* arg) {
+    file_cache* cache = (file_cache*) arg;
+    cache->watch_loop();
+    return cache;
+}
+
+void file_cache::watch_loop() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true) {
+        int len = read(m_inotify_fd, buf, sizeof(buf));
+        if(len <= 0) {
+            if(len < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for(char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if(ev->mask & IN_Q_OVERFLOW) {  // 事件丢失了，不知道哪些文件变了
+                clear();
+                continue;
+            }
+            std::unordered_map<int, std::string>::iterator it = m_watch_dirs.find(ev->wd);
+            if(it == m_watch_dirs.end()) {
+                continue;
+            }
+            if(ev->mask & IN_IGNORED) {  // 目录被删除，监视自动失效
+                m_watch_dirs.erase(it);
+                continue;
+            }
+            if(ev->len == 0) {  // 被监视的目录自身被删除或移动
+                continue;
+            }
+            std::string path = it->second + "/" + ev->name;
+            if(ev->mask & IN_ISDIR) {
+                // 子目录被创建、删除或移动，它下面的任何文件都可能变了
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    add_watch(path);
+                }
+                clear();
+                continue;
+            }
+            invalidate(path.c_str());
+        }
+    }
+}
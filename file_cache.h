@@ -0,0 +1,103 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+
+/*
+    静态文件描述符缓存: 缓存热点文件的fd、struct stat和mmap映射，命中时do_request不再需要stat/open/mmap/close，
+    应答发送完也不需要munmap
+    1. 以规范化后的URL路径为key(相对doc_root)，按哈希分成若干个分片，每个分片一把锁和一个LRU链表
+    2. 条目带引用计数，连接在发送期间持有引用，被淘汰或失效的条目在最后一个引用释放时才munmap和close
+    3. 同一个文件的并发未命中只有第一个线程去加载，其余线程在分片的条件变量上等待加载结果
+    4. 后台线程用inotify监视doc_root(包括子目录)，文件被修改、删除或移动时使对应条目失效，
+       并通知监听者(应答缓存)，使由该文件生成的数据也失效
+*/
+
+/*缓存条目*/
+struct file_entry {
+    enum STATE {LOADING = 0, READY, FAILED};
+
+    std::string key;            // 规范化后的相对路径
+    int fd;                     // 打开的文件描述符
+    struct stat st;             // 文件状态
+    char* addr;                 // mmap映射的起始地址，空文件和超过max_map的大文件为NULL
+    int state;                  // 加载状态，分片锁保护
+    int error;                  // 加载失败时的结果(file_cache::RESULT)
+    bool cached;                // 是否还在缓存中，分片锁保护
+    std::atomic<int> refs;      // 引用计数，缓存本身持有一个引用
+    file_entry* prev;           // LRU链表，越靠前越新
+    file_entry* next;
+};
+
+class file_cache {
+public:
+    // 查找的结果，与http_conn的HTTP_CODE一一对应
+    enum RESULT {FILE_OK = 0, FILE_NOT_FOUND, FILE_FORBIDDEN, FILE_IS_DIR, FILE_BAD_PATH};
+
+    static const int SHARD_COUNT = 16;  // 分片个数
+
+    // 失效通知，key为规范化后的路径，为NULL表示全部失效
+    typedef void (*invalidate_fn)(const char* key, void* arg);
+
+    file_cache();
+    ~file_cache();
+
+    bool init(const char* doc_root, int max_entries, long max_map);  // 设置根目录、容量和整体映射的最大文件大小，并启动inotify线程
+    file_entry* acquire(const char* url, RESULT* result);  // 查找或加载文件，成功时返回持有一个引用的条目
+    void release(file_entry* entry);                   // 释放acquire得到的引用
+    void invalidate(const char* key);                  // 使一个文件的条目失效
+    void clear();                                      // 清空整个缓存
+    void set_listener(invalidate_fn fn, void* arg);    // 设置失效通知，在init之前调用
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+    long invalidations() const { return m_invalidations; }
+    void print_stats() const;
+
+    // 把URL规范化为相对doc_root的路径: 合并多余的'/'，去掉"."，处理".."，越过根目录返回false
+    static bool normalize(const char* url, char* out, int size);
+
+private:
+    struct shard {
+        locker lock;
+        cond loaded;                                   // 有条目加载完成时广播
+        std::unordered_map<std::string, file_entry*> map;
+        file_entry* head;                              // LRU链表头(最新)
+        file_entry* tail;                              // LRU链表尾(最旧)
+        int count;
+        shard(): head(NULL), tail(NULL), count(0) {}
+    };
+
+    shard& get_shard(const std::string& key);
+    RESULT load(file_entry* entry);                    // 在锁外完成stat/open/mmap
+    void unlink(shard& s, file_entry* entry);          // 从分片中移除，调用者持有分片锁
+    void push_front(shard& s, file_entry* entry);
+    static void destroy(file_entry* entry);
+
+    static void* watcher(void* arg);                   // inotify线程
+    void watch_loop();
+    void add_watch(const std::string& dir);            // 监视dir及其所有子目录
+
+private:
+    std::string m_doc_root;
+    int m_max_per_shard;                               // 每个分片最多缓存的条目数
+    long m_max_map;                                    // 超过这个大小的文件不整体映射，由连接分段发送
+    shard m_shards[SHARD_COUNT];
+
+    int m_inotify_fd;
+    std::unordered_map<int, std::string> m_watch_dirs; // inotify wd -> 相对doc_root的目录，只在inotify线程中访问
+    pthread_t m_thread;
+    invalidate_fn m_listener;
+    void* m_listener_arg;
+
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_invalidations;
+};
+
+#endif
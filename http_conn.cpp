@@ -1,29 +1,46 @@
 #include "http_conn.h"
-
-// #define connfdLT    // 水平触发阻塞
-#define connfdET    // 边缘触发非阻塞
-
-#define listenfdLT  // 水平触发阻塞
-// #define listenfdET  // 边缘触发非阻塞
+#include "http_scanner.h"
+#include "log.h"
+#include "access_log.h"
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+#include <ctype.h>
+#include <time.h>
+#include <new>
 
 // 静态值的初始化
-// 所有socket上的事件都被注册到同一个epoll对象中
-int http_conn::m_epollfd = -1;
 // 统计所有用户的数量
-int http_conn::m_user_count = 0;
-// 网站的根目录
-const char* doc_root = "/home/admin1/Simple-Web-Server/resources";
-
-/*定义HTTP响应的一些状态信息*/
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+std::atomic<int> http_conn::m_user_count(0);
+// 以下参数由setup()根据配置设置
+bool http_conn::m_conn_et = true;
+bool http_conn::m_oneshot = false;
+int http_conn::m_read_buffer_size = 2048;
+int http_conn::m_read_buffer_max = 65536;
+int http_conn::m_write_buffer_size = 1024;
+const char* http_conn::m_doc_root = NULL;
+file_cache* http_conn::m_file_cache = NULL;
+response_cache* http_conn::m_response_cache = NULL;
+int http_conn::m_send_mode = config::SEND_WRITEV;
+int http_conn::m_zerocopy_threshold = 65536;
+int http_conn::m_stream_window = 1 << 20;
+int http_conn::m_notsent_lowat = 0;
+char http_conn::m_boundary[32];
+char http_conn::m_overload_response[128];
+int http_conn::m_overload_len = 0;
+std::atomic<long> http_conn::m_zerocopy_sends(0);
+std::atomic<long> http_conn::m_zerocopy_done(0);
+std::atomic<long> http_conn::m_zerocopy_copied(0);
+int http_conn::m_keepalive_timeout = 0;
+int http_conn::m_header_timeout = 0;
+int http_conn::m_send_timeout = 0;
+std::atomic<long> http_conn::m_timeouts[http_conn::TIMER_STATES];
+slab_pool* http_conn::m_state_pool = NULL;
+std::atomic<long> http_conn::m_rejected(0);
+slab_pool* http_conn::m_read_pools[http_conn::READ_CLASSES];
+int http_conn::m_read_class_count = 0;
+
+/*416应答的页面内容，其它状态行和错误应答在http_response中*/
+const char error_416_form[] = "The requested range is not satisfiable.\n";
 
 // 设置文件描述符非阻塞
 int setnonblocking(int fd) {
@@ -33,30 +50,17 @@ int setnonblocking(int fd) {
     return old_flag;
 }
 
-// 向epoll中添加需要监听的文件描述符（内核事件表注册新事件 放树上）
-void addfd(int epollfd, int fd, bool one_shot) {
+// 向epoll中添加需要监听的文件描述符（内核事件表注册新事件 放树上），et表示是否使用边缘触发
+void addfd(int epollfd, int fd, bool one_shot, bool et) {
     epoll_event event;
     event.data.fd = fd;
-
-#ifdef connfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
-    event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdLT
     event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
+    if(et) {
+        event.events |= EPOLLET;
+    }
     if(one_shot) {
         // 针对客户端连接的文件描述符connfd，开启EPOLLONESHOT，监听描述符listenfd不用开启，我们希望每个连接的socket在任意时刻都只被一个线程处理
-        event.events | EPOLLONESHOT;
+        event.events |= EPOLLONESHOT;
     }
     //往epoll事件表中注册fd上的事件
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
@@ -66,67 +70,269 @@ void addfd(int epollfd, int fd, bool one_shot) {
 
 // 从epoll中移除监听的文件描述符（内核事件表删除事件）
 void removefd(int epollfd, int fd){
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    if(epollfd != -1) {  // io_uring后端的连接没有注册到epoll上
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    }
     close(fd);
 }
 
 // 修改文件描述符，重置socket上EPOLLONESHOT事件，确保下一次可读时，EPOLLIN事件能被触发
-void modfd(int epollfd, int fd, int ev) {
+void modfd(int epollfd, int fd, int ev, bool et) {
     epoll_event event;
     event.data.fd = fd;
-
-#ifdef connfdET
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
-#endif
-
+    if(et) {
+        event.events |= EPOLLET;
+    }
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
+void http_conn::setup(const config& cfg) {
+    m_conn_et = cfg.conn_et;
+    m_oneshot = !cfg.conn_et;
+    m_read_buffer_size = cfg.read_buffer_size;
+    m_write_buffer_size = cfg.write_buffer_size;
+    m_doc_root = cfg.doc_root;
+    m_send_mode = cfg.send_mode;
+    m_zerocopy_threshold = cfg.zerocopy_threshold;
+    m_keepalive_timeout = cfg.keepalive_timeout * 1000;
+    m_header_timeout = cfg.header_timeout * 1000;
+    m_send_timeout = cfg.send_timeout * 1000;
+    // 窗口的起点要按页对齐，大小取页大小的整数倍
+    long page = sysconf(_SC_PAGESIZE);
+    m_stream_window = (cfg.stream_window + page - 1) / page * page;
+    out_queue::setup(m_stream_window);
+    m_notsent_lowat = cfg.notsent_lowat;
+    m_state_pool = new slab_pool(sizeof(request_state) + m_read_buffer_size + m_write_buffer_size);
+    // 读缓冲区每级翻倍，最后一级是read_buffer_max；大的缓冲区每个slab少放几个
+    m_read_buffer_max = cfg.read_buffer_max > m_read_buffer_size ? cfg.read_buffer_max : m_read_buffer_size;
+    for(int size = m_read_buffer_size; size < m_read_buffer_max && m_read_class_count < READ_CLASSES; ) {
+        size = size * 2 < m_read_buffer_max ? size * 2 : m_read_buffer_max;
+        int per_slab = (1 << 20) / size;
+        per_slab = per_slab < 4 ? 4 : (per_slab > slab_pool::OBJECTS_PER_SLAB ? slab_pool::OBJECTS_PER_SLAB : per_slab);
+        m_read_pools[m_read_class_count++] = new slab_pool(size, per_slab);
+    }
+    // 按CPU支持的指令集选择请求扫描的实现
+    LOG_INFO("request scanner: %s", http_scanner::isa_name(http_scanner::init()));
+    http_response::init();
+    snprintf(m_boundary, sizeof(m_boundary), "%08lx%08x", (unsigned long)time(NULL), (unsigned)getpid() * 2654435761u);
+    // 过载时reactor直接发送这个应答，不解析请求、不经过线程池
+    int line_len = 0;
+    const char* line = http_response::status_line(503, &line_len);
+    m_overload_len = snprintf(m_overload_response, sizeof(m_overload_response),
+                              "%.*sRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                              line_len, line, cfg.retry_after);
+    if(cfg.file_cache_entries > 0) {
+        m_file_cache = new file_cache;
+        if(!m_file_cache->init(cfg.doc_root, cfg.file_cache_entries, m_stream_window)) {
+            LOG_WARN("file cache disabled");
+            delete m_file_cache;
+            m_file_cache = NULL;
+        }
+    }
+    // 应答缓存依赖文件缓存的inotify线程在文件变化时使应答失效
+    if(cfg.response_cache_size > 0 && m_file_cache) {
+        m_response_cache = new response_cache;
+        if(!m_response_cache->init(cfg.response_cache_size, cfg.response_cache_max_object)) {
+            LOG_WARN("response cache disabled");
+            delete m_response_cache;
+            m_response_cache = NULL;
+        } else {
+            m_file_cache->set_listener(response_cache::on_file_invalidate, m_response_cache);
+        }
+    }
+}
+
+void http_conn::print_stats() {
+    printf("accept: rejected=%ld (connection table full or out of fds)\n", m_rejected.load());
+    m_state_pool->print_stats("request state");
+    for(int i = 0; i < m_read_class_count; i++) {
+        m_read_pools[i]->print_stats("read buffer");
+    }
+}
+
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init_conn(int sockfd, const sockaddr_in& addr) {
+void http_conn::init_conn(int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* wheel) {
     m_sockfd = sockfd;
     m_address = addr;
-    
-    // 设置m_sockfd端口复用
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    
+    m_epollfd = epollfd;
+    m_wheel = wheel;
+    m_timer.data = this;
+    m_processing = false;
+    m_deferred = 0;
+    m_result = NO_REQUEST;
+    m_zerocopy_enabled = false;
+    m_zerocopy_pending = 0;
+    m_keep_alive = false;
+
+    // 发送缓冲区中还没有发出的数据超过它时socket不可写，应答留在输出队列中，不把整个文件塞进内核
+    if(m_notsent_lowat > 0) {
+        setsockopt(m_sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &m_notsent_lowat, sizeof(m_notsent_lowat));
+    }
+
     // 将accept()到的socket文件描述符connfd注册到内核事件表中，等用户发来请求报文
-    addfd(m_epollfd, sockfd, true);
+    // accept4已经把它设为非阻塞；epollfd为-1时由io_uring后端负责该连接的读写
+    if(m_epollfd != -1) {
+        epoll_event event;
+        event.data.fd = sockfd;
+        if(m_oneshot) {
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        } else {
+            // 边缘触发下EPOLLOUT只在发送缓冲区由满变为可写时通知，一直注册着也不会反复触发
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        }
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    }
     // 总用户数加1
     m_user_count++;
 
+    // 请求状态和缓冲区等第一次读数据时再分配，没有发来数据的连接不占用它们
+    // 新连接要在header_timeout内发来第一个完整的请求
+    set_timer(TIMER_HEADER, m_header_timeout);
+}
+
+// 请求状态和读写缓冲区在池中的一块内存中: [request_state][读缓冲区][写缓冲区]
+bool http_conn::acquire_state() {
+    if(m_req) {
+        return true;
+    }
+    void* block = m_state_pool->alloc();
+    if(!block) {
+        LOG_ERROR("cannot allocate request state for connection %d", m_sockfd);
+        return false;
+    }
+    m_req = new(block) request_state;
+    m_req->read_buf = (char*)block + sizeof(request_state);
+    m_req->read_size = m_read_buffer_size;
+    m_req->read_class = -1;
+    m_req->write_buf = m_req->read_buf + m_read_buffer_size;
     init();
+    return true;
+}
+
+void http_conn::release_state() {
+    if(access_log::enabled()) {
+        access_abort();
+    }
+    unmap();
+    delete m_req->pipe;
+    if(m_req->read_class >= 0) {
+        m_read_pools[m_req->read_class]->free(m_req->read_buf);
+    }
+    m_req->~request_state();                // 输出队列析构时释放没有发送完的应答持有的映射、fd和引用
+    m_state_pool->free(m_req);
+    m_req = NULL;
+}
+
+// 应答都发送完、读缓冲区中也没有流水线上的下一个请求时，连接回到空闲状态
+void http_conn::release_if_idle() {
+    if(m_req && m_req->read_idx == 0 && m_req->out.empty()) {
+        release_state();
+    }
+}
+
+/*
+    请求行和头部在读缓冲区中必须是连续的(头部表记录的是偏移，url和version指向缓冲区)，
+    所以增长时整块拷贝到大一级的缓冲区，再修正指向缓冲区的指针
+*/
+bool http_conn::grow_read_buf() {
+    int cls = m_req->read_class + 1;
+    if(cls >= m_read_class_count) {
+        return false;
+    }
+    char* buf = (char*)m_read_pools[cls]->alloc();
+    if(!buf) {
+        return false;
+    }
+    char* old = m_req->read_buf;
+    memcpy(buf, old, m_req->read_idx);
+    if(m_req->url) {
+        m_req->url = buf + (m_req->url - old);
+    }
+    if(m_req->version) {
+        m_req->version = buf + (m_req->version - old);
+    }
+    if(m_req->read_class >= 0) {
+        m_read_pools[m_req->read_class]->free(old);
+    }
+    m_req->read_buf = buf;
+    m_req->read_class = cls;
+    m_req->read_size = m_read_pools[cls]->object_size() < (size_t)m_read_buffer_max ? m_read_pools[cls]->object_size() : m_read_buffer_max;
+    return true;
+}
+
+/*
+    在reactor线程中调用: slab_pool的空闲链表是每个线程一份，在工作线程中释放的缓冲区reactor再也拿不到
+    还没有开始解析请求行时url和version都是空的，头部表记录的是偏移，缓冲区可以整体搬走
+*/
+void http_conn::shrink_read_buf() {
+    if(!m_req || m_req->read_class < 0 || m_req->read_idx > m_read_buffer_size ||
+       m_req->check_state != CHECK_STATE_REQUESTLINE) {
+        return;
+    }
+    char* inline_buf = (char*)m_req + sizeof(request_state);
+    memcpy(inline_buf, m_req->read_buf, m_req->read_idx);
+    m_read_pools[m_req->read_class]->free(m_req->read_buf);
+    m_req->read_buf = inline_buf;
+    m_req->read_size = m_read_buffer_size;
+    m_req->read_class = -1;
 }
 
 void http_conn::init() {
-    bytes_to_send = 0;
-    bytes_have_send = 0;
-
-    m_check_state = CHECK_STATE_REQUESTLINE;  // 初始化状态为解析请求首行
-    m_linger = false;  // 默认不保持链接Connection :keep-alive保持连接
-
-    m_method = GET;    // 默认请求方式为GET
-    m_url = 0;
-    m_version = 0;
-    m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_checked_index = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    m_req->checked_index = 0;
+    m_req->read_idx = 0;
+    m_req->access_pending = false;
+    m_req->file_address = NULL;
+    m_req->file_fd = -1;
+    m_req->entry = NULL;
+    m_req->cached = NULL;
+    m_req->error = NULL;
+    m_req->pipe = NULL;
+    m_req->deferred = NO_REQUEST;
+    init_request();
+    init_response();
+}
+
+void http_conn::init_request() {
+    m_req->check_state = CHECK_STATE_REQUESTLINE;  // 初始化状态为解析请求首行
+    m_req->linger = false;  // 默认不保持链接Connection :keep-alive保持连接
+
+    m_req->method = GET;    // 默认请求方式为GET
+    m_req->url = 0;
+    m_req->version = 0;
+    m_req->content_length = 0;
+    m_req->body_left = 0;
+    m_req->headers.clear();
+
+    // checked_index是上一个请求的结束位置，之后的数据是客户端流水线发来的后续请求，不能丢弃
+    int left = m_req->read_idx - m_req->checked_index;
+    if(left > 0 && m_req->checked_index > 0) {
+        memmove(m_req->read_buf, m_req->read_buf + m_req->checked_index, left);
+    }
+    m_req->read_idx = left > 0 ? left : 0;
+    m_req->start_line = 0;
+    m_req->checked_index = 0;
+    // 流水线上的下一个请求已经在缓冲区中了
+    m_req->request_start = m_req->read_idx > 0 && access_log::enabled() ? access_log::now_us() : 0;
+}
+
+void http_conn::init_response() {
+    m_req->response_bytes = 0;
+    m_req->part_count = 0;
+    m_req->held = 0;
+    m_req->write_idx = 0;
+    m_req->write_start = 0;
+    m_req->first_byte = 0;
 }
 
 // 关闭连接
 void http_conn::close_conn() {
+    if(m_req) {
+        release_state();
+    }
+    if(m_wheel) {
+        m_wheel->cancel(&m_timer);
+    }
     if(m_sockfd != -1) {
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
@@ -135,33 +341,62 @@ void http_conn::close_conn() {
     }
 }
 
+/*
+    过载时拒绝请求: 应答很短，新连接或空闲的长连接的发送缓冲区一定放得下，只发送一次，发送失败也直接关闭；
+    先shutdown写方向，使503之后紧跟FIN
+*/
+void http_conn::shed() {
+    if(m_sockfd != -1) {
+        send(m_sockfd, m_overload_response, m_overload_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        shutdown(m_sockfd, SHUT_WR);
+    }
+    close_conn();
+}
+
+// 连接表已满或fd用完时，刚accept的连接还没有http_conn，同样回答503后关闭
+// 关闭前读掉已经到达的请求，接收队列中留有数据时close会发RST，对方可能来不及读到503
+void http_conn::reject(int sockfd) {
+    char discard[1024];
+    send(sockfd, m_overload_response, m_overload_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    shutdown(sockfd, SHUT_WR);
+    while(recv(sockfd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+    close(sockfd);
+    m_rejected++;
+}
+
 // 非阻塞的读
 // 循环读取客户的数据直到无数据可读
 bool http_conn::read_once() {
-    // 对本程序来说可有可无
-    if(m_read_idx >= READ_BUFFER_SIZE) {
+    if(!acquire_state()) {    // 空闲的连接这时才分配读缓冲区
+        return false;
+    }
+    // 缓冲区满了，已有的请求处理过之后仍然是满的，说明请求行和头部放不下，换成更大的缓冲区
+    if(m_req->read_idx >= m_req->read_size && !grow_read_buf()) {
+        LOG_WARN("request header of connection %d exceeds %d bytes", m_sockfd, m_read_buffer_max);
         return false;
     }
     // 读取到的字节
     int bytes_read = 0;
 
-#ifdef connfdLT
+    if(!m_conn_et) {  // 水平触发: 读一次，没读完的数据epoll会再次通知
 
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-    m_read_idx += bytes_read;
+        bytes_read = recv(m_sockfd, m_req->read_buf + m_req->read_idx, m_req->read_size - m_req->read_idx, 0);
+        if(bytes_read <= 0) {
+            return false;
+        }
+        m_req->read_idx += bytes_read;
+        if(m_req->request_start == 0 && access_log::enabled()) {
+            m_req->request_start = access_log::now_us();
+        }
+        return true;
 
-    if(bytes_read <= 0) {
-        return false;
     }
-    return true;
-
-#endif
-
-#ifdef connfdET
 
-    while(true) {  // recv读到的数据小于我们期望的缓冲区大小，因此要多次调用直到读完
+    while(m_req->read_idx < m_req->read_size) {  // 边缘触发: recv读到的数据小于我们期望的缓冲区大小，因此要多次调用直到读完
+        // 缓冲区满了就先处理已有的(流水线)请求，剩下的数据留在socket中，应答之后重新注册事件时还会通知
         // recv(要读取的socket的fd, 读缓冲区的位置, 读缓冲区的大小, flag一般取0)
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);  // 从套接字接收数据，存储在m_read_buf缓冲区
+        bytes_read = recv(m_sockfd, m_req->read_buf + m_req->read_idx, m_req->read_size - m_req->read_idx, 0);  // 从套接字接收数据，存储在read_buf缓冲区
         if(bytes_read == -1) {
             if(errno == EAGAIN || errno == EWOULDBLOCK) {  // 非阻塞ET模式下，需要一次性将数据读完
                 // EAGAIN、EWOULDBLOCK表示没有数据了
@@ -172,13 +407,16 @@ bool http_conn::read_once() {
             // 对方关闭连接
             return false;
         }
-        m_read_idx += bytes_read;  // 修改m_read_idx的读取字节数
+        m_req->read_idx += bytes_read;  // 修改read_idx的读取字节数
     }
-    printf("[INFO] 读取到了请求报文: \n%s\n", m_read_buf);
+    if(m_req->read_idx >= m_req->read_size && !m_oneshot) {
+        m_deferred |= EPOLLIN;     // socket中可能还有数据，不会再有新的边沿通知，处理完之后由reactor接着读
+    }
+    if(m_req->request_start == 0 && m_req->read_idx > 0 && access_log::enabled()) {
+        m_req->request_start = access_log::now_us();
+    }
+    LOG_DEBUG("读取到了请求报文: \n%.*s", m_req->read_idx, m_req->read_buf);
     return true;
-    
-#endif
-
 }
 
 /* 
@@ -186,47 +424,47 @@ bool http_conn::read_once() {
     解析(获取)一行，判断依据\r\n
 */
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
-    for( ; m_checked_index < m_read_idx ; ++m_checked_index) {
-        temp = m_read_buf[m_checked_index];                       // 从m_read_buf中逐字节读取
-        if(temp == '\r') {                                        // 如果当前字节为\r
-            if((m_checked_index + 1) == m_read_idx) {             // 接下来达到了buffer末尾，表示buffer还需要继续接收，返回LINE_OPEN
-                return LINE_OPEN;
-            } else if(m_read_buf[m_checked_index + 1] == '\n') {  // "\r"接下来的字符是"\n"，则将"\r\n"修改成"\0\0"，且将m_checked_index指向下一行的开头
-                m_read_buf[m_checked_index++] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;                                   // 完整读取到一行
-            }
-            return LINE_BAD;                                      // 否则，表示语法错误，返回LINE_BAD
-        } else if(temp == '\n') {                                 // 当前字节不是"\r"，判断是否是"\n",一般是上次读取到\r就到了buffer末尾，没有接收完整，再次接收时会出现这种情况
-            if((m_checked_index > 1) && (m_read_buf[m_checked_index - 1] == '\r')) {  // 如果前一个字符是"\r"，则将"\r\n"修改为"\0\0",将m_checked_index指向下一行的开头
-                m_read_buf[m_checked_index - 1] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;                                   // 完整读取到一行
-            }
-            return LINE_BAD;
+    // 一次扫描16/32个字节跳过普通字符，停在第一个控制字符上，行中的字符在同一遍中完成校验
+    const char* end = m_req->read_buf + m_req->read_idx;
+    const char* p = http_scanner::find_ctl(m_req->read_buf + m_req->checked_index, end);
+    m_req->checked_index = p - m_req->read_buf;
+    if(p == end) {
+        return LINE_OPEN;                                         // 没有找到行尾，表示接收不完整，需要继续接收
+    }
+    if(*p == '\r') {                                             // 如果当前字节为\r
+        if((m_req->checked_index + 1) == m_req->read_idx) {                 // 接下来达到了buffer末尾，表示buffer还需要继续接收，返回LINE_OPEN
+            return LINE_OPEN;
+        } else if(m_req->read_buf[m_req->checked_index + 1] == '\n') {      // "\r"接下来的字符是"\n"，则将"\r\n"修改成"\0\0"，且将checked_index指向下一行的开头
+            m_req->read_buf[m_req->checked_index++] = '\0';
+            m_req->read_buf[m_req->checked_index++] = '\0';
+            return LINE_OK;                                       // 完整读取到一行
         }
+        return LINE_BAD;                                          // 否则，表示语法错误，返回LINE_BAD
+    } else if(*p == '\n') {                                      // 一般是上次读取到\r就到了buffer末尾，没有接收完整，再次接收时会出现这种情况
+        if((m_req->checked_index > 1) && (m_req->read_buf[m_req->checked_index - 1] == '\r')) {  // 如果前一个字符是"\r"，则将"\r\n"修改为"\0\0",将checked_index指向下一行的开头
+            m_req->read_buf[m_req->checked_index - 1] = '\0';
+            m_req->read_buf[m_req->checked_index++] = '\0';
+            return LINE_OK;                                       // 完整读取到一行
+        }
+        return LINE_BAD;
     }
-    return LINE_OPEN;                                             // 当前接受的字节既不是"\r"，也不是"\n"，表示接收不完整，需要继续接收
+    return LINE_BAD;                                              // 行中出现了\r\n以外的控制字符(包括\0)
 }
 
 // 解析请求首行(请求行)，获得请求方法，目标URL，HTTP版本号
 // text = "GET /index.html HTTP/1.1"    
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     // 请求行用来说明请求类型,要访问的资源以及所使用的HTTP版本，其中各个部分之间通过\t或空格分隔
-    // C库函数-- strpbck(str1, str2): 检索字符串 str1 中第一个匹配字符串str2中字符的字符，并返回该字符的位置
-    m_url = strpbrk(text, " \t");
-    /*    
-        m_url = " /index.html HTTP/1.1"
-        text  = "GET /index.html HTTP/1.1"    
-    */
-   if(!m_url) {
-       return BAD_REQUEST;   // 如果没有空格或\t，则报文格式有误
-   }  
-
-    *m_url++ = '\0';  // 将该位置改为\0，用于将前面数据取出：字符串数组的结尾为"\0"
+    // 行尾的\r\n已经改成了\0，扫描一定会在行内停下；方法名只能由tchar组成，URL只能由可见字符组成
+    const char* end = m_req->read_buf + m_req->read_idx;
+    char* sep = (char*)http_scanner::find_non_token(text, end);
+    if(sep == text || (*sep != ' ' && *sep != '\t')) {
+        return BAD_REQUEST;   // 方法名为空、含有非法字符或者没有空格和\t，则报文格式有误
+    }
+    *sep = '\0';  // 将该位置改为\0，用于将前面数据取出：字符串数组的结尾为"\0"
+    m_req->url = sep + 1;
     /*    
-        m_url = "/index.html HTTP/1.1"    
+        m_req->url = "/index.html HTTP/1.1"    
         text  = "GET\0/index.html HTTP/1.1" 
     */  
 
@@ -236,50 +474,47 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     */
 
     if(strcasecmp(method, "GET") == 0) {  // 忽略大小写比较，确定请求方式
-        m_method = GET;
+        m_req->method = GET;
+    } else if(strcasecmp(method, "HEAD") == 0) {
+        m_req->method = HEAD;
     } else {
         return BAD_REQUEST;
     }
 
-    m_version = strpbrk(m_url, " \t");
-    /*
-        m_version = " HTTP/1.1"
-        m_url     = "/index.html HTTP/1.1"
-    */
-
-    if(!m_version) {
+    sep = (char*)http_scanner::find_non_vchar(m_req->url, end);
+    if(sep == m_req->url || (*sep != ' ' && *sep != '\t')) {
         return BAD_REQUEST;
     }
-
-    *m_version++ = '\0';
+    *sep = '\0';
+    m_req->version = sep + 1;
     /*
-        m_version = "HTTP/1.1"
-        m_url     = "/index.html\0HTTP/1.1"
+        m_req->version = "HTTP/1.1"
+        m_req->url     = "/index.html\0HTTP/1.1"
     */
 
-    if(strcasecmp(m_version, "HTTP/1.1") != 0) {
+    if(strcasecmp(m_req->version, "HTTP/1.1") != 0) {
         return BAD_REQUEST;
     }
 
     /* 
         去除"http://"和"https://"的影响
-        此时使用m_url已经变成了"/index.html" 
+        此时使用url已经变成了"/index.html" 
     */
     // strncasecmp(str1, str2, n): 用来比较str1和str2前n个字符（忽略大小写），相同则返回0
-    if(strncasecmp(m_url, "http://", 7) == 0) {
-        m_url += 7;
-        m_url = strchr(m_url, '/');
+    if(strncasecmp(m_req->url, "http://", 7) == 0) {
+        m_req->url += 7;
+        m_req->url = strchr(m_req->url, '/');
     }
-    if(strncasecmp(m_url, "https://", 8) == 0) {
-        m_url += 8;
-        m_url = strchr(m_url, '/');   // strchr(str, c): 在参数 str 所指向的字符串中搜索第一次出现字符 c（一个无符号字符）的位置
+    if(strncasecmp(m_req->url, "https://", 8) == 0) {
+        m_req->url += 8;
+        m_req->url = strchr(m_req->url, '/');   // strchr(str, c): 在参数 str 所指向的字符串中搜索第一次出现字符 c（一个无符号字符）的位置
     }
     // 一般的不会带有上述两种符号，直接是单独的/或/后面带访问资源
-    if(!m_url || m_url[0] != '/') {
+    if(!m_req->url || m_req->url[0] != '/') {
         return BAD_REQUEST;
     }
     // 请求行处理完毕，将主状态机转移处理请求头
-    m_check_state = CHECK_STATE_HEADER;
+    m_req->check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
@@ -287,45 +522,61 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     /*遇到空行，表示请求头解析完毕，进而判断content-length是否为0*/
     if(text[0] == '\0') {
-        if(m_content_length != 0) {                // 如果不是0，HTTP请求有消息体，说明是POST请求，则还需要读取m_content_length字节的消息体
-            m_check_state = CHECK_STATE_CONTENT;
+        if(m_req->content_length != 0) {                // 如果不是0，HTTP请求有消息体，说明是POST请求，则还需要读取content_length字节的消息体
+            m_req->check_state = CHECK_STATE_CONTENT;
+            m_req->body_left = m_req->content_length;
             return NO_REQUEST;                     // 状态机转移到CHECK_STATE_CONTENT状态
         }
         /*否则说明没有消息体，是一个GET请求，意味着我们已经得到了一个完整的HTTP请求，报文解析结束*/
         return GET_REQUEST;
-    // 解析请求头部字段
-    } else if(strncasecmp(text, "Connection:", 11) == 0) {
+    }
+    // 头部名必须是token且紧跟冒号；行尾的\r\n在checked_index之前，已经被改成了\0\0
+    char* end = m_req->read_buf + m_req->checked_index - 2;
+    char* colon = (char*)http_scanner::find_non_token(text, end);
+    if(colon == text || *colon != ':') {
+        return BAD_REQUEST;
+    }
+    char* value = colon + 1;
+    value += strspn(value, " \t");                // strspn(str1, str2): 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
+    while(end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    *end = '\0';                                  // 去掉值末尾的空白，值仍然是以\0结尾的字符串
+    http_headers::ID id = http_headers::lookup(text, colon - text);
+    m_req->headers.add(id, text - m_req->read_buf, colon - text, value - m_req->read_buf, end - value);
+    // 影响报文分界和连接管理的头部在这里处理，其它头部由使用者通过header()读取
+    if(id == http_headers::CONNECTION) {
         /*处理Connection头部字段 Connection: keep-alive*/
-        text += 11;
-        text += strspn(text, " \t");               // strspn(str1, str2): 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
-        if(strcasecmp(text, "keep-alive") == 0) {
-            m_linger = true;
-        }
-    } else if(strncasecmp(text, "Content-Length:", 15) == 0) {
-        /*处理Content-Length头部字段*/
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    } else if(strncasecmp(text, "Host:", 5) == 0) {
-        /*处理Host头部字段*/
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    } else {
-        /*未知的请求头*/
-        printf("[INFO] 未知的请求头          : %s\n", text);
+        if(strcasecmp(value, "keep-alive") == 0) {
+            m_req->linger = true;
+        }
+    } else if(id == http_headers::CONTENT_LENGTH) {
+        /*处理Content-Length头部字段，只能是十进制数字，负数或者超出范围都是400*/
+        if(*value < '0' || *value > '9') {
+            return BAD_REQUEST;
+        }
+        char* digits_end;
+        errno = 0;
+        m_req->content_length = strtoll(value, &digits_end, 10);
+        if(errno == ERANGE || *digits_end != '\0') {
+            return BAD_REQUEST;
+        }
     }
     return NO_REQUEST;
 }
 
 // 解析请求体
-// 我们没有真正去解析HTTP请求的请求体，只是判断它是否被完整的读入
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
-    if(m_read_idx >= (m_content_length + m_checked_index)) {
-        text[m_content_length] = '\0';
-        return GET_REQUEST;
+// 我们没有真正去解析HTTP请求的请求体，读到的部分直接从缓冲区中去掉，请求体多大都不占读缓冲区，读完整之后请求才算完整
+http_conn::HTTP_CODE http_conn::parse_content() {
+    int avail = m_req->read_idx - m_req->checked_index;
+    int take = avail < m_req->body_left ? avail : (int)m_req->body_left;
+    if(take > 0) {
+        // 消息体之后可能是流水线上的下一个请求，移到头部后面
+        memmove(m_req->read_buf + m_req->checked_index, m_req->read_buf + m_req->checked_index + take, avail - take);
+        m_req->read_idx -= take;
+        m_req->body_left -= take;
     }
-    return NO_REQUEST;
+    return m_req->body_left == 0 ? GET_REQUEST : NO_REQUEST;
 }
 
 // 主状态机，解析请求
@@ -340,18 +591,21 @@ http_conn::HTTP_CODE http_conn::process_read() {
         即：解析到了请求体且是完整的数据(针对POST请求，因为POST请求的消息体末尾没有任何字符) 或者 解析到了一行完整的数据(GET和POST请求都适用)        
     */
     // parse_line为从状态机的具体实现
-    while(((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK))  // 初始化m_check_state = CHECK_STATE_REQUESTLINE: 初始化状态为解析请求首行
+    while(((m_req->check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK))  // 初始化check_state = CHECK_STATE_REQUESTLINE: 初始化状态为解析请求首行
             || ((line_status = parse_line()) == LINE_OK)) {
         text = get_line();        // 获取一行数据
-        // m_start_line是每一个数据行在m_read_buf中的起始位置
-        // m_checked_idx表示从状态机在m_read_buf中读取的位置
-        m_start_line = m_checked_index;
-        printf("[INFO] 读取到一条http请求信息: %s\n", text);
+        // start_line是每一个数据行在read_buf中的起始位置
+        // m_checked_idx表示从状态机在read_buf中读取的位置
+        m_req->start_line = m_req->checked_index;
+        if(m_req->check_state != CHECK_STATE_CONTENT) {  // 消息体不是以\0结尾的字符串
+            LOG_DEBUG("读取到一条http请求信息: %s", text);
+        }
 
-        switch(m_check_state) {                 // 主状态机的三种状态转移逻辑
+        switch(m_req->check_state) {                 // 主状态机的三种状态转移逻辑
             case CHECK_STATE_REQUESTLINE: {     // 解析请求行
                 ret = parse_request_line(text);
                 if(ret == BAD_REQUEST) {
+                    m_req->linger = false;           // 后面的数据已经无法按请求分界，发送400后关闭连接
                     return BAD_REQUEST;
                 }
                 break;
@@ -359,6 +613,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
             case CHECK_STATE_HEADER: {          // 解析请求头
                 ret = parse_headers(text);
                 if(ret == BAD_REQUEST) {
+                    m_req->linger = false;
                     return BAD_REQUEST;
                 } else if(ret == GET_REQUEST) {
                     return do_request();
@@ -366,7 +621,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
                 break;
             }
             case CHECK_STATE_CONTENT: {         // 解析请求体
-                ret = parse_content(text);
+                ret = parse_content();
                 if(ret == GET_REQUEST) {
                     return do_request();
                 }
@@ -380,241 +635,972 @@ http_conn::HTTP_CODE http_conn::process_read() {
             } 
         }
     }
+    if(line_status == LINE_BAD) {
+        m_req->linger = false;                       // 行格式错误或含有非法字符
+        return BAD_REQUEST;
+    }
     return NO_REQUEST;
 }
 
 /*
     当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性
     如果目标文件存在、对所有的用户可读，且不是目录，则使用mmap将其
-    映射到内存地址m_file_address处，并告诉调用者获取文件成功
+    映射到内存地址file_address处，并告诉调用者获取文件成功
 */
 http_conn::HTTP_CODE http_conn::do_request() {
-    // 将初始化的m_real_file赋值为网站根目录
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    // 将url和网站目录拼接
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    /*通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体，返回值-1失败，0成功*/
-    if(stat(m_real_file, &m_file_stat) < 0) {
+    if(m_response_cache && cacheable()) {
+        // 命中时process_write直接发送缓存的完整应答
+        m_req->cached = m_response_cache->lookup(m_req->url, m_req->linger, &m_req->cache_epoch);
+        if(m_req->cached) {
+            return FILE_REQUEST;
+        }
+    }
+    if(m_file_cache) {
+        // 命中时直接使用缓存中的fd、stat和映射，不需要任何系统调用
+        file_cache::RESULT result;
+        m_req->entry = m_file_cache->acquire(m_req->url, &result);
+        switch(result) {
+            case file_cache::FILE_OK:
+                m_req->file_stat = m_req->entry->st;
+                m_req->file_address = m_req->entry->addr;
+                m_req->file_fd = m_req->entry->fd;
+                return not_modified() ? NOT_MODIFIED : FILE_REQUEST;
+            case file_cache::FILE_NOT_FOUND:
+                return NO_RESOURCE;
+            case file_cache::FILE_FORBIDDEN:
+                return FORBIDDEN_REQUEST;
+            default:
+                return BAD_REQUEST;
+        }
+    }
+
+    // 将初始化的real_file赋值为网站根目录
+    strcpy(m_req->real_file, m_doc_root);
+    int len = strlen(m_doc_root);
+    // 将url规范化后和网站目录拼接，与文件缓存相同: ".."越过根目录或者路径太长时返回400
+    if(!file_cache::normalize(m_req->url, m_req->real_file + len, FILENAME_LEN - len)) {
+        return BAD_REQUEST;
+    }
+    /*通过stat获取请求资源文件信息，成功则将信息更新到file_stat结构体，返回值-1失败，0成功*/
+    if(stat(m_req->real_file, &m_req->file_stat) < 0) {
         return NO_RESOURCE;  //失败则返回NO_RESOURCE，表示请求资源不存在
     }
     /*判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态*/
-    if(!(m_file_stat.st_mode & S_IROTH)) {
+    if(!(m_req->file_stat.st_mode & S_IROTH)) {
         return FORBIDDEN_REQUEST;
     }
     /*判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误*/
-    if(S_ISDIR(m_file_stat.st_mode)) {
+    if(S_ISDIR(m_req->file_stat.st_mode)) {
         return BAD_REQUEST;
     }
+    /*304和HEAD都不需要文件内容，不用打开文件*/
+    if(not_modified()) {
+        return NOT_MODIFIED;
+    }
+    if(m_req->method == HEAD) {
+        return FILE_REQUEST;
+    }
     /*以只读方式打开文件*/
-    int fd = open(m_real_file, O_RDONLY);
-    /*创建内存映射*/
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int fd = open(m_req->real_file, O_RDONLY);
+    if(fd < 0) {
+        return NO_RESOURCE;
+    }
+    /*sendfile模式直接从fd发送，大于窗口的文件分段映射，都不需要整体映射，fd在发送完毕后关闭*/
+    if((m_send_mode == config::SEND_SENDFILE && m_epollfd != -1) || m_req->file_stat.st_size > m_stream_window) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);  // 顺序读，让内核加大预读
+        m_req->file_fd = fd;
+        return FILE_REQUEST;
+    }
+    /*创建内存映射，空文件不需要映射(长度为0的mmap会失败)*/
+    if(m_req->file_stat.st_size > 0) {
+        void* addr = mmap(0, m_req->file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED) {
+            close(fd);
+            return INTERNAL_ERROR;
+        }
+        m_req->file_address = (char*)addr;
+    }
     /*避免文件描述符的浪费和占用*/
     close(fd);
     /*表示请求文件存在，且可以访问*/
     return FILE_REQUEST;
 }
 
-// 对内存映射区执行munmap操作
+// 文件的实体标签，由大小和纳秒精度的修改时间组成，文件被改写后一定会变化；buf至少要有40个字节
+static int format_etag(const struct stat& st, char* buf) {
+    unsigned long long mtime = (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    int len = 0;
+    buf[len++] = '"';
+    len += http_response::format_hex(buf + len, (unsigned long long)st.st_size);
+    buf[len++] = '-';
+    len += http_response::format_hex(buf + len, mtime);
+    buf[len++] = '"';
+    buf[len] = '\0';
+    return len;
+}
+
+// HTTP日期，例如 Sun, 06 Nov 1994 08:49:37 GMT
+static int format_http_date(time_t t, char* buf) {
+    int len = http_response::format_date(buf, t);
+    buf[len] = '\0';
+    return len;
+}
+
+// If-None-Match的值是逗号分隔的实体标签列表或*，按弱比较匹配(忽略W/前缀)
+static bool etag_list_match(const char* list, const char* etag) {
+    int len = strlen(etag);
+    const char* p = list;
+    while(true) {
+        p += strspn(p, " \t,");
+        if(*p == '*') {
+            return true;
+        }
+        if(strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if(*p != '"') {
+            return false;
+        }
+        const char* end = strchr(p + 1, '"');
+        if(!end) {
+            return false;
+        }
+        if(end - p + 1 == len && strncmp(p, etag, len) == 0) {
+            return true;
+        }
+        p = end + 1;
+    }
+}
+
+const char* http_conn::header(http_headers::ID id) const {
+    const http_headers::field* f = m_req->headers.find(id);
+    return f ? m_req->read_buf + f->value : NULL;
+}
+
+// 有If-None-Match时只比较实体标签，否则比较If-Modified-Since和文件的修改时间(秒)
+bool http_conn::not_modified() {
+    const char* if_none_match = header(http_headers::IF_NONE_MATCH);
+    if(if_none_match) {
+        char etag[48];
+        format_etag(m_req->file_stat, etag);
+        return etag_list_match(if_none_match, etag);
+    }
+    const char* if_modified_since = header(http_headers::IF_MODIFIED_SINCE);
+    if(if_modified_since) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if(!end || *end != '\0') {                   // 无法识别的日期按没有这个头部处理
+            return false;
+        }
+        return m_req->file_stat.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
+
+// If-Range为实体标签时要求强匹配，为日期时要求和Last-Modified完全相同
+bool http_conn::if_range_ok() {
+    const char* if_range = header(http_headers::IF_RANGE);
+    if(!if_range) {
+        return true;
+    }
+    char value[48];
+    if(if_range[0] == '"') {
+        format_etag(m_req->file_stat, value);
+    } else {
+        format_http_date(m_req->file_stat.st_mtime, value);
+    }
+    return strcmp(if_range, value) == 0;
+}
+
+// 应答缓存中只有完整的200应答，HEAD、Range和条件请求都不使用缓存
+bool http_conn::cacheable() const {
+    return m_req->method == GET && !m_req->headers.find(http_headers::RANGE) && !m_req->headers.find(http_headers::IF_NONE_MATCH)
+           && !m_req->headers.find(http_headers::IF_MODIFIED_SINCE);
+}
+
+/*
+    前面的应答留在输出队列中、头部留在写缓冲区中，就可以接着处理流水线上的下一个请求，最后一起发送；
+    写缓冲区和队列都要给下一个应答留出空间，一批的个数也有上限
+*/
+bool http_conn::hold_response() {
+    if(m_req->held == MAX_PIPELINE || m_write_buffer_size - m_req->write_idx < PIPELINE_HEADROOM
+       || m_req->out.space() < RESPONSE_SEGMENTS) {
+        return false;
+    }
+    if(m_req->access_pending) {                   // 访问记录按应答的顺序暂存，发送完时依次写出
+        if(!m_req->pipe) {
+            m_req->pipe = new pipeline;
+        }
+        pipeline& p = *m_req->pipe;
+        p.access[p.count++] = m_req->access;
+        m_req->access_pending = false;
+    }
+    m_req->held++;
+    return true;
+}
+
+void http_conn::access_begin() {
+    access_log::record& rec = m_req->access.rec;
+    rec.method = m_req->method;
+    rec.addr = m_address.sin_addr.s_addr;
+    rec.time_us = m_req->request_start ? m_req->request_start : access_log::now_us();
+    rec.bytes = m_req->response_bytes;                 // 应答的总字节数，发送完时改为实际发送的字节数
+    // 请求行无法解析时url可能为空；URL在读缓冲区中，下一个请求开始解析前必须拷贝出来
+    const char* url = m_req->url ? m_req->url : "-";
+    int len = strnlen(url, access_log::URL_MAX);
+    memcpy(m_req->access.url, url, len);
+    rec.url_len = len;
+    m_req->access_pending = true;
+}
+
+void http_conn::access_end(access_log::entry& e, long long bytes, bool complete, uint64_t now) {
+    uint64_t start = e.rec.time_us;
+    e.rec.bytes = bytes;
+    e.rec.complete = complete;
+    e.rec.ttfb_us = m_req->first_byte > start ? m_req->first_byte - start : 0;
+    e.rec.ttlb_us = now > start ? now - start : 0;
+    access_log::write(e);
+}
+
+// 应答按生成的顺序发送完，先是暂存的，最后是当前应答
+void http_conn::access_done(int count, uint64_t now) {
+    for(; count > 0; count--) {
+        pipeline* p = m_req->pipe;
+        if(p && p->first < p->count) {
+            access_log::entry& e = p->access[p->first++];
+            access_end(e, e.rec.bytes, true, now);
+            if(p->first == p->count) {
+                p->first = p->count = 0;
+            }
+        } else if(m_req->access_pending) {
+            m_req->access_pending = false;
+            access_end(m_req->access, m_req->access.rec.bytes, true, now);
+        }
+    }
+}
+
+// 队首的应答可能发送了一部分，后面的都还没有开始发送
+void http_conn::access_abort() {
+    uint64_t now = access_log::now_us();
+    long long left = m_req->out.head_left();
+    bool head = true;
+    if(m_req->pipe) {
+        pipeline& p = *m_req->pipe;
+        for(int i = p.first; i < p.count; i++) {
+            long long size = p.access[i].rec.bytes;
+            long long n = head ? size - left : 0;
+            head = false;
+            access_end(p.access[i], n, n == size, now);
+        }
+        p.first = p.count = 0;
+    }
+    if(m_req->access_pending) {
+        m_req->access_pending = false;
+        long long size = m_req->access.rec.bytes;
+        long long n = head ? size - left : 0;
+        access_end(m_req->access, n, n == size, now);
+    }
+}
+
+// 对内存映射区执行munmap操作，只有还没有进入输出队列的应答才会用到
 void http_conn::unmap() {
-    if( m_file_address )
+    if(m_req->cached) {
+        m_response_cache->release(m_req->cached);
+        m_req->cached = NULL;
+    }
+    if(m_req->entry) {  // 映射和fd属于文件缓存，只释放引用
+        m_file_cache->release(m_req->entry);
+        m_req->entry = NULL;
+        m_req->file_address = 0;
+        m_req->file_fd = -1;
+        return;
+    }
+    if( m_req->file_address )
     {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address = 0;
+        munmap( m_req->file_address, m_req->file_stat.st_size );
+        m_req->file_address = 0;
+    }
+    if(m_req->file_fd != -1) {
+        close(m_req->file_fd);
+        m_req->file_fd = -1;
     }
 }
 
 // 非阻塞的写HTTP响应
 bool http_conn::write() {
-    int temp = 0;
-    int newadd = 0;
-    // 若要发送的数据长度为0
-    // 表示响应报文为空，一般不会出现这种情况
-    if ( bytes_to_send == 0 ) {
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+    // 输出队列为空，表示响应报文为空，一般不会出现这种情况
+    if(m_req->out.empty()) {
+        set_events(EPOLLIN);
+        init_response();
+        release_if_idle();
         return true;
     }
 
     while(1) {
-        // 将响应报文的状态行、消息头、空行和响应正文写到TCP Socket本身定义的发送缓冲区，交由内核发送给浏览器端
-        // writev函数用于在一次函数调用中写多个非连续缓冲区，有时也将这该函数称为聚集写，若成功返回已写的字节数，若失败返回-1
-        // writev以顺序iov[0]，iov[1]至iov[iovcnt-1]从缓冲区中聚集输出数据
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        // writev单次发送成功，temp为发送的字节数
-        if (temp > 0) {
-            // 更新已发送字节
-            bytes_have_send += temp;
-            // 偏移文件iovec的指针
-            newadd = bytes_have_send - m_write_idx;
-        }
-        // writev单次发送失败
-        if ( temp <= -1 ) {
-            // 判断是否是写缓冲区满了，如果满了
-            if (errno == EAGAIN) {
-                // 第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-                if (bytes_have_send >= m_iv[0].iov_len) {
-                    // 不再继续发送头部信息
-                    m_iv[0].iov_len = 0;
-                    m_iv[1].iov_base = m_file_address + newadd;
-                    m_iv[1].iov_len = bytes_to_send;
-                }
-                // 继续发送第一个iovec头部信息的数据
-                else {
-                    m_iv[0].iov_base = m_write_buf + bytes_to_send;
-                    m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-                }
+        // 将输出队列队首的一批数据写到TCP Socket本身定义的发送缓冲区，交由内核发送给浏览器端
+        ssize_t temp = send_some();
+        if(temp < 0) {
+            // 判断是否是写缓冲区满了(或者未发出的数据超过了TCP_NOTSENT_LOWAT)
+            if(errno == EAGAIN) {
                 // 重新注册写事件，等待下一次写事件触发（当缓冲区从不可写变为可写，触发epollout），因此在此期间无法立即接收到同一用户的下一请求，但可以保证连接的完整性
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                set_events(EPOLLOUT);
                 return true;
             }
-            // 如果发送失败，但不是缓冲区问题，取消映射
-            unmap();
+            // 发送失败或文件映射失败，队列中的映射和引用在关闭连接时释放
+            return false;
+        }
+        if(temp == 0) {  // sendfile时文件在发送期间被截短了
             return false;
         }
-        // 更新待发送的字节数
-        bytes_to_send -= temp;
+        // 推进输出队列，短写时停在段的中间，发送完的应答的映射和引用随之释放
+        if(sent(temp)) {
+            // 回环等情况下完成通知立即就到了，顺便回收，避免之后再触发一次EPOLLERR
+            if(m_zerocopy_pending > 0) {
+                reap_zerocopy();
+            }
+            // 浏览器的请求为短连接
+            if (!m_keep_alive) {
+                return false;
+            }
+            // 重置发送状态，请求的解析状态在生成应答时已经重置了
+            init_response();
+            // 在epoll树上重置EPOLLONESHOT事件；读缓冲区中还有流水线请求时由调用者接着处理，不能让其它线程同时读
+            if (!pipelined()) {
+                set_events(EPOLLIN);
+                release_if_idle();     // 长连接空闲时只保留http_conn本身
+            }
+            return true;
+        }
+    }
+}
 
-        // 判断条件，数据已全部发送完
-        if (bytes_to_send <= 0) {
-            unmap();
-            // 在epoll树上重置EPOLLONESHOT事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-            // 浏览器的请求为长连接
-            if (m_linger) {
-                // 重新初始化HTTP对象
-                init();
-                return true;
+/*
+    从输出队列的队首取一批发送方式相同的数据发送一次:
+    sendfile: 一个文件段，每次最多一个窗口，一个大文件不会长时间占住reactor
+    zerocopy: 文件内容用sendmsg(MSG_ZEROCOPY)发送，内核直接引用这些页面而不拷贝，完成通知在错误队列上；
+              头部在写缓冲区中，下一个应答会覆盖它，所以头部总是单独普通发送
+    其它: 连续的内存段和文件窗口用一次sendmsg(相当于writev)发送，后面还有数据时加MSG_MORE，
+          告诉内核不要把头部单独作为一个小包发出
+*/
+ssize_t http_conn::send_some() {
+    int mode;
+    bool more;
+    int count = m_req->out.gather(&mode, &more);
+    if(count < 0) {
+        return -1;  // 窗口映射失败，errno由mmap设置
+    }
+    if(mode == out_queue::MODE_SENDFILE) {
+        const out_queue::segment& s = m_req->out.front();
+        off_t offset = s.offset;  // 由sent()统一推进
+        size_t count = s.len < (size_t)m_stream_window ? s.len : m_stream_window;
+        return sendfile(m_sockfd, s.fd, &offset, count);
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = m_req->out.iov();
+    msg.msg_iovlen = count;
+    if(mode == out_queue::MODE_ZEROCOPY) {
+        if(!m_zerocopy_enabled) {
+            int one = 1;
+            if(setsockopt(m_sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+                return sendmsg(m_sockfd, &msg, 0);  // 内核不支持，普通发送
+            }
+            m_zerocopy_enabled = true;
+        }
+        ssize_t ret = sendmsg(m_sockfd, &msg, MSG_ZEROCOPY);
+        if(ret > 0) {
+            m_zerocopy_pending++;
+            m_zerocopy_sends++;
+        } else if(ret < 0 && errno == ENOBUFS) {
+            // 未回收的完成通知超过了socket的optmem限制，这一次普通发送
+            return sendmsg(m_sockfd, &msg, 0);
+        }
+        return ret;
+    }
+    return sendmsg(m_sockfd, &msg, more ? MSG_MORE : 0);
+}
+
+/*
+    MSG_ZEROCOPY发送的数据被内核发送(或确认)后，完成通知以sock_extended_err的形式放在socket的错误队列上，
+    错误队列非空时epoll报告EPOLLERR，一条通知用[ee_info, ee_data]表示一段连续的发送序号
+    内核持有被发送页面的引用，所以发送完毕后可以先释放文件映射，只是需要回收通知，否则它们会占满optmem
+    只收到完成通知(或通知已被回收、socket上没有错误)时返回true，错误队列上有真正的错误或EPOLLERR来自其它错误时返回false
+*/
+bool http_conn::reap_zerocopy() {
+    bool reaped = false;
+    while(true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(m_sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if(!reaped && errno == EAGAIN) {
+                // ET模式下连接一直注册着，通知可能已经在write()中回收了，这时EPOLLERR是过时的；没有挂起的错误就不算失败
+                int error = 0;
+                socklen_t len = sizeof(error);
+                return getsockopt(m_sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
             }
-            else {
+            return reaped;
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+            struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+            if(err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
                 return false;
             }
+            int count = err->ee_data - err->ee_info + 1;
+            m_zerocopy_pending -= count;
+            m_zerocopy_done += count;
+            if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                m_zerocopy_copied += count;
+            }
+            reaped = true;
         }
     }
 }
 
-// 往写缓冲中写入待发送的数据，可变参数
-bool http_conn::add_response(const char* format, ...) {
-    // 如果写入内容超出m_write_buf大小则报错
-    if(m_write_idx >= WRITE_BUFFER_SIZE) {
-        return false;
+// 只处理了完成通知时，事件已被EPOLLONESHOT禁用，按连接当前的状态重新注册
+void http_conn::rearm() {
+    set_events(sending() ? EPOLLOUT : EPOLLIN);
+}
+
+void http_conn::set_events(int ev) {
+    if(m_oneshot) {
+        modfd(m_epollfd, m_sockfd, ev, m_conn_et);
+    }
+}
+
+void http_conn::set_timer(TIMER_STATE state, int timeout_ms) {
+    m_timer_state = state;
+    if(!m_wheel) {
+        return;
+    }
+    if(timeout_ms > 0) {
+        m_wheel->schedule(&m_timer, timeout_ms);
+    } else {
+        m_wheel->cancel(&m_timer);
+    }
+}
+
+// 发送有进展时重新计时；请求只收到一部分时保持第一个字节时的期限，慢速发送头部的客户端不能一直占用连接
+void http_conn::update_timer() {
+    if(!m_wheel) {
+        return;
+    }
+    if(sending()) {
+        set_timer(TIMER_SEND, m_send_timeout);
+    } else if(m_req && m_req->read_idx > 0) {
+        if(m_timer_state != TIMER_HEADER) {
+            set_timer(TIMER_HEADER, m_header_timeout);
+        }
+    } else {
+        set_timer(TIMER_IDLE, m_keepalive_timeout);
     }
-    // 定义可变参数列表
-    va_list arg_list;
-    // 将变量arg_list初始化为传入参数
-    va_start(arg_list, format);
-    // 将数据format从可变参数列表写入写缓冲区，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    // 如果写入的数据长度超过缓冲区剩余空间，则报错
-    if(len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
+}
+
+static const char* timer_state_names[] = {"idle", "header", "send"};
+
+bool http_conn::expire() {
+    if(m_processing) {  // 工作线程正在处理，不能在这里关闭，稍后再检查
+        m_wheel->schedule(&m_timer, m_wheel->tick_ms());
         return false;
     }
-    // 更新m_write_idx位置
-    m_write_idx += len;
-    // 清空可变参列表
-    va_end(arg_list);
+    m_timeouts[m_timer_state]++;
+    LOG_DEBUG("connection %d timed out (%s)", m_sockfd, timer_state_names[m_timer_state]);
     return true;
+}
 
+// 往写缓冲中追加一段文本
+bool http_conn::add_text(const char* text, int len) {
+    // 如果写入内容超出write_buf大小则报错
+    if(len > m_write_buffer_size - m_req->write_idx) {
+        return false;
+    }
+    memcpy(m_req->write_buf + m_req->write_idx, text, len);
+    m_req->write_idx += len;
+    return true;
+}
+// 追加一个十进制整数
+bool http_conn::add_number(long long n) {
+    if(m_write_buffer_size - m_req->write_idx < http_response::NUMBER_MAX) {
+        return false;
+    }
+    m_req->write_idx += http_response::format_number(m_req->write_buf + m_req->write_idx, n);
+    return true;
 }
 // 添加响应状态行
-bool http_conn::add_status_line(int status, const char* title) {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+bool http_conn::add_status_line(int status) {
+    m_req->access.rec.status = status;
+    int len;
+    const char* line = http_response::status_line(status, &len);
+    return add_text(line, len);
 }
 // 添加消息报头，具体的添加文本长度、文本类型、连接状态和空行
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+bool http_conn::add_headers(long long content_len) {
+    return add_content_length(content_len) && add_content_type()
+        && add_linger() && add_blank_line();
 }
 // 添加Content-Length，表示响应报文的长度
-bool http_conn::add_content_length(int content_len) {
-    return add_response("Content-Length: %d\r\n", content_len);
+bool http_conn::add_content_length(long long content_len) {
+    return add_literal("Content-Length: ") && add_number(content_len) && add_literal("\r\n");
 }
-// 添加文本类型，这里是html
+// 添加文本类型，按请求的文件的扩展名
 bool http_conn::add_content_type() {
-    return add_response("Content-Type: %s\r\n", "text/html");
+    int len;
+    const char* line = http_response::content_type(m_req->url, &len);
+    return add_text(line, len);
 }
 // 添加连接状态，通知浏览器端是保持连接还是关闭
 bool http_conn::add_linger() {
-    return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return m_req->linger ? add_literal("Connection: keep-alive\r\n") : add_literal("Connection: close\r\n");
 }
-// 添加空行
+// 添加Date和空行，Date每秒格式化一次
 bool http_conn::add_blank_line() {
-    return add_response("%s", "\r\n");
+    return add_text(http_response::header_end(), http_response::HEADER_END_LEN);
+}
+// 添加错误应答，HEAD请求只有头部，Content-Length仍然是GET时消息体的长度；
+// 除Date外的部分是预先生成的常量，由queue_response直接放进输出队列
+bool http_conn::add_error(int status) {
+    m_req->access.rec.status = status;
+    m_req->error = http_response::error(status, m_req->linger);
+    return add_blank_line();
+}
+// 添加ETag和Last-Modified，浏览器下次用它们发送条件请求
+bool http_conn::add_validators() {
+    char etag[48];
+    char date[48];
+    int etag_len = format_etag(m_req->file_stat, etag);
+    int date_len = format_http_date(m_req->file_stat.st_mtime, date);
+    return add_literal("ETag: ") && add_text(etag, etag_len)
+        && add_literal("\r\nLast-Modified: ") && add_text(date, date_len) && add_literal("\r\n");
+}
+
+/*
+    解析Range头部，例如 bytes=0-499, 1000-, -200，结果存入parts
+    范围超出文件末尾的部分被截掉，完全在文件之外的范围被跳过；语法错误或范围太多时忽略整个Range
+*/
+int http_conn::parse_range() {
+    long long size = m_req->file_stat.st_size;
+    const char* p = header(http_headers::RANGE);
+    if(strncasecmp(p, "bytes=", 6) != 0) {
+        return -1;
+    }
+    p += 6;
+    int count = 0;
+    while(true) {
+        p += strspn(p, " \t");
+        long long start, end;
+        char* stop;
+        if(*p == '-') {                              // -n: 最后n个字节
+            if(!isdigit((unsigned char)p[1])) {
+                return -1;
+            }
+            long long n = strtoll(p + 1, &stop, 10);
+            start = n < size ? size - n : 0;
+            end = n > 0 ? size : 0;                  // -0不可满足
+        } else {                                     // a-b 或 a-
+            if(!isdigit((unsigned char)*p)) {
+                return -1;
+            }
+            start = strtoll(p, &stop, 10);
+            if(*stop != '-') {
+                return -1;
+            }
+            if(isdigit((unsigned char)stop[1])) {
+                end = strtoll(stop + 1, &stop, 10);
+                if(end < start) {
+                    return -1;
+                }
+                end = end + 1 < size ? end + 1 : size;
+            } else {
+                stop++;
+                end = size;
+            }
+        }
+        if(start < end) {                            // 可满足的范围
+            if(count == MAX_RANGES) {
+                return -1;
+            }
+            m_req->parts[count].start = start;
+            m_req->parts[count].end = end;
+            count++;
+        }
+        p = stop + strspn(stop, " \t");
+        if(*p == '\0') {
+            return count;
+        }
+        if(*p != ',') {
+            return -1;
+        }
+        p++;
+    }
+}
+
+// multipart/byteranges中一个部分的头部，type是整行的Content-Type；buf为NULL时只计算长度，只在多个范围时使用
+static int format_part_head(char* buf, int size, bool first, const char* boundary, const char* type, int type_len,
+                            long long start, long long end, long long total) {
+    return snprintf(buf, size, "%s--%s\r\n%.*sContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                    first ? "" : "\r\n", boundary, type_len, type, start, end - 1, total);
+}
+
+// Content-Range的值 start-end/total 或 */total
+bool http_conn::add_content_range(long long start, long long end, long long total) {
+    if(start < 0) {
+        return add_literal("Content-Range: bytes */") && add_number(total) && add_literal("\r\n");
+    }
+    return add_literal("Content-Range: bytes ") && add_number(start) && add_literal("-") && add_number(end - 1)
+        && add_literal("/") && add_number(total) && add_literal("\r\n");
 }
-// 添加文本content
-bool http_conn::add_content(const char* content) {
-    return add_response("%s", content);
+
+// 填充206应答的头部，单个范围时就是普通的头部加Content-Range，写缓冲区放不下时返回false
+bool http_conn::add_range_headers(int count) {
+    long long size = m_req->file_stat.st_size;
+    if(count == 1) {
+        if(!add_status_line(206) || !add_literal("Accept-Ranges: bytes\r\n") || !add_validators()
+           || !add_content_range(m_req->parts[0].start, m_req->parts[0].end, size)
+           || !add_headers(m_req->parts[0].end - m_req->parts[0].start)) {
+            return false;
+        }
+        m_req->parts[0].head_end = m_req->write_idx;
+        m_req->part_count = 1;
+        return true;
+    }
+
+    // 多个范围: 先算出整个消息体的长度
+    int type_len;
+    const char* type = http_response::content_type(m_req->url, &type_len);
+    int boundary_len = strlen(m_boundary);
+    long long total = boundary_len + 8;                // \r\n--boundary--\r\n
+    for(int i = 0; i < count; i++) {
+        total += format_part_head(NULL, 0, i == 0, m_boundary, type, type_len, m_req->parts[i].start, m_req->parts[i].end, size);
+        total += m_req->parts[i].end - m_req->parts[i].start;
+    }
+    if(!add_status_line(206) || !add_literal("Accept-Ranges: bytes\r\n")
+       || !add_validators() || !add_content_length(total)
+       || !add_literal("Content-Type: multipart/byteranges; boundary=") || !add_text(m_boundary, boundary_len)
+       || !add_literal("\r\n") || !add_linger() || !add_blank_line()) {
+        return false;
+    }
+    for(int i = 0; i < count; i++) {
+        int space = m_write_buffer_size - 1 - m_req->write_idx;
+        int len = format_part_head(m_req->write_buf + m_req->write_idx, space, i == 0, m_boundary, type, type_len,
+                                   m_req->parts[i].start, m_req->parts[i].end, size);
+        if(len >= space) {
+            return false;
+        }
+        m_req->write_idx += len;
+        m_req->parts[i].head_end = m_req->write_idx;
+    }
+    // 最后一部分只有结束分隔符
+    if(!add_literal("\r\n--") || !add_text(m_boundary, boundary_len) || !add_literal("--\r\n")) {
+        return false;
+    }
+    m_req->parts[count].start = m_req->parts[count].end = 0;
+    m_req->parts[count].head_end = m_req->write_idx;
+    m_req->part_count = count + 1;
+    return true;
+}
+
+// 输出队列发送完应答时释放缓存引用
+static void release_entry(void* cache, void* entry) {
+    ((file_cache*)cache)->release((file_entry*)entry);
+}
+
+static void release_response(void* cache, void* resp) {
+    ((response_cache*)cache)->release((response*)resp);
+}
+
+/*
+    把生成好的应答放进输出队列: 缓存的应答是一段内存；文件应答的每一部分是写缓冲区中的头部加上文件的一个范围，
+    文件内容整体映射时是内存段，否则是文件段(sendfile发送或按窗口映射)；最后跟上释放映射、fd或缓存引用的标记，
+    应答发送完时由队列释放，这些资源从此不再属于当前应答
+*/
+bool http_conn::queue_response() {
+    out_queue& out = m_req->out;
+    if(out.space() < RESPONSE_SEGMENTS) {
+        return false;
+    }
+    long long before = out.bytes();
+    if(m_req->cached) {
+        // 缓存的应答自带头部，只有Date是现在的，插在缓存的头部和正文之间
+        response* resp = m_req->cached;
+        m_req->write_idx = m_req->write_start;
+        if(!add_blank_line()) {
+            return false;
+        }
+        out.push_memory(resp->data, resp->head_len);
+        out.push_memory(m_req->write_buf + m_req->write_start, m_req->write_idx - m_req->write_start);
+        out.push_memory(resp->data + resp->head_len, resp->size - resp->head_len);
+        out.push_release(release_response, m_response_cache, resp);
+        m_req->cached = NULL;
+    } else if(m_req->error) {                      // 预先生成的错误应答，写缓冲区中只有Date和空行
+        const http_response::error_page* page = m_req->error;
+        out.push_memory(page->head, page->head_len);
+        out.push_memory(m_req->write_buf + m_req->write_start, m_req->write_idx - m_req->write_start);
+        if(m_req->method != HEAD) {
+            out.push_memory(page->body, page->body_len);
+        }
+        m_req->error = NULL;
+    } else if(m_req->part_count == 0) {            // 只有头部(和错误页面)
+        out.push_memory(m_req->write_buf + m_req->write_start, m_req->write_idx - m_req->write_start);
+    } else {
+        long long body = 0;
+        for(int i = 0; i < m_req->part_count; i++) {
+            body += m_req->parts[i].end - m_req->parts[i].start;
+        }
+        // sendfile直接从fd发送，io_uring后端不使用sendfile和MSG_ZEROCOPY
+        int flags = 0;
+        if(m_send_mode == config::SEND_SENDFILE && m_epollfd != -1 && m_req->file_fd != -1) {
+            flags = out_queue::SENDFILE;
+        } else if(m_send_mode == config::SEND_ZEROCOPY && m_epollfd != -1 && body >= m_zerocopy_threshold) {
+            flags = out_queue::ZEROCOPY;
+        }
+        int head = m_req->write_start;
+        for(int i = 0; i < m_req->part_count; i++) {
+            body_part& part = m_req->parts[i];
+            out.push_memory(m_req->write_buf + head, part.head_end - head);
+            head = part.head_end;
+            if(m_req->file_address && !(flags & out_queue::SENDFILE)) {
+                out.push_memory(m_req->file_address + part.start, part.end - part.start, flags);
+            } else {
+                out.push_file(m_req->file_fd, part.start, part.end - part.start, flags);
+            }
+        }
+        if(m_req->entry) {                         // 映射和fd属于文件缓存，只释放引用
+            out.push_release(release_entry, m_file_cache, m_req->entry);
+        } else {
+            if(m_req->file_address) {
+                out.push_unmap(m_req->file_address, m_req->file_stat.st_size);
+            }
+            if(m_req->file_fd != -1) {
+                out.push_close(m_req->file_fd);
+            }
+        }
+        m_req->entry = NULL;
+        m_req->file_address = NULL;
+        m_req->file_fd = -1;
+    }
+    out.end_response();
+    m_req->response_bytes = out.bytes() - before;
+    m_req->write_start = m_req->write_idx;         // 下一个应答的头部写在这个应答的头部之后
+    m_req->part_count = 0;                         // 流水线上的下一个应答可能只有头部
+    return true;
 }
 
 // 写HTTP响应,根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool http_conn::process_write(HTTP_CODE ret) {
     switch (ret) {
         case INTERNAL_ERROR:                         // 内部错误，500
-            add_status_line( 500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) ) {
+            if ( ! add_error( 500 ) ) {
                 return false;
             }
             break;
-        case BAD_REQUEST:                            // 报文语法有误，404
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) ) {
+        case BAD_REQUEST:                            // 报文语法有误，400
+            if ( ! add_error( 400 ) ) {
                 return false;
             }
             break;
-        case NO_RESOURCE:                  
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) ) {
+        case NO_RESOURCE:                            // 资源不存在，404
+            if ( ! add_error( 404 ) ) {
                 return false;
             }
             break;
         case FORBIDDEN_REQUEST:                      // 资源没有访问权限，403
-            add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
-            if ( ! add_content( error_403_form ) ) {
+            if ( ! add_error( 403 ) ) {
                 return false;
             }
             break;
-        case FILE_REQUEST:                           // 文件存在，200
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            // 第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            // 第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            // 发送的全部数据为响应报文头部信息和文件大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-            return true;
+        case NOT_MODIFIED:                           // 客户端缓存的副本仍然有效，304没有消息体
+            unmap();
+            if(!add_status_line(304) || !add_validators()
+               || !add_linger() || !add_blank_line()) {
+                return false;
+            }
+            break;
+        case FILE_REQUEST:                           // 文件存在，200或206
+            if(!m_req->cached) {
+                // Range只对GET有定义，HEAD忽略它；If-Range不匹配时发送整个文件
+                int ranges = m_req->headers.find(http_headers::RANGE) && m_req->method == GET && if_range_ok() ? parse_range() : -1;
+                if(ranges == 0) {                    // 没有一个范围落在文件内，416
+                    unmap();
+                    if(!add_status_line(416) || !add_content_range(-1, -1, m_req->file_stat.st_size)
+                       || !add_content_length(sizeof(error_416_form) - 1) || !add_literal("Content-Type: text/html\r\n")
+                       || !add_linger() || !add_blank_line() || !add_literal(error_416_form)) {
+                        return false;
+                    }
+                    break;
+                }
+                bool ranged = ranges > 0 && add_range_headers(ranges);
+                if(ranges > 0 && !ranged && m_req->held > 0) {
+                    // 多个范围的头部在暂存的应答之后放不下: 先发送这一批，写缓冲区空了之后再重新生成
+                    m_req->write_idx = m_req->write_start;
+                    m_req->deferred = FILE_REQUEST;
+                    return true;
+                }
+                if(!ranged) {
+                    // 没有Range、Range无效或者空的写缓冲区也放不下头部时发送整个文件，这是协议允许的
+                    m_req->write_idx = m_req->write_start;
+                    if(!add_status_line(200) || !add_literal("Accept-Ranges: bytes\r\n")
+                       || !add_validators() || !add_headers(m_req->file_stat.st_size)) {
+                        return false;
+                    }
+                    m_req->parts[0].start = 0;
+                    m_req->parts[0].end = m_req->file_stat.st_size;
+                    m_req->parts[0].head_end = m_req->write_idx;
+                    m_req->part_count = 1;
+                    // 小文件的应答放入应答缓存，本次也直接发送缓存中的应答，文件映射可以提前释放
+                    if(m_response_cache && cacheable() && (m_req->file_address || m_req->file_stat.st_size == 0)
+                       && m_req->write_idx - m_req->write_start + m_req->file_stat.st_size <= m_response_cache->max_object()) {
+                        // 缓存的头部不含Date和空行，发送时再补上当时的
+                        response* resp = m_response_cache->insert(m_req->url, m_req->linger, m_req->write_buf + m_req->write_start,
+                                                                  m_req->write_idx - m_req->write_start - http_response::HEADER_END_LEN,
+                                                                  m_req->file_address, m_req->file_stat.st_size, m_req->cache_epoch);
+                        if(resp) {
+                            unmap();
+                            m_req->cached = resp;
+                        }
+                    }
+                }
+                if(m_req->method == HEAD) {               // HEAD只发送头部，不需要文件内容
+                    unmap();
+                    m_req->part_count = 0;
+                    break;
+                }
+            }
+            if(m_req->cached) {                         // 缓存的应答在一块连续的内存中
+                m_req->access.rec.status = 200;           // 只缓存200应答
+                m_req->part_count = 0;
+            }
+            return queue_response();
         default:
             return false;
     }
-    // 除FILE_REQUEST状态外，其余状态只申请一个iovec，指向响应报文缓冲区
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
-    return true;
+    // 除FILE_REQUEST状态外，其余状态只有写缓冲区中的响应报文
+    return queue_response();
 }
 
-// 由线程池中的工作线程调用的，这是处理HTTP请求的入口函数
+// 解析请求并生成应答，不涉及事件后端
+// 请求不完整返回NO_REQUEST，应答生成失败返回CLOSED_CONNECTION，否则返回请求的解析结果
+// 读缓冲区中有多个完整的请求(流水线)时依次处理，在内存中的应答暂存起来，和最后一个应答一起发送
+http_conn::HTTP_CODE http_conn::process_request() {
+    HTTP_CODE ret = NO_REQUEST;
+    if(!m_req) {                               // 还没有收到数据
+        return ret;
+    }
+    while(true) {
+        // 1.解析HTTP请求；上一批发送完之后，先为推迟的请求生成应答，它已经解析过了
+        HTTP_CODE read_ret = m_req->deferred != NO_REQUEST ? m_req->deferred : process_read();
+        m_req->deferred = NO_REQUEST;
+        if(read_ret == NO_REQUEST) {           // NO_REQUEST，表示请求不完整，需要继续接收请求数据
+            break;
+        }
+        if(!process_write(read_ret)) {         // 2.生成响应
+            return CLOSED_CONNECTION;
+        }
+        if(m_req->deferred != NO_REQUEST) {    // 应答推迟到暂存的应答发送完之后，读缓冲区中的请求保持原样
+            break;
+        }
+        if(access_log::enabled()) {
+            access_begin();
+        }
+        ret = read_ret;
+        m_keep_alive = m_req->linger;
+        init_request();                        // 3.这个请求已经处理完，准备解析后面的请求
+        if(!m_keep_alive || m_req->read_idx == 0 || !hold_response()) {
+            break;
+        }
+    }
+    return ret;                                // 暂存了应答时，即使最后一个请求不完整也要先发送
+}
+
+// 由线程池中的工作线程(或多reactor模式下的reactor线程)调用的，这是处理HTTP请求的入口函数
+// 工作线程不修改epoll事件，也不关闭连接，结果由reactor线程在respond()中处理
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();       // 1.解析HTTP请求
-    if(read_ret == NO_REQUEST) {               // NO_REQUEST，表示请求不完整，需要继续接收请求数据
-        modfd(m_epollfd, m_sockfd, EPOLLIN);   // 修改socket事件，注册并监听读事件
-        return;
+    m_result = process_request();
+}
+
+bool http_conn::respond() {
+    m_processing = false;
+    if(m_result == CLOSED_CONNECTION) {
+        return false;
     }
+    shrink_read_buf();        // 请求已经处理完，换回初始的读缓冲区
+    if(m_result == NO_REQUEST) {
+        set_events(EPOLLIN);  // 请求不完整，继续等待读事件
+        release_if_idle();    // 什么也没有读到
+        return true;
+    }
+    return write();           // 不用等EPOLLOUT，发送缓冲区通常有空间，直接发送
+}
+
+// 把后端收到的数据追加到读缓冲区，放不下的部分由后端自己保留
+int http_conn::append_read(const char* data, int len) {
+    if(!acquire_state()) {
+        return 0;
+    }
+    if(m_req->read_idx >= m_req->read_size && !grow_read_buf()) {
+        return 0;
+    }
+    int space = m_req->read_size - m_req->read_idx;
+    if(len > space) {
+        len = space;
+    }
+    memcpy(m_req->read_buf + m_req->read_idx, data, len);
+    m_req->read_idx += len;
+    if(m_req->request_start == 0 && len > 0 && access_log::enabled()) {
+        m_req->request_start = access_log::now_us();
+    }
+    return len;
+}
+
+// 记录已发送的字节并推进输出队列，发送完的应答的资源由队列释放
+bool http_conn::sent(long long bytes) {
+    uint64_t now = 0;
+    if(access_log::enabled()) {
+        now = access_log::now_us();
+        if(m_req->first_byte == 0 && bytes > 0) {
+            m_req->first_byte = now;
+        }
+    }
+    int done = m_req->out.consume(bytes);
+    if(now && done > 0) {
+        access_done(done, now);
+    }
+    return m_req->out.empty();
+}
+
+// 供io_uring后端使用，大文件只包含当前窗口
+struct iovec* http_conn::get_iov(int& count, bool* last) {
+    int mode;
+    bool more;
+    count = m_req->out.gather(&mode, &more);
+    if(count < 0) {
+        return NULL;
+    }
+    *last = !more;
+    return m_req->out.iov();
+}
 
-    bool write_ret = process_write(read_ret);  // 2.生成响应
-    if(!write_ret) {
-        close_conn();
+// 应答发送完毕，释放文件映射；长连接重新初始化并返回true，否则返回false由后端关闭连接
+bool http_conn::finish_write() {
+    if(m_req->deferred == NO_REQUEST) {            // 推迟的应答还要用它已经打开的文件
+        unmap();
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);      // 注册并监听写事件，服务器主线程检测写事件，并调用http_conn::write函数将响应报文发送给浏览器
-}
\ No newline at end of file
+    if(m_keep_alive) {
+        init_response();
+        shrink_read_buf();
+        if(!pipelined()) {
+            release_if_idle();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool http_conn::pipelined() const {
+    return m_req && m_req->out.empty() && (m_req->deferred != NO_REQUEST || m_req->read_idx > m_req->checked_index);
+}
@@ -15,18 +15,31 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <string.h>
+#include <atomic>
 #include "locker.h"
+#include "config.h"
+#include "file_cache.h"
+#include "response_cache.h"
+#include "http_headers.h"
+#include "access_log.h"
+#include "timer_wheel.h"
+#include "slab_pool.h"
+#include "out_queue.h"
+#include "http_response.h"
 
 
 class http_conn {
 public:
-    static const int READ_BUFFER_SIZE = 2048;    // 读缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 1024;   // 写缓冲区大小
     static const int FILENAME_LEN = 200;         // 文件名的最大长度
+    static const int MAX_RANGES = 8;             // 一个Range请求最多支持的范围个数，超过时发送整个文件
+    static const int MAX_PIPELINE = 16;          // 流水线请求一次最多批量发送的应答个数
+    static const int PIPELINE_HEADROOM = 512;    // 写缓冲区剩余空间少于它时不再批量，留给下一个应答的头部
+    static const int RESPONSE_SEGMENTS = 2 * MAX_RANGES + 4;  // 一个应答在输出队列中最多占用的段数
 
     /*定义状态机的状态*/
-    /*HTTP请求方法，我们只支持GET*/
+    /*HTTP请求方法，我们只支持GET和HEAD*/
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
 
     /*
@@ -53,81 +66,243 @@ public:
         NO_RESOURCE         :  表示请求资源不存在 -> 跳转process_write完成响应报文
         FORBIDDEN_REQUEST   :  表示客户对资源没有足够的访问权限 -> 跳转process_write完成响应报文
         FILE_REQUEST        :  请求资源可以正常访问 -> 跳转process_write完成响应报文
+        NOT_MODIFIED        :  条件请求的资源没有变化 -> 跳转process_write发送不带消息体的304
         INTERNAL_ERROR      :  表示服务器内部错误 -> 该结果在主状态机逻辑switch的default下，一般不会触发
         CLOSED_CONNECTION   :  表示客户端已经关闭连接了
     */
     enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, 
                     NO_RESOURCE, FORBIDDEN_REQUEST, 
-                    FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+                    FILE_REQUEST, NOT_MODIFIED, INTERNAL_ERROR, CLOSED_CONNECTION};
+
+    /*
+        连接的超时状态，决定时间轮上的定时器怎样重置
+        TIMER_IDLE    :  长连接在等待下一个请求，每次应答发送完重新计时(keepalive_timeout)
+        TIMER_HEADER  :  正在接收请求，从新连接建立或请求的第一个字节起计时，之后收到数据不延长(header_timeout)
+        TIMER_SEND    :  正在发送应答，每次发送有进展都重新计时(send_timeout)
+    */
+    enum TIMER_STATE {TIMER_IDLE = 0, TIMER_HEADER, TIMER_SEND, TIMER_STATES};
 
 public:
-    http_conn(){}
-    ~http_conn(){}
+    http_conn(): m_epollfd(-1), m_sockfd(-1), m_req(NULL), m_wheel(NULL), m_processing(false) {}
+    ~http_conn() {
+        if(m_req) {
+            release_state();
+        }
+    }
 
 public:
-    void init_conn(int sockfd, const sockaddr_in& addr);  // 初始化新接受的客户连接
+    static void setup(const config& cfg);                 // 设置所有连接共用的运行参数
+    static void print_stats();                            // 打印请求状态池的使用情况
+    // 初始化新接受的客户连接，epollfd为该连接所属reactor的epoll对象，wheel为该reactor的时间轮(NULL为不超时)
+    void init_conn(int sockfd, const sockaddr_in& addr, int epollfd, timer_wheel* wheel);
     void close_conn();                                    // 关闭连接
-    void process();                                       // 处理客户端的请求
+    void process();                                       // 处理客户端的请求(可以在线程池中)，只解析和生成应答，不涉及epoll
+    bool respond();                                       // process()之后由reactor线程调用: 立即发送应答或等待更多数据，需要关闭连接时返回false
     bool read_once();                                     // 非阻塞的读
     bool write();                                         // 非阻塞的写
+    bool reap_zerocopy();                                 // 回收错误队列上的MSG_ZEROCOPY完成通知，有其它错误时返回false
+    void rearm();                                         // 按当前状态重新注册EPOLLIN或EPOLLOUT
+    void update_timer();                                  // 按当前状态重置超时，每次读写之后由所属reactor的线程调用
+    bool expire();                                        // 定时器到期时由reactor线程调用，应当关闭连接时返回true
+    void mark_processing() { m_processing = true; }       // reactor把连接交给线程池之前调用，respond()时清除
+    bool processing() const { return m_processing; }
+    void set_enqueue_time(uint64_t us) { m_enqueue_time = us; }  // 线程池的过载控制用
+    uint64_t enqueue_time() const { return m_enqueue_time; }
+    void shed();                                          // 过载时由reactor调用: 发送预先生成的503应答并关闭连接
+    static void reject(int sockfd);                       // 不能接受的新连接(还没有init_conn)，发送503应答并关闭
+    bool incomplete() const { return m_result == NO_REQUEST; }  // 上一次process()时请求还不完整，没有应答
+    bool sending() const { return m_req && !m_req->out.empty(); }  // 还有应答没有发送完
+    // 连接忙(在线程池中或正在发送)时到达的事件先记下，空闲后由reactor处理，只在ET模式下发生
+    void defer(uint32_t events) { m_deferred |= events; }
+    uint32_t take_deferred() { uint32_t events = m_deferred; m_deferred = 0; return events; }
+
+    // 下面这一组函数供不经过epoll的事件后端(io_uring)使用，由后端自己提交读写
+    int append_read(const char* data, int len);           // 把后端收到的数据追加到读缓冲区，返回放得下的字节数
+    HTTP_CODE process_request();                          // 解析请求并生成应答，不修改epoll事件
+    struct iovec* get_iov(int& count, bool* last);        // 输出队列中下一批待发送的数据，大文件只包含当前窗口，last表示是否包含了剩余的全部数据；映射失败返回NULL
+    bool is_linger() const { return m_keep_alive; }      // 应答发送完后是否保持连接
+    bool sent(long long bytes);                           // 记录已发送的字节并推进输出队列，全部发送完返回true
+    bool finish_write();                                  // 应答发送完毕，长连接返回true并重置状态
+    bool pipelined() const;                               // 应答发送完后读缓冲区中还有未处理的数据(流水线请求)或推迟的应答，调用者应接着处理
 
 private:
     void init();                                           // 初始化连接其余的数据
+    void set_events(int ev);                               // 等待EPOLLIN或EPOLLOUT，只有EPOLLONESHOT模式需要重新注册
+    void init_request();                                   // 开始解析下一个请求，读缓冲区中剩余的数据移到开头
+    void init_response();                                  // 应答发送完后重置发送状态
     HTTP_CODE process_read();                              // 解析HTTP请求
     bool process_write(HTTP_CODE ret);                     // 填充HTTP应答
 
     // 下面这一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char* text);              // 解析请求首行(请求行)，获得请求方法，目标URL，HTTP版本
     HTTP_CODE parse_headers(char* text);                   // 解析请求头
-    HTTP_CODE parse_content(char* text);                   // 解析请求体
+    HTTP_CODE parse_content();                             // 解析请求体
     HTTP_CODE do_request();
-    char* get_line() { return m_read_buf + m_start_line; } // 获取一行数据，m_start_line是行在buffer中的位置，将该位置后面的数据赋给text
+    bool not_modified();                                   // 根据If-None-Match/If-Modified-Since判断客户端缓存的副本是否仍然有效
+    bool if_range_ok();                                    // If-Range与当前文件一致(或没有If-Range)时才处理Range
+    bool cacheable() const;                                // 本次请求能否使用应答缓存
+    const char* header(http_headers::ID id) const;         // 已知请求头部的值，没有时返回NULL
+    char* get_line() { return m_req->read_buf + m_req->start_line; } // 获取一行数据，start_line是行在buffer中的位置，将该位置后面的数据赋给text
     LINE_STATUS parse_line();                              // 解析(获取)一行
 
     // 这一组函数被process_write调用以填充HTTP应答
-    void unmap();                                          // 对内存映射区执行unmap操作
-    bool add_response(const char* format, ...);
-    bool add_content(const char* content);
+    void unmap();                                          // 释放还没有进入输出队列的映射、fd和缓存引用(不发送文件内容的应答)
+    bool queue_response();                                 // 把生成好的应答放进输出队列，文件资源的释放也交给队列
+    bool hold_response();                                  // 还能在当前应答之后接着处理流水线上的下一个请求时返回true
+    void access_begin();                                   // 应答生成后填写访问记录，发送完时再补上时间
+    void access_end(access_log::entry& e, long long bytes, bool complete, uint64_t now);
+    void access_done(int count, uint64_t now);             // 按顺序写出count个发送完的应答的访问记录
+    void access_abort();                                   // 连接关闭时记录还没有发送完的应答
+    ssize_t send_some();                                   // 按队首的发送方式发送一批，返回值同writev
+    int parse_range();                                     // 解析Range头部，返回可满足的范围个数，0为都不可满足，-1为忽略Range
+    bool add_range_headers(int count);                     // 填充206应答的头部(多个范围时还有各部分的头部)
+    // 头部都是拷贝预先生成的片段，写缓冲区放不下时返回false
+    bool add_text(const char* text, int len);
+    template<int N> bool add_literal(const char (&text)[N]) { return add_text(text, N - 1); }
+    bool add_number(long long n);
+    bool add_error(int status);                            // 预先生成的错误应答，写缓冲区中只有Date和空行
+    bool add_validators();
     bool add_content_type();
-    bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length );
-    bool add_content_length(int content_length);
+    bool add_status_line(int status);
+    bool add_headers(long long content_length );
+    bool add_content_length(long long content_length);
+    bool add_content_range(long long start, long long end, long long total);  // start < 0时为 */total
     bool add_linger();
-    bool add_blank_line();
+    bool add_blank_line();                                 // Date和空行，Date总是最后一个头部
+    void set_timer(TIMER_STATE state, int timeout_ms);
 
 public:
-    static int m_epollfd;     // 所有socket上的事件都被注册到同一个epoll对象（内核事件）中
-    static int m_user_count;  // 统计所有用户的数量
+    static std::atomic<int> m_user_count;  // 统计所有用户的数量，多个reactor线程会同时修改
+    static bool m_conn_et;                 // 连接socket是否使用边缘触发
+    /*
+        LT模式下连接使用EPOLLONESHOT，每次读写之后都要epoll_ctl(MOD)重新注册；
+        ET模式下连接一次注册EPOLLIN | EPOLLOUT，之后不再修改，连接忙时到达的事件由reactor记下(defer)
+    */
+    static bool m_oneshot;
+    static int m_read_buffer_size;         // 读缓冲区的初始大小
+    static int m_read_buffer_max;          // 读缓冲区可以增长到的大小
+    static int m_write_buffer_size;        // 写缓冲区大小
+    static const char* m_doc_root;         // 网站的根目录
+    static file_cache* m_file_cache;       // 所有连接共享的文件缓存，为NULL时每个请求都stat/open/mmap
+    static response_cache* m_response_cache;  // 所有连接共享的应答缓存，为NULL时不缓存应答
+    static int m_send_mode;                // 文件内容的发送方式(config::SEND_MODE)
+    static int m_zerocopy_threshold;       // 使用MSG_ZEROCOPY的最小文件大小
+    static int m_stream_window;            // 大文件分段发送的窗口大小(页大小的整数倍)，也是sendfile每次发送的上限
+    static int m_notsent_lowat;            // 连接的TCP_NOTSENT_LOWAT，0为不设置
+    static char m_boundary[32];            // multipart/byteranges的分隔符，启动时随机生成
+    static std::atomic<long> m_zerocopy_sends;    // MSG_ZEROCOPY发送的次数
+    static std::atomic<long> m_zerocopy_done;     // 收到完成通知的次数
+    static std::atomic<long> m_zerocopy_copied;   // 其中内核实际做了拷贝的次数(例如回环网卡)
+    static std::atomic<long> m_rejected;          // accept之后因连接表已满或fd用完而拒绝的连接数
+    static int m_keepalive_timeout;        // 各超时状态的时限(毫秒)，0为不限
+    static int m_header_timeout;
+    static int m_send_timeout;
+    static std::atomic<long> m_timeouts[TIMER_STATES];  // 各状态下超时关闭的连接数
+    static char m_overload_response[128];  // 过载时的503应答(带Retry-After)，启动时生成
+    static int m_overload_len;
 
 private:
-    int m_sockfd;                         // 该HTTP连接的socket
-    sockaddr_in m_address;                // 通信的客户端socket地址
+    /*
+        应答由若干部分组成，每部分是写缓冲区中的一段头部加上文件的一个范围[start, end):
+        普通的200和单个范围的206只有一部分；多个范围时每个范围一部分(头部为分隔符和Content-Range)，
+        最后一部分只有结束分隔符。各部分的头部在写缓冲区中连续存放，第i部分的头部结束于head_end
+    */
+    struct body_part {
+        off_t start;
+        off_t end;
+        int head_end;
+    };
+
+    /*
+        流水线: 读缓冲区中有多个完整的请求时，前面的应答留在输出队列中，和最后一个应答一起发出，
+        这里只保存它们的访问记录(开启访问日志时)，按发送完的顺序写出
+    */
+    struct pipeline {
+        access_log::entry access[MAX_PIPELINE];
+        int first;                             // [first, count)还没有发送完
+        int count;
+        pipeline(): first(0), count(0) {}
+    };
+
+    /*
+        请求状态: 从收到请求的第一个字节到应答发送完(读缓冲区中也没有剩下的数据)之间才需要的数据，
+        和读写缓冲区一起从m_state_pool中分配一块(读写缓冲区紧跟在结构体后面)，连接空闲时归还；
+        空闲的长连接和还没发来数据的新连接只占用http_conn本身
+    */
+    struct request_state {
+        char* read_buf;                   // 读缓冲区，开始时是请求状态后面的m_read_buffer_size字节，头部放不下时换成m_read_pools中更大的块
+        int read_size;                    // 读缓冲区的大小
+        int read_class;                   // 读缓冲区来自m_read_pools[read_class]，-1为请求状态中的初始缓冲区
+        int read_idx;                     // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位
+        int checked_index;                // 当前正在分析的字符在读缓冲区的位置
+        int start_line;                   // 当前正在解析的行的起始位置
+
+        CHECK_STATE check_state;          // 主状态机当前所处的状态
+        METHOD method;                    // 请求方法
 
-    char m_read_buf[READ_BUFFER_SIZE];    // 读缓冲区
-    int m_read_idx;                       // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位
-    int m_checked_index;                  // 当前正在分析的字符在读缓冲区的位置
-    int m_start_line;                     // 当前正在解析的行的起始位置
+        char real_file[FILENAME_LEN];     // 客户请求的目标文件的完整路径，其内容等于 doc_root + url, doc_root是网站根目录
+        char* url;                        // 请求目标文件的文件名
+        char* version;                    // 协议版本，只支持HTTP1.1
+        http_headers headers;             // 请求头部表
+        long long content_length;         // HTTP请求的消息总长度
+        long long body_left;              // 请求体还没有读到的字节数，读到的请求体直接丢弃
+        bool linger;                      // 判断HTTP请求是否保持连接
 
-    CHECK_STATE m_check_state;            // 主状态机当前所处的状态
-    METHOD m_method;                      // 请求方法
+        char* write_buf;                  // 写缓冲区，m_write_buffer_size字节
+        int write_idx;                    // 写缓冲区中待发送的字节数
+        int write_start;                  // 当前应答的头部在写缓冲区中的起始位置，前面是暂存的流水线应答的头部
+        // 生成应答时用到的文件资源，应答进入输出队列后由队列在发送完时释放，这里清空
+        char* file_address;               // 客户请求的目标文件被mmap到内存中的起始位置，大文件和sendfile时为NULL
+        int file_fd;                      // 目标文件的描述符，没有整体映射时使用；来自文件缓存时不属于本连接
+        file_entry* entry;                // 来自文件缓存时持有的条目引用
+        response* cached;                 // 缓存的应答，持有一个引用
+        const http_response::error_page* error;  // 预先生成的错误应答
+        body_part parts[MAX_RANGES + 1];
+        int part_count;                   // 部分的个数，不是文件应答时为0
+        unsigned cache_epoch;             // 应答缓存未命中时的失效计数，插入时带回
+        struct stat file_stat;            // 目标文件的状态，通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
 
-    char m_real_file[FILENAME_LEN];       // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
-    char* m_url;                          // 请求目标文件的文件名
-    char* m_version;                      // 协议版本，只支持HTTP1.1
-    char* m_host;                         // 主机名
-    int m_content_length;                 // HTTP请求的消息总长度
-    bool m_linger;                        // 判断HTTP请求是否保持连接
+        out_queue out;                    // 已经生成、还没有发送完的应答
+        long long response_bytes;         // 最后生成的应答的总字节数，文件可以超过2GB
+        int held;                         // 这一批中排在最后一个应答之前的流水线应答个数
+        HTTP_CODE deferred;               // 头部在暂存的应答之后放不下、等这一批发送完再生成应答的请求，NO_REQUEST为没有
 
-    char m_write_buf[WRITE_BUFFER_SIZE];  // 写缓冲区(字符数组的定义)
-    int m_write_idx;                      // 写缓冲区中待发送的字节数
-    char* m_file_address;                 // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;              // 目标文件的状态，通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                 // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
+        // 访问日志，只在开启时计时
+        uint64_t request_start;           // 收到当前请求第一个字节的时间(微秒)，0为还没有收到
+        uint64_t first_byte;              // 这一批应答发出第一个字节的时间
+        bool access_pending;              // access是当前应答的记录，还没有写出
+        access_log::entry access;
 
-    int bytes_to_send;                    // 要发送的数据的字节数
-    int bytes_have_send;                  // 已经发送的字节数
+        pipeline* pipe;                   // 开启访问日志时第一次遇到流水线请求才分配，和请求状态一起释放
+    };
+
+    bool acquire_state();                 // 读入数据之前调用，分配请求状态和缓冲区，失败返回false
+    void release_state();                 // 归还请求状态，释放它持有的映射和引用
+    void release_if_idle();               // 没有正在发送的应答、读缓冲区也空了时归还请求状态
+    bool grow_read_buf();                 // 读缓冲区满了而请求还不完整时换成大一级的缓冲区，已经最大时返回false
+    void shrink_read_buf();               // 一个请求处理完后剩下的数据放得下时换回初始缓冲区
+
+private:
+    // 连接一直需要的数据，空闲的长连接只有这些
+    int m_epollfd;                        // 该连接注册到的epoll对象，每个reactor有自己的epoll对象
+    int m_sockfd;                         // 该HTTP连接的socket
+    sockaddr_in m_address;                // 通信的客户端socket地址
+    request_state* m_req;                 // 正在处理的请求，连接空闲时为NULL
+    timer_wheel* m_wheel;                 // 所属reactor的时间轮，NULL为不超时
+    timer_node m_timer;                   // 超时，定时器只由所属reactor的线程修改
+    uint64_t m_enqueue_time;              // 交给线程池的时间(微秒)，只在开启过载控制时设置
+    HTTP_CODE m_result;                   // process()的结果，交给respond()
+    uint32_t m_deferred;                  // 连接忙时到达的epoll事件，只由reactor线程读写
+    int m_zerocopy_pending;               // 还没有收到完成通知的MSG_ZEROCOPY发送次数，应答发送完后仍可能有
+    unsigned char m_timer_state;          // TIMER_STATE
+    bool m_processing;                    // 正在线程池中处理，这时到期的定时器推迟一个tick；只由reactor线程读写
+    bool m_keep_alive;                    // 最后生成的应答发送完后是否保持连接，解析下一个请求时linger会被重置
+    bool m_zerocopy_enabled;              // 该socket已经设置了SO_ZEROCOPY
 
+    static slab_pool* m_state_pool;       // 请求状态和读写缓冲区的池
+    static const int READ_CLASSES = 12;   // 读缓冲区增长的级数，每级是上一级的两倍
+    static slab_pool* m_read_pools[READ_CLASSES];  // 增长后的读缓冲区的池，m_read_buffer_size * 2, * 4 ...
+    static int m_read_class_count;        // 实际使用的级数，由m_read_buffer_max决定
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include "http_headers.h"
+#include "perfect_hash.h"
+
+// 已知头部的规范名字，顺序与http_headers::ID一致
+static constexpr const char* header_names[] = {
+    "", "Host", "Connection", "Content-Length", "Transfer-Encoding", "Expect",
+    "Range", "If-Range", "If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since",
+    "Accept", "Accept-Encoding", "Accept-Language", "Cache-Control", "Pragma", "Cookie", "User-Agent",
+    "Referer", "Origin", "Authorization", "Upgrade", "X-Forwarded-For",
+};
+static_assert(sizeof(header_names) / sizeof(header_names[0]) == http_headers::COUNT,
+              "header_names must match http_headers::ID");
+
+static constexpr const char* header_key(int id) {
+    return header_names[id];
+}
+
+// 头部名已经过tchar校验，64个槽
+static constexpr perfect_hash<http_headers::COUNT, 6> header_table(header_key);
+static_assert(header_table.seed() != 0, "no perfect hash seed for the known headers, increase the slot bits");
+
+http_headers::ID http_headers::lookup(const char* name, int len) {
+    return (ID)header_table.find(name, len);
+}
+
+const char* http_headers::name(ID id) {
+    return header_names[id];
+}
@@ -0,0 +1,72 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include <string.h>
+
+/*
+    请求头部表: 每个头部记录为读缓冲区中的(偏移, 长度)，不拷贝也不分配内存
+    解析时头部名经过lookup()映射为ID(编译期生成的完美哈希，一次哈希加一次比较)，
+    已知头部的第一次出现在m_index中有索引，find()是O(1)的；未知头部也会记录，ID为UNKNOWN
+    头部再多也不拒绝请求: 记录满MAX_FIELDS个之后不再记录未知头部和已知头部的重复出现，
+    另外为每个已知头部预留了一个位置，它们的第一次出现总能记录下来
+    值两端的空白已经去掉，值的结尾在读缓冲区中被改成了\0，可以直接当作C字符串使用
+    表属于一个连接，解析每个请求前clear()；读缓冲区中的数据移动后偏移失效，所以只在一个请求内有效
+*/
+class http_headers {
+public:
+    // 新增已知头部时同时修改http_headers.cpp中的名字表，顺序必须一致
+    enum ID {UNKNOWN = 0, HOST, CONNECTION, CONTENT_LENGTH, TRANSFER_ENCODING, EXPECT,
+             RANGE, IF_RANGE, IF_NONE_MATCH, IF_MODIFIED_SINCE, IF_MATCH, IF_UNMODIFIED_SINCE,
+             ACCEPT, ACCEPT_ENCODING, ACCEPT_LANGUAGE, CACHE_CONTROL, PRAGMA, COOKIE, USER_AGENT,
+             REFERER, ORIGIN, AUTHORIZATION, UPGRADE, X_FORWARDED_FOR, COUNT};
+
+    static const int MAX_FIELDS = 32;  // 一个请求记录的头部个数，超过后只记录已知头部的第一次出现
+
+    struct field {
+        unsigned name;                 // 头部名在读缓冲区中的偏移
+        unsigned value;                // 值在读缓冲区中的偏移
+        unsigned value_len;
+        unsigned short name_len;
+        unsigned char id;              // ID
+    };
+
+public:
+    http_headers(): m_count(0) { memset(m_index, 0, sizeof(m_index)); }
+
+    void clear() {
+        if(m_count > 0) {
+            m_count = 0;
+            memset(m_index, 0, sizeof(m_index));
+        }
+    }
+    // 追加一个头部；表满时未知头部和已知头部的重复出现不记录
+    void add(ID id, unsigned name, int name_len, unsigned value, int value_len) {
+        bool first = id != UNKNOWN && m_index[id] == 0;
+        if((m_count >= MAX_FIELDS && !first) || name_len > 0xffff) {
+            return;
+        }
+        field& f = m_fields[m_count++];
+        f.name = name;
+        f.name_len = name_len;
+        f.value = value;
+        f.value_len = value_len;
+        f.id = id;
+        if(first) {
+            m_index[id] = m_count;
+        }
+    }
+    int count() const { return m_count; }
+    const field& operator[](int i) const { return m_fields[i]; }
+    // 已知头部第一次出现的记录，没有时返回NULL
+    const field* find(ID id) const { return m_index[id] ? &m_fields[m_index[id] - 1] : NULL; }
+
+    static ID lookup(const char* name, int len);  // 头部名(不区分大小写)对应的ID，不是已知头部时返回UNKNOWN
+    static const char* name(ID id);               // ID对应的规范名字
+
+private:
+    field m_fields[MAX_FIELDS + COUNT - 1];   // 记录满MAX_FIELDS个之后，每个已知头部最多再占一个
+    unsigned char m_index[COUNT];      // 已知头部在m_fields中的下标加一，0表示没有
+    int m_count;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "http_response.h"
+#include "perfect_hash.h"
+#include <stdio.h>
+#include <string.h>
+
+/*状态行，新增状态码时在这里加一行*/
+struct status_text {
+    int status;
+    const char* line;
+};
+
+static constexpr status_text statuses[] = {
+    {200, "HTTP/1.1 200 OK\r\n"},
+    {206, "HTTP/1.1 206 Partial Content\r\n"},
+    {304, "HTTP/1.1 304 Not Modified\r\n"},
+    {400, "HTTP/1.1 400 Bad Request\r\n"},
+    {403, "HTTP/1.1 403 Forbidden\r\n"},
+    {404, "HTTP/1.1 404 Not Found\r\n"},
+    {416, "HTTP/1.1 416 Range Not Satisfiable\r\n"},
+    {500, "HTTP/1.1 500 Internal Error\r\n"},
+    {503, "HTTP/1.1 503 Service Unavailable\r\n"},
+};
+static const int STATUS_COUNT = sizeof(statuses) / sizeof(statuses[0]);
+
+static constexpr int text_length(const char* s) {
+    int n = 0;
+    while(s[n]) {
+        n++;
+    }
+    return n;
+}
+
+struct length_table {
+    int len[STATUS_COUNT];
+};
+
+static constexpr length_table make_status_lengths() {
+    length_table table = {};
+    for(int i = 0; i < STATUS_COUNT; i++) {
+        table.len[i] = text_length(statuses[i].line);
+    }
+    return table;
+}
+
+static constexpr length_table status_lengths = make_status_lengths();
+
+/*
+    扩展名到Content-Type的表，扩展名为小写；新增类型时只需要在这里加一行，
+    编译期会重新找一个完美哈希的种子
+*/
+struct mime_type {
+    const char* ext;
+    const char* line;
+};
+
+static constexpr mime_type mime_types[] = {
+    {"", "Content-Type: application/octet-stream\r\n"},     // 未知的扩展名
+    {"html", "Content-Type: text/html\r\n"},
+    {"htm", "Content-Type: text/html\r\n"},
+    {"css", "Content-Type: text/css\r\n"},
+    {"js", "Content-Type: text/javascript\r\n"},
+    {"mjs", "Content-Type: text/javascript\r\n"},
+    {"json", "Content-Type: application/json\r\n"},
+    {"txt", "Content-Type: text/plain\r\n"},
+    {"xml", "Content-Type: application/xml\r\n"},
+    {"jpg", "Content-Type: image/jpeg\r\n"},
+    {"jpeg", "Content-Type: image/jpeg\r\n"},
+    {"png", "Content-Type: image/png\r\n"},
+    {"gif", "Content-Type: image/gif\r\n"},
+    {"webp", "Content-Type: image/webp\r\n"},
+    {"svg", "Content-Type: image/svg+xml\r\n"},
+    {"ico", "Content-Type: image/x-icon\r\n"},
+    {"bmp", "Content-Type: image/bmp\r\n"},
+    {"mp4", "Content-Type: video/mp4\r\n"},
+    {"webm", "Content-Type: video/webm\r\n"},
+    {"mp3", "Content-Type: audio/mpeg\r\n"},
+    {"wav", "Content-Type: audio/wav\r\n"},
+    {"woff", "Content-Type: font/woff\r\n"},
+    {"woff2", "Content-Type: font/woff2\r\n"},
+    {"ttf", "Content-Type: font/ttf\r\n"},
+    {"wasm", "Content-Type: application/wasm\r\n"},
+    {"pdf", "Content-Type: application/pdf\r\n"},
+    {"zip", "Content-Type: application/zip\r\n"},
+    {"gz", "Content-Type: application/gzip\r\n"},
+};
+static const int MIME_COUNT = sizeof(mime_types) / sizeof(mime_types[0]);
+
+static constexpr const char* mime_key(int i) {
+    return mime_types[i].ext;
+}
+
+struct mime_lengths {
+    int len[MIME_COUNT];                        // 每一项Content-Type行的长度
+};
+
+static constexpr mime_lengths make_mime_lengths() {
+    mime_lengths table = {};
+    for(int i = 0; i < MIME_COUNT; i++) {
+        table.len[i] = text_length(mime_types[i].line);
+    }
+    return table;
+}
+
+static constexpr perfect_hash<MIME_COUNT, 6> mime_table(mime_key);   // 64个槽
+static_assert(mime_table.seed() != 0, "no perfect hash seed for the known extensions, increase the slot bits");
+static constexpr mime_lengths mime_lines = make_mime_lengths();
+
+/*错误应答的页面内容*/
+struct error_form {
+    int status;
+    const char* body;
+};
+
+static const error_form error_forms[] = {
+    {400, "Your request has bad syntax or is inherently impossible to satisfy.\n"},
+    {403, "You do not have permission to get file from this server.\n"},
+    {404, "The requested file was not found on this server.\n"},
+    {500, "There was an unusual problem serving the requested file.\n"},
+};
+static const int ERROR_COUNT = sizeof(error_forms) / sizeof(error_forms[0]);
+
+static char error_heads[ERROR_COUNT][2][160];    // [错误][短连接/长连接]
+static http_response::error_page error_pages[ERROR_COUNT][2];
+
+// 两位一组的十进制数字
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char* const day_names[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* const month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                          "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+void http_response::init() {
+    int type_len;
+    const char* type = content_type(".html", &type_len);
+    for(int i = 0; i < ERROR_COUNT; i++) {
+        int status = error_forms[i].status;
+        int line_len = 0;
+        const char* line = status_line(status, &line_len);
+        const char* body = error_forms[i].body;
+        int body_len = strlen(body);
+        for(int linger = 0; linger < 2; linger++) {
+            char* head = error_heads[i][linger];
+            int len = snprintf(head, sizeof(error_heads[i][linger]), "%.*sContent-Length: %d\r\n%.*sConnection: %s\r\n",
+                               line_len, line, body_len, type_len, type, linger ? "keep-alive" : "close");
+            error_page& page = error_pages[i][linger];
+            page.status = status;
+            page.head = head;
+            page.head_len = len;
+            page.body = body;
+            page.body_len = body_len;
+        }
+    }
+}
+
+const char* http_response::status_line(int status, int* len) {
+    for(int i = 0; i < STATUS_COUNT; i++) {
+        if(statuses[i].status == status) {
+            *len = status_lengths.len[i];
+            return statuses[i].line;
+        }
+    }
+    return NULL;
+}
+
+/*
+    每个线程一份，只在秒数变化时重新格式化；
+    返回的缓冲区下一秒会被改写，调用者要立即拷贝
+*/
+const char* http_response::header_end() {
+    static thread_local time_t cached = 0;
+    static thread_local char line[HEADER_END_LEN + 1] = "Date: ";
+    time_t now = time(NULL);
+    if(now != cached) {
+        cached = now;
+        format_date(line + 6, now);
+        memcpy(line + 6 + DATE_LEN, "\r\n\r\n", 4);
+    }
+    return line;
+}
+
+// 扩展名从最后一个/之后的最后一个.开始
+const char* http_response::content_type(const char* path, int* len) {
+    int index = 0;
+    const char* dot = strrchr(path, '.');
+    if(dot && !strchr(dot, '/')) {
+        const char* ext = dot + 1;
+        index = mime_table.find(ext, strlen(ext));
+    }
+    *len = mime_lines.len[index];
+    return mime_types[index].line;
+}
+
+const http_response::error_page* http_response::error(int status, bool linger) {
+    for(int i = 0; i < ERROR_COUNT; i++) {
+        if(error_pages[i][0].status == status) {
+            return &error_pages[i][linger ? 1 : 0];
+        }
+    }
+    return NULL;
+}
+
+// 先数出位数，再从低位起每次写两位
+int http_response::format_number(char* buf, unsigned long long n) {
+    int len = 1;
+    for(unsigned long long v = n; ; v /= 10000, len += 4) {
+        if(v < 10) {
+            break;
+        }
+        if(v < 100) {
+            len += 1;
+            break;
+        }
+        if(v < 1000) {
+            len += 2;
+            break;
+        }
+        if(v < 10000) {
+            len += 3;
+            break;
+        }
+    }
+    char* p = buf + len;
+    while(n >= 100) {
+        unsigned i = (unsigned)(n % 100) * 2;
+        n /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + i, 2);
+    }
+    if(n >= 10) {
+        memcpy(p - 2, digit_pairs + n * 2, 2);
+    } else {
+        p[-1] = '0' + (char)n;
+    }
+    return len;
+}
+
+int http_response::format_hex(char* buf, unsigned long long n) {
+    static const char digits[] = "0123456789abcdef";
+    int len = 1;
+    while(len < 16 && (n >> (len * 4)) != 0) {
+        len++;
+    }
+    for(int i = len - 1; i >= 0; i--) {
+        buf[i] = digits[n & 0xf];
+        n >>= 4;
+    }
+    return len;
+}
+
+// 固定格式，不依赖locale，代替strftime的"%a, %d %b %Y %H:%M:%S GMT"
+int http_response::format_date(char* buf, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    memcpy(buf, day_names[tm.tm_wday], 3);
+    buf[3] = ',';
+    buf[4] = ' ';
+    memcpy(buf + 5, digit_pairs + tm.tm_mday * 2, 2);
+    buf[7] = ' ';
+    memcpy(buf + 8, month_names[tm.tm_mon], 3);
+    buf[11] = ' ';
+    int year = tm.tm_year + 1900;
+    memcpy(buf + 12, digit_pairs + year / 100 * 2, 2);
+    memcpy(buf + 14, digit_pairs + year % 100 * 2, 2);
+    buf[16] = ' ';
+    memcpy(buf + 17, digit_pairs + tm.tm_hour * 2, 2);
+    buf[19] = ':';
+    memcpy(buf + 20, digit_pairs + tm.tm_min * 2, 2);
+    buf[22] = ':';
+    memcpy(buf + 23, digit_pairs + tm.tm_sec * 2, 2);
+    memcpy(buf + 25, " GMT", 4);
+    return DATE_LEN;
+}
@@ -0,0 +1,46 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <time.h>
+
+/*
+    应答头部的构造材料，生成头部时只做memcpy，不经过vsnprintf
+    1. 状态行: 支持的状态码的"HTTP/1.1 200 OK\r\n"预先写好，连同长度
+    2. Date: 每个线程缓存一行"Date: ...\r\n\r\n"(Date总是最后一个头部，后面跟着空行)，秒数变化时才重新格式化
+    3. Content-Type: 按扩展名查编译期生成的完美哈希表(一次哈希加一次比较)，得到整行"Content-Type: ...\r\n"
+    4. 整数: 每次转换两位的十进制和十六进制格式化，代替%lld和%llx
+    5. 400/403/404/500错误应答: 状态行、Content-Length、Content-Type、Connection和页面内容启动时生成好，
+       应答直接引用这些常量，只有Date在写缓冲区中
+*/
+class http_response {
+public:
+    static const int DATE_LEN = 29;                       // HTTP日期，例如 Sun, 06 Nov 1994 08:49:37 GMT
+    static const int HEADER_END_LEN = 6 + DATE_LEN + 4;   // "Date: <日期>\r\n\r\n"
+    static const int NUMBER_MAX = 20;                     // 最长的64位无符号十进制数
+
+    // 预先生成的错误应答，head从状态行到Connection头部，后面是Date和空行，最后是body(HEAD请求不发送)
+    struct error_page {
+        int status;
+        const char* head;
+        int head_len;
+        const char* body;
+        int body_len;
+    };
+
+    static void init();                                   // 生成错误应答，启动时调用一次
+
+    // 状态码的状态行，不支持的状态码返回NULL
+    static const char* status_line(int status, int* len);
+    // 当前时间的"Date: ...\r\n\r\n"，返回本线程的缓冲区，长度为HEADER_END_LEN
+    static const char* header_end();
+    // 路径的扩展名对应的"Content-Type: ...\r\n"，未知的扩展名为application/octet-stream
+    static const char* content_type(const char* path, int* len);
+    static const error_page* error(int status, bool linger);   // 不是400/403/404/500时返回NULL
+
+    // 写入buf并返回长度，不补\0；buf至少要有NUMBER_MAX / DATE_LEN个字节
+    static int format_number(char* buf, unsigned long long n);
+    static int format_hex(char* buf, unsigned long long n);
+    static int format_date(char* buf, time_t t);
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "http_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCANNER_X86
+#endif
+
+/*
+    标量实现使用的字符分类表，每个字节一组标志位:
+    CLASS_CTL       : find_ctl要停下的字符
+    CLASS_NON_TOKEN : 不是tchar
+    CLASS_NON_VCHAR : 不是可见字符
+*/
+enum {CLASS_CTL = 1, CLASS_NON_TOKEN = 2, CLASS_NON_VCHAR = 4};
+static const unsigned char char_class[256] = {
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 7, 7, 7, 7, 7, 7,  // 0x00
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  // 0x10
+    6, 0, 2, 0, 0, 0, 0, 0, 2, 2, 0, 0, 2, 0, 0, 2,  // 0x20
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2,  // 0x30
+    2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x40
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 0, 0,  // 0x50
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x60
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 7,  // 0x70
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0x80
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0x90
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xa0
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xb0
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xc0
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xd0
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xe0
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,  // 0xf0
+};
+
+static inline const char* scan_scalar(const char* p, const char* end, unsigned char cls) {
+    // 每次展开4个字节，减少循环判断
+    for( ; end - p >= 4; p += 4) {
+        if(char_class[(unsigned char)p[0]] & cls) return p;
+        if(char_class[(unsigned char)p[1]] & cls) return p + 1;
+        if(char_class[(unsigned char)p[2]] & cls) return p + 2;
+        if(char_class[(unsigned char)p[3]] & cls) return p + 3;
+    }
+    for( ; p < end; p++) {
+        if(char_class[(unsigned char)*p] & cls) {
+            return p;
+        }
+    }
+    return end;
+}
+
+static const char* find_ctl_scalar(const char* p, const char* end) {
+    return scan_scalar(p, end, CLASS_CTL);
+}
+
+static const char* find_non_token_scalar(const char* p, const char* end) {
+    return scan_scalar(p, end, CLASS_NON_TOKEN);
+}
+
+static const char* find_non_vchar_scalar(const char* p, const char* end) {
+    return scan_scalar(p, end, CLASS_NON_VCHAR);
+}
+
+#ifdef HTTP_SCANNER_X86
+
+/*
+    SSE4.2: pcmpestri的范围模式，一条指令就能在16个字节中找到第一个落在给定范围(最多8个)内的字节
+    范围表为成对的[下界, 上界]
+*/
+#define SSE42_RANGES (_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT)
+
+__attribute__((target("sse4.2")))
+static const char* find_ctl_sse42(const char* p, const char* end) {
+    static const char ranges[16] = "\x00\x08" "\x0a\x1f" "\x7f\x7f";  // 除HTAB(0x09)外的控制字符和DEL
+    const __m128i r = _mm_loadu_si128((const __m128i*)ranges);
+    for( ; end - p >= 16; p += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        int i = _mm_cmpestri(r, 6, b, 16, SSE42_RANGES);
+        if(i != 16) {
+            return p + i;
+        }
+    }
+    return find_ctl_scalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+static const char* find_non_token_sse42(const char* p, const char* end) {
+    // 不是tchar的字符正好需要9个范围，把{|}~和DEL以上合并成一个，停在|或~上时再用查表确认
+    static const char ranges[17] = "\x00\x20" "\x22\x22" "\x28\x29" "\x2c\x2c"
+                                   "\x2f\x2f" "\x3a\x40" "\x5b\x5d" "\x7b\xff";
+    const __m128i r = _mm_loadu_si128((const __m128i*)ranges);
+    while(end - p >= 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        int i = _mm_cmpestri(r, 16, b, 16, SSE42_RANGES);
+        if(i == 16) {
+            p += 16;
+        } else if(char_class[(unsigned char)p[i]] & CLASS_NON_TOKEN) {
+            return p + i;
+        } else {
+            p += i + 1;
+        }
+    }
+    return find_non_token_scalar(p, end);
+}
+
+__attribute__((target("sse4.2")))
+static const char* find_non_vchar_sse42(const char* p, const char* end) {
+    static const char ranges[16] = "\x00\x20" "\x7f\xff";
+    const __m128i r = _mm_loadu_si128((const __m128i*)ranges);
+    for( ; end - p >= 16; p += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        int i = _mm_cmpestri(r, 4, b, 16, SSE42_RANGES);
+        if(i != 16) {
+            return p + i;
+        }
+    }
+    return find_non_vchar_scalar(p, end);
+}
+
+/*
+    AVX2: 一次比较32个字节得到一个位掩码，第一个置位的位就是要找的位置
+    tchar没有规律，用两次pshufb查表分类: 低4位查出该列中哪些行(高4位，0-7)是tchar，
+    再和高4位对应的行位相与，结果为0的字节不是tchar(高4位大于7的行位为0，DEL以上都不是tchar)
+*/
+__attribute__((target("avx2")))
+static const char* find_ctl_avx2(const char* p, const char* end) {
+    const __m256i c1f = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for( ; end - p >= 32; p += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(b, c1f), b);             // b <= 0x1f
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(b, tab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(b, del));
+        unsigned mask = _mm256_movemask_epi8(ctl);
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_ctl_sse42(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_non_token_avx2(const char* p, const char* end) {
+    const __m256i rows = _mm256_setr_epi8(
+        0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70,
+        0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70);
+    const __m256i row_bit = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    for( ; end - p >= 32; p += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        __m256i lo = _mm256_and_si256(b, low4);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(b, 4), low4);
+        __m256i hit = _mm256_and_si256(_mm256_shuffle_epi8(rows, lo), _mm256_shuffle_epi8(row_bit, hi));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, zero));
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_non_token_sse42(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_non_vchar_avx2(const char* p, const char* end) {
+    // 有符号比较: 0x80以上的字节是负数，也落在(0x20, 0x7f)之外
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for( ; end - p >= 32; p += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(b, space), _mm256_cmpgt_epi8(del, b));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(ok);
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_non_vchar_sse42(p, end);
+}
+
+#endif
+
+http_scanner::scan_fn http_scanner::m_find_ctl = find_ctl_scalar;
+http_scanner::scan_fn http_scanner::m_find_non_token = find_non_token_scalar;
+http_scanner::scan_fn http_scanner::m_find_non_vchar = find_non_vchar_scalar;
+
+http_scanner::ISA http_scanner::init(ISA max) {
+    ISA isa = SCALAR;
+#ifdef HTTP_SCANNER_X86
+    __builtin_cpu_init();
+    if(max >= AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+        isa = AVX2;
+    } else if(max >= SSE42 && __builtin_cpu_supports("sse4.2")) {
+        isa = SSE42;
+    }
+    switch(isa) {
+        case AVX2:
+            m_find_ctl = find_ctl_avx2;
+            m_find_non_token = find_non_token_avx2;
+            m_find_non_vchar = find_non_vchar_avx2;
+            return isa;
+        case SSE42:
+            m_find_ctl = find_ctl_sse42;
+            m_find_non_token = find_non_token_sse42;
+            m_find_non_vchar = find_non_vchar_sse42;
+            return isa;
+        default:
+            break;
+    }
+#endif
+    m_find_ctl = find_ctl_scalar;
+    m_find_non_token = find_non_token_scalar;
+    m_find_non_vchar = find_non_vchar_scalar;
+    return isa;
+}
+
+const char* http_scanner::isa_name(ISA isa) {
+    static const char* names[] = {"scalar", "sse4.2", "avx2"};
+    return names[isa];
+}
@@ -0,0 +1,33 @@
+#ifndef HTTP_SCANNER_H
+#define HTTP_SCANNER_H
+
+/*
+    HTTP请求的字符扫描: 一次检查16(SSE4.2)或32(AVX2)个字节，在找行尾、分词边界的同时校验字符是否合法
+    init()按CPU支持的指令集选择实现，不支持时(或非x86)使用查表的标量实现
+    所有函数都返回[p, end)中第一个满足条件的位置，没有时返回end，不会读取end之后的内存
+    1. find_ctl:       第一个控制字符(0x00-0x1f中除HTAB外的字符和DEL)，正常的行在\r或\n处停下，
+                       停在其它字符上说明行中有非法字符
+    2. find_non_token: 第一个不是tchar(方法名和头部名允许的字符: 字母、数字和!#$%&'*+-.^_`|~)的字符
+    3. find_non_vchar: 第一个不是可见字符(0x21-0x7e)的字符，用于URL
+    解析时行尾的\r\n已经被改成\0，所以在一行之内扫描时一定会在行尾停下
+*/
+class http_scanner {
+public:
+    enum ISA {SCALAR = 0, SSE42, AVX2};
+
+    static ISA init(ISA max = AVX2);              // 选择不超过max且CPU支持的实现，返回选中的实现
+    static const char* isa_name(ISA isa);
+
+    static const char* find_ctl(const char* p, const char* end) { return m_find_ctl(p, end); }
+    static const char* find_non_token(const char* p, const char* end) { return m_find_non_token(p, end); }
+    static const char* find_non_vchar(const char* p, const char* end) { return m_find_non_vchar(p, end); }
+
+private:
+    typedef const char* (*scan_fn)(const char* p, const char* end);
+
+    static scan_fn m_find_ctl;
+    static scan_fn m_find_non_token;
+    static scan_fn m_find_non_vchar;
+};
+
+#endif
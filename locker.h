@@ -6,6 +6,11 @@
 #include <exception>
 /*信号量头文件*/
 #include <semaphore.h>
+#include <atomic>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /*线程同步机制的封装类：信号量、互斥量（锁）、条件变量*/
 
@@ -99,6 +104,10 @@ public:
     bool wait() {
         return sem_wait(&m_sem) == 0;
     }
+    /*等待信号量，最多等到绝对时间t(CLOCK_REALTIME)*/
+    bool timedwait(struct timespec t) {
+        return sem_timedwait(&m_sem, &t) == 0;
+    }
     /*增加信号量*/
     bool post() {
         return sem_post(&m_sem) == 0;
@@ -109,4 +118,51 @@ private:
 };
 
 
-#endif
\ No newline at end of file
+/*自旋等待时提示CPU降低功耗、让出流水线给同一核心上的另一个超线程*/
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+    eventcount: 让等待"某个条件成立"的线程睡眠，条件由使用者自己检查(例如无锁队列非空)
+    等待方: key = prepare_wait(); 再检查一次条件; 成立就cancel_wait()，否则wait(key)
+    通知方: 先使条件成立，再notify()；没有等待者时notify()只是一次读，不进入内核
+    prepare_wait()之后的notify()会改变m_epoch，wait(key)发现它变了就不会睡下去，所以不会丢失唤醒
+*/
+class eventcount {
+public:
+    eventcount(): m_epoch(0), m_waiters(0) {}
+
+    int prepare_wait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_acquire);
+    }
+    void cancel_wait() {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void wait(int key) {
+        while(m_epoch.load(std::memory_order_acquire) == key) {
+            syscall(SYS_futex, &m_epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);  // m_epoch不等于key时立即返回
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    /*唤醒一个(all为true时所有)等待者*/
+    void notify(bool all = false) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // 和prepare_wait()配对: 条件的修改先于读m_waiters
+        if(m_waiters.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &m_epoch, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+    }
+
+private:
+    std::atomic<int> m_epoch;           // 每次有等待者时的通知加1，futex等在它上面
+    std::atomic<int> m_waiters;         // 已经prepare_wait()还没有返回的线程数
+};
+
+#endif
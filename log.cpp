@@ -0,0 +1,376 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+    环形缓冲区: head和tail只增不减，取模后是在data中的位置
+    本线程格式化好一整行后写入并发布head，后台线程读到head为止并发布tail，两者都不需要加锁
+*/
+struct logger::ring {
+    char* data;
+    unsigned long mask;                   // 大小减一(大小是2的幂)
+    std::atomic<unsigned long> head;      // 生产者写到的位置
+    std::atomic<unsigned long> tail;      // 后台线程写出到的位置
+    std::atomic<long> dropped;
+    int id;                               // 线程编号，出现在每行日志中
+    time_t stamp_sec;                     // 缓存的时间戳对应的秒
+    char stamp[24];                       // "2026-01-01 00:00:00"
+    char line[MAX_LINE];
+};
+
+std::atomic<int> logger::m_level(logger::INFO);
+std::atomic<bool> logger::m_running(false);
+std::atomic<logger::ring*> logger::m_rings[logger::MAX_THREADS];
+std::atomic<int> logger::m_ring_count(0);
+thread_local logger::ring* logger::m_local = NULL;
+int logger::m_buffer_size = 256 << 10;
+int logger::m_fd = STDOUT_FILENO;
+char logger::m_path[256] = "";
+long logger::m_file_size = 0;
+long logger::m_max_size = 0;
+int logger::m_files = 0;
+pthread_t logger::m_thread;
+sem logger::m_wakeup;
+std::atomic<bool> logger::m_wakeup_pending(false);
+std::atomic<bool> logger::m_reopen(false);
+locker logger::m_file_lock;
+
+static const char* level_names[] = {"debug", "info", "warn", "error", "off"};
+static const char* level_tags[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+static const int FLUSH_INTERVAL_MS = 100;  // 没有被唤醒时后台线程写出的间隔
+
+bool logger::init(const char* path, int level, long file_size, int files, int buffer_size) {
+    if(m_running) {
+        return false;
+    }
+    fflush(stdout);  // 之前printf的内容先输出，保持顺序
+    if(path && path[0]) {
+        if(strlen(path) >= sizeof(m_path)) {
+            printf("log file path too long: %s\n", path);
+            return false;
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            printf("cannot open log file %s: %s\n", path, strerror(errno));
+            return false;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        strcpy(m_path, path);
+        m_fd = fd;
+        m_file_size = st.st_size;
+        m_max_size = file_size;
+        m_files = files;
+    }
+    int size = 4096;
+    while(size < buffer_size) {
+        size <<= 1;
+    }
+    m_buffer_size = size;
+    set_level(level);
+
+    m_running = true;
+    if(pthread_create(&m_thread, NULL, flush_worker, NULL) != 0) {
+        m_running = false;
+        return false;
+    }
+    static bool registered = false;
+    if(!registered) {
+        atexit(shutdown);  // exit()时写出缓冲区中剩下的日志，例如初始化失败时的错误信息
+        registered = true;
+    }
+    return true;
+}
+
+void logger::shutdown() {
+    if(!m_running.exchange(false)) {
+        return;
+    }
+    m_wakeup.post();
+    pthread_join(m_thread, NULL);
+    flush();
+}
+
+void logger::reopen() {
+    m_reopen = true;
+    if(m_running && !m_wakeup_pending.exchange(true)) {
+        m_wakeup.post();
+    }
+}
+
+int logger::parse_level(const char* name) {
+    for(int i = DEBUG; i <= OFF; i++) {
+        if(strcasecmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* logger::level_name(int level) {
+    return level_names[level];
+}
+
+long logger::dropped() {
+    long total = 0;
+    int count = m_ring_count.load();
+    for(int i = 0; i < count && i < MAX_THREADS; i++) {
+        ring* r = m_rings[i].load(std::memory_order_acquire);
+        if(r) {
+            total += r->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+void logger::print_stats() {
+    int threads = m_ring_count.load();
+    printf("log: level=%s threads=%d dropped=%ld\n", level_name(level()), threads < MAX_THREADS ? threads : MAX_THREADS,
+           dropped());
+}
+
+// 本线程的缓冲区，第一次调用时分配并登记；线程数超过上限时返回NULL
+logger::ring* logger::local_ring() {
+    if(m_local) {
+        return m_local;
+    }
+    static thread_local bool overflow = false;  // 登记失败的线程之后不再尝试
+    if(overflow) {
+        return NULL;
+    }
+    int id = m_ring_count.fetch_add(1);
+    if(id >= MAX_THREADS) {
+        overflow = true;
+        return NULL;
+    }
+    ring* r = new ring;
+    r->data = new char[m_buffer_size];
+    r->mask = m_buffer_size - 1;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->id = id;
+    r->stamp_sec = -1;
+    m_rings[id].store(r, std::memory_order_release);
+    m_local = r;
+    return r;
+}
+
+// 把非负整数写成至少width位的十进制数(不足时补0)，返回写入的字节数
+static int put_uint(char* p, unsigned long v, int width) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v || n < width);
+    for(int i = 0; i < n; i++) {
+        p[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+// 格式化一行日志，返回长度(包括末尾的\n)
+// 前缀"日期.微秒 级别 线程 文件:行号 "手工拼接，snprintf格式化前缀的开销比消息本身还大
+static int format_line(char* buf, time_t* stamp_sec, char* stamp, int id, int level,
+                       const char* file, int line, const char* format, va_list ap) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(ts.tv_sec != *stamp_sec) {  // 同一秒内的日志复用格式化好的日期
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(stamp, 24, "%Y-%m-%d %H:%M:%S", &tm);
+        *stamp_sec = ts.tv_sec;
+    }
+    const char* base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    int base_len = strlen(base);
+    if(base_len > 64) {
+        base_len = 64;
+    }
+    char* p = buf;
+    memcpy(p, stamp, 19);
+    p += 19;
+    *p++ = '.';
+    p += put_uint(p, ts.tv_nsec / 1000, 6);
+    *p++ = ' ';
+    memcpy(p, level_tags[level], 5);
+    p += 5;
+    *p++ = ' ';
+    if(id < 0) {
+        *p++ = '-';
+    } else {
+        p += put_uint(p, id, 1);
+    }
+    *p++ = ' ';
+    memcpy(p, base, base_len);
+    p += base_len;
+    *p++ = ':';
+    p += put_uint(p, line, 1);
+    *p++ = ' ';
+    int n = p - buf;
+    n += vsnprintf(buf + n, logger::MAX_LINE - n, format, ap);
+    if(n > logger::MAX_LINE - 1) {  // 截断
+        n = logger::MAX_LINE - 1;
+    }
+    buf[n++] = '\n';
+    return n;
+}
+
+void logger::write(int level, const char* file, int line, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    ring* r = m_running.load(std::memory_order_relaxed) ? local_ring() : NULL;
+    if(!r) {
+        // 还没有启动后台线程或者线程太多: 同步写
+        char buf[MAX_LINE];
+        time_t sec = -1;
+        char stamp[24];
+        int n = format_line(buf, &sec, stamp, -1, level, file, line, format, ap);
+        va_end(ap);
+        m_file_lock.lock();
+        fflush(stdout);
+        write_file(buf, n);
+        m_file_lock.unlock();
+        return;
+    }
+    int n = format_line(r->line, &r->stamp_sec, r->stamp, r->id, level, file, line, format, ap);
+    va_end(ap);
+
+    unsigned long size = r->mask + 1;
+    unsigned long head = r->head.load(std::memory_order_relaxed);
+    unsigned long tail = r->tail.load(std::memory_order_acquire);
+    if(head - tail + n > size) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    unsigned long offset = head & r->mask;
+    unsigned long first = size - offset < (unsigned long)n ? size - offset : n;
+    memcpy(r->data + offset, r->line, first);
+    memcpy(r->data, r->line + first, n - first);
+    r->head.store(head + n, std::memory_order_release);
+
+    // 错误需要尽快落盘；缓冲区过半时提前写出，减少丢弃
+    if(level >= ERROR || head + n - tail > size / 2) {
+        if(!m_wakeup_pending.exchange(true)) {
+            m_wakeup.post();
+        }
+    }
+}
+
+void* logger::flush_worker(void*) {
+    while(m_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        m_wakeup.timedwait(deadline);
+        m_wakeup_pending = false;
+        if(m_reopen.exchange(false)) {
+            m_file_lock.lock();
+            reopen_file();
+            m_file_lock.unlock();
+        }
+        flush();
+    }
+    return NULL;
+}
+
+// 把每个缓冲区中[tail, head)的数据写到文件，环绕时分两段
+void logger::flush() {
+    int count = m_ring_count.load();
+    for(int i = 0; i < count && i < MAX_THREADS; i++) {
+        ring* r = m_rings[i].load(std::memory_order_acquire);
+        if(!r) {
+            continue;
+        }
+        unsigned long head = r->head.load(std::memory_order_acquire);
+        unsigned long tail = r->tail.load(std::memory_order_relaxed);
+        if(head == tail) {
+            continue;
+        }
+        unsigned long size = r->mask + 1;
+        unsigned long offset = tail & r->mask;
+        unsigned long len = head - tail;
+        unsigned long first = size - offset < len ? size - offset : len;
+        m_file_lock.lock();
+        write_file(r->data + offset, first);
+        if(len > first) {
+            write_file(r->data, len - first);
+        }
+        m_file_lock.unlock();
+        r->tail.store(head, std::memory_order_release);
+    }
+}
+
+bool logger::write_file(const char* data, long len) {
+    if(m_max_size > 0 && m_fd != STDOUT_FILENO && m_file_size > 0 && m_file_size + len > m_max_size) {
+        rotate();
+    }
+    while(len > 0) {
+        ssize_t n = ::write(m_fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+        m_file_size += n;
+    }
+    return true;
+}
+
+// path.(files-1) -> path.files, ..., path -> path.1，然后重新创建path
+void logger::rotate() {
+    char from[sizeof(m_path) + 16];
+    char to[sizeof(m_path) + 16];
+    for(int i = m_files - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", m_path, i);
+        snprintf(to, sizeof(to), "%s.%d", m_path, i + 1);
+        rename(from, to);
+    }
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    if(m_files > 0) {
+        snprintf(to, sizeof(to), "%s.1", m_path);
+        rename(m_path, to);
+    } else {
+        flags |= O_TRUNC;  // 不保留旧文件
+    }
+    int fd = open(m_path, flags, 0644);
+    if(fd < 0) {
+        return;  // 继续写原来的文件
+    }
+    close(m_fd);
+    m_fd = fd;
+    m_file_size = 0;
+}
+
+// 日志被外部工具改名之后，m_fd还指向改名后的文件，按路径重新打开
+void logger::reopen_file() {
+    if(m_fd == STDOUT_FILENO) {
+        return;
+    }
+    int fd = open(m_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return;  // 继续写原来的文件
+    }
+    struct stat st;
+    fstat(fd, &st);
+    close(m_fd);
+    m_fd = fd;
+    m_file_size = st.st_size;
+}
@@ -0,0 +1,85 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <pthread.h>
+#include "locker.h"
+
+/*
+    异步分级日志
+    1. 每个线程第一次写日志时得到自己的环形缓冲区(单生产者单消费者，无锁)，日志在本线程内格式化后整行放入
+    2. 后台线程定期(或缓冲区过半、出现ERROR时被唤醒)把所有缓冲区中的数据批量写入文件，
+       文件超过大小上限时轮转: path -> path.1 -> path.2 ...，最多保留files个旧文件
+    3. 缓冲区满时丢弃日志并计数，不会阻塞工作线程
+    4. 级别低于运行时级别的语句只有一次比较，参数不会被求值；
+       低于编译期级别LOG_COMPILE_LEVEL的语句在编译时被去掉，例如 -DLOG_COMPILE_LEVEL=1 去掉所有DEBUG日志
+    init()之前(解析配置时)和线程数超过上限时，日志直接同步写到标准输出
+*/
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+#define LOG(level, format, ...)                                                            \
+    do {                                                                                   \
+        if((level) >= LOG_COMPILE_LEVEL && logger::enabled(level)) {                       \
+            logger::write(level, __FILE__, __LINE__, format, ##__VA_ARGS__);                \
+        }                                                                                  \
+    } while(0)
+
+#define LOG_DEBUG(format, ...) LOG(logger::DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)  LOG(logger::INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)  LOG(logger::WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG(logger::ERROR, format, ##__VA_ARGS__)
+
+class logger {
+public:
+    enum LEVEL {DEBUG = 0, INFO, WARN, ERROR, OFF};
+
+    static const int MAX_THREADS = 256;         // 最多的日志缓冲区(线程)个数
+    static const int MAX_LINE = 1024;           // 一条日志的最大长度，超过时截断
+
+    // path为空时写到标准输出；file_size为0时不轮转；buffer_size为每个线程缓冲区的字节数，向上取2的幂
+    static bool init(const char* path, int level, long file_size, int files, int buffer_size);
+    static void shutdown();                     // 写出所有缓冲区中的日志并停止后台线程，进程退出时自动调用
+    static void reopen();                       // 请后台线程重新打开日志文件(日志被外部轮转之后)，可以在任何线程中调用
+
+    static bool enabled(int level) { return __builtin_expect(level >= m_level.load(std::memory_order_relaxed), 0); }
+    static void set_level(int level) { m_level.store(level, std::memory_order_relaxed); }
+    static int level() { return m_level.load(std::memory_order_relaxed); }
+    static void write(int level, const char* file, int line, const char* format, ...)
+        __attribute__((format(printf, 4, 5)));
+
+    static int parse_level(const char* name);  // 级别名(debug/info/warn/error/off)，无法识别时返回-1
+    static const char* level_name(int level);
+    static long dropped();                      // 因缓冲区满而丢弃的日志条数
+    static void print_stats();
+
+private:
+    struct ring;
+    static ring* local_ring();
+    static void* flush_worker(void*);
+    static void flush();                        // 只在后台线程(或停止后)调用
+    static bool write_file(const char* data, long len);   // 调用者持有m_file_lock
+    static void rotate();
+    static void reopen_file();                  // 只在后台线程调用，调用者持有m_file_lock
+
+private:
+    static std::atomic<int> m_level;           // 运行时级别
+    static std::atomic<bool> m_running;        // 后台线程是否在运行，否则同步写
+    static std::atomic<ring*> m_rings[MAX_THREADS];
+    static std::atomic<int> m_ring_count;
+    static thread_local ring* m_local;         // 本线程的缓冲区
+    static int m_buffer_size;
+    static int m_fd;                           // 日志文件，默认是标准输出
+    static char m_path[256];
+    static long m_file_size;                   // 当前文件的大小
+    static long m_max_size;
+    static int m_files;
+    static pthread_t m_thread;
+    static sem m_wakeup;                       // 唤醒后台线程
+    static std::atomic<bool> m_wakeup_pending; // 已经唤醒过还没有处理，避免重复post
+    static std::atomic<bool> m_reopen;         // reopen()请求的重新打开，由后台线程处理
+    static locker m_file_lock;                 // 保护m_fd和m_file_size: 同步写的线程和后台线程的写出、轮转、重新打开
+};
+
+#endif
@@ -12,16 +12,14 @@
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "config.h"
+#include "log.h"
+#include "access_log.h"
+#include "topology.h"
+#include "conn_table.h"
 
-#define MAX_FD 65535            // 最大的文件描述符个数
-#define MAX_EVENT_NUMBER 10000  // epoll最大支持同时监听的事件个数
-
-#define listenfdLT    // 水平触发阻塞
-// #define listenfdET    // 边缘触发非阻塞
-
-extern void addfd(int epollfd, int fd, bool one_shot);  // 添加文件描述符到epoll中，extern声明函数在外部定义
-extern void removefd(int epollfd, int fd);              // 从epoll中删除文件描述符
-// extern void modfd(int epollfd, int fd, int ev);         // 修改epoll中的文件描述符
 
 // 添加信号捕捉
 void addsig(int sig, void(handler)(int)) {
@@ -37,141 +35,239 @@ void addsig(int sig, void(handler)(int)) {
     sigaction(sig, &sa, NULL);  // 设置信号处理函数
 }
 
-/*main函数是主线程*/
-int main(int argc, char* argv[]) {  // 通过命令行指定端口号，argc：参数个数
-    // 首先判断执行程序传入的参数是否正确
-    // 如果不传参数的话，默认只有我们执行函数的命令这一个参数
-    if(argc <= 1) {
-        printf("请按照如下格式执行程序: %s port_number\n", basename(argv[0]));
-        exit(-1);  // 退出程序
+static threadpool<http_conn>* pool = NULL;  // 单reactor模式下的线程池
+static conn_table* users = NULL;            // 所有reactor共用的连接表
+
+// 打印运行统计，收到SIGUSR1时调用，例如 kill -USR1 <pid>
+void print_stats() {
+    printf("users=%d\n", http_conn::m_user_count.load());
+    if(users) {
+        users->print_stats();
+    }
+    http_conn::print_stats();
+    printf("timeouts: idle=%ld header=%ld send=%ld\n", http_conn::m_timeouts[http_conn::TIMER_IDLE].load(),
+           http_conn::m_timeouts[http_conn::TIMER_HEADER].load(), http_conn::m_timeouts[http_conn::TIMER_SEND].load());
+    if(http_conn::m_file_cache) {
+        http_conn::m_file_cache->print_stats();
+    }
+    if(http_conn::m_response_cache) {
+        http_conn::m_response_cache->print_stats();
+    }
+    if(http_conn::m_send_mode == config::SEND_ZEROCOPY) {
+        printf("zerocopy: sends=%ld completed=%ld copied=%ld\n", http_conn::m_zerocopy_sends.load(),
+               http_conn::m_zerocopy_done.load(), http_conn::m_zerocopy_copied.load());
+    }
+    if(pool) {
+        pool->print_stats();
     }
+    logger::print_stats();
+    access_log::print_stats();
+    fflush(stdout);
+}
 
-    int port = atoi(argv[1]);  // 获取端口号: 字符串转为整数
-    addsig(SIGPIPE, SIG_IGN);  //对SIGPIPE信号进行处理: 忽略SIGPIPE信号
+static reactor** reactors = NULL;  // 所有的reactor，收到SIGTERM/SIGINT时全部停止
+static int reactor_count = 0;
 
-    threadpool<http_conn>* pool = NULL;  // 创建线程池，初始化线程池指针
-    // try catch(...)能够捕获任何异常
-    try{
-        pool = new threadpool<http_conn>;
-    } catch(...) {
-        exit(-1);
+// 由接收信号的reactor在它的事件循环中调用，不受信号处理函数的限制
+void on_signal(int sig) {
+    switch(sig) {
+        case SIGTERM:
+        case SIGINT:
+            LOG_INFO("received signal %d, stopping", sig);
+            for(int i = 0; i < reactor_count; i++) {
+                reactors[i]->stop();
+            }
+            break;
+        case SIGHUP:           // 日志被外部工具轮转之后重新打开
+            logger::reopen();
+            access_log::reopen();
+            break;
+        case SIGUSR1:
+            print_stats();
+            break;
     }
+}
 
-    /*创建一个数组用于保存所有客户端的信息*/
-    http_conn* users = new http_conn[MAX_FD];   // 创建MAX_FD个http_conn类对象，存于users数组中
+// 解析CPU列表，为空时返回0(不绑定)，非法时退出
+static int parse_cpu_option(const char* name, const char* list, int* cpus) {
+    if(!list[0]) {
+        return 0;
+    }
+    int count = topology::parse_cpus(list, cpus, topology::MAX_CPUS);
+    if(count <= 0) {
+        printf("invalid %s: %s (online cpus: %d)\n", name, list, topology::cpu_count());
+        exit(-1);
+    }
+    return count;
+}
 
-    /*
-        socket编程
-    */
-    // 1.创建监听的socket文件描述符
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+// 启动时打印拓扑和每个线程绑定的CPU
+static void print_placement(const config& cfg, const int* reactor_cpus, int reactor_cpu_count,
+                            const int* worker_cpus, int worker_cpu_count, const int* nodes, int node_count) {
+    topology::print();
+    int reactor_threads = cfg.reactor_threads > 0 ? cfg.reactor_threads : 1;
+    for(int i = 0; i < reactor_threads; i++) {
+        if(reactor_cpu_count > 0) {
+            int cpu = reactor_cpus[i % reactor_cpu_count];
+            printf("  reactor %d -> cpu %d (node %d)\n", i, cpu, topology::node_of(cpu));
+        } else {
+            printf("  reactor %d -> any cpu\n", i);
+        }
+    }
+    if(cfg.reactor_threads == 0) {
+        for(int i = 0; i < cfg.threads; i++) {
+            if(worker_cpu_count > 0) {
+                int cpu = worker_cpus[i % worker_cpu_count];
+                printf("  worker %d -> cpu %d (node %d)\n", i, cpu, topology::node_of(cpu));
+            } else {
+                printf("  worker %d -> any cpu\n", i);
+            }
+        }
+    }
+    // 连接表只预留地址空间，按段在第一次用到时才构造，实际占用见SIGUSR1统计中的constructed
+    printf("  connection table: %lu KB address space reserved, ", (unsigned long)(sizeof(http_conn) * cfg.max_fd >> 10));
+    if(node_count == 0) {
+        printf("first touch\n");
+    } else {
+        printf("%s node", node_count == 1 ? "preferred" : "interleaved over");
+        for(int i = 0; i < node_count; i++) {
+            printf(" %d", nodes[i]);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
 
-    // struct sockaddr_in: IPv4专用的socket地址结构体
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    // htons: 端口->主机字节序转为网络字节序
-    // htonl: IP->主机字节序转为网络字节序
-    address.sin_port = htons(port);
+/*main函数是主线程*/
+int main(int argc, char* argv[]) {
+    // 在创建任何线程之前屏蔽这些信号，之后创建的线程都继承这个信号掩码，由reactor 0通过signalfd接收
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-    // 2.设置socket属性之端口复用，需要在绑定IP和PORT之前
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    
-    // 3.绑定IP和PORT地址
-    bind(listenfd, (struct sockaddr*) &address, sizeof(address));
+    // 解析配置文件和命令行参数，所有参数都有默认值
+    config cfg;
+    if(!cfg.parse_args(argc, argv)) {
+        config::usage(basename(argv[0]));
+        exit(-1);  // 退出程序
+    }
+    cfg.print();
+    // 之后的日志由后台线程批量写出
+    if(!logger::init(cfg.log_file, cfg.log_level, cfg.log_file_size, cfg.log_files, cfg.log_buffer_size)) {
+        exit(-1);
+    }
+    if(cfg.access_log_file[0] && !access_log::init(cfg.access_log_file, cfg.access_log_format, cfg.access_log_buffer_size)) {
+        exit(-1);
+    }
+    http_conn::setup(cfg);
+    addsig(SIGPIPE, SIG_IGN);  //对SIGPIPE信号进行处理: 忽略SIGPIPE信号
 
-    // 4.监听，创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前
-    listen(listenfd, 5);
+    // CPU绑定和NUMA放置
+    topology::init();
+    static int reactor_cpus[topology::MAX_CPUS];
+    static int worker_cpus[topology::MAX_CPUS];
+    int reactor_cpu_count = parse_cpu_option("reactor_cpus", cfg.reactor_cpus, reactor_cpus);
+    int worker_cpu_count = parse_cpu_option("worker_cpus", cfg.worker_cpus, worker_cpus);
+    int nodes[topology::MAX_NODES];
+    int node_count = 0;
+    if(cfg.numa_local && reactor_cpu_count > 0) {  // 没有绑定reactor时不知道它们在哪个节点上
+        int reactor_threads = cfg.reactor_threads > 0 ? cfg.reactor_threads : 1;
+        for(int i = 0; i < reactor_threads; i++) {
+            int node = topology::node_of(reactor_cpus[i % reactor_cpu_count]);
+            bool seen = false;
+            for(int j = 0; j < node_count; j++) {
+                seen = seen || nodes[j] == node;
+            }
+            if(!seen) {
+                nodes[node_count++] = node;
+            }
+        }
+    }
+    print_placement(cfg, reactor_cpus, reactor_cpu_count, worker_cpus, worker_cpu_count, nodes, node_count);
 
     /*
-        epoll的代码
-        创建epoll对象，事件数组，添加监听fd
+        创建连接表保存所有客户端的信息，fd在进程内唯一，所有reactor共用
+        numa_local时放在reactor绑定的CPU所在的节点上，多个节点时按页交错(fd由内核分配，哪个reactor接受的连接用哪个元素事先不知道)；
+        否则由首次访问决定。连接对象在第一次用到时才构造
     */
-    int epollfd = epoll_create(5);          // (调用epoll_create方法创建一个epoll的句柄，该句柄代表着一个事件表)创建epoll对象,创建一个额外的文件描述符来唯一标识内核中的epoll事件表
-    epoll_event events[MAX_EVENT_NUMBER];   // 创建内核事件表（用于存储epoll事件表中就绪事件的event数组）
-    addfd(epollfd, listenfd, false);        // 将listenfd放在epoll树上，（主线程往epoll内核事件表中注册监听socket事件，当listen到新的客户连接时，listenfd变为就绪事件）
-    http_conn::m_epollfd = epollfd;         // 将上述epollfd赋值给http_conn类对象的m_epollfd属性（static，所有对象使用同一份）
+    users = new conn_table;
+    if(!users->init(cfg.max_fd, nodes, node_count)) {
+        LOG_ERROR("cannot allocate %d connections", cfg.max_fd);
+        exit(-1);
+    }
 
-    while(true) {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);  // 主线程调用epoll_wait等待监听一组fd上的事件产生，并将当前所有就绪的epoll_event复制到events数组中
-        if((num < 0) && (errno != EINTR)) {  // num代表检测到了几个事件,num<0表示epollwait失败了
-            printf("epoll failure\n");
-            break;
+    if(cfg.reactor_threads == 0) {
+        // try catch(...)能够捕获任何异常
+        try{
+            pool = new threadpool<http_conn>(cfg.threads, cfg.max_requests, cfg.pool_mode == config::POOL_STEAL,
+                                             worker_cpus, worker_cpu_count);
+            if(cfg.codel_target > 0) {
+                pool->set_codel(new codel(cfg.codel_target, cfg.codel_interval));
+            }
+        } catch(...) {
+            exit(-1);
         }
-        
-        // 然后我们可以遍历事件数组以处理已经就绪的事件
-        for(int i = 0; i < num; i++) {
-            int sockfd = events[i].data.fd;  // 事件表中就绪的socket文件描述符
-            if(sockfd == listenfd) {  // 有客户端连接进来了
-                // 5.解除阻塞，接受(accept)客户端的连接，返回一个和客户端通信的connfd
-                struct sockaddr_in client_address;
-                socklen_t client_addrlen = sizeof(client_address);
-
-#ifdef listenfdLT
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
-                if(connfd < 0) {
-                    continue;
-                }
-                if(http_conn::m_user_count >= MAX_FD) {  // 判断当前连接数是否已满
-                    // TODO: 给客户端写一个服务器内部正忙的信息
-                    close(connfd);
-                    continue;
-                }
-                users[connfd].init_conn(connfd, client_address);   // 将新客户的连接数据初始化，放到user数组中
-#endif
-
-#ifdef listenfdET
-                while(1) {   //需要循环接收数据
-                    int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
-                    if(connfd < 0) {
-                        break;
-                    }
-                    if(http_conn::m_user_count >= MAX_FD) {
-                        // 目前连接数满了
-                        // TODO: 给客户端写一个服务器内部正忙的信息
-                        close(connfd);
-                        break;
-                    }
-                    users[connfd].init_conn(connfd, client_address);   // 将新客户的连接数据初始化，放到user数组中
-                }
-                continue;
-#endif
-
-            } 
-            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {  // 对方异常断开或错误的事件发生了
-
-                users[sockfd].close_conn();          // 关闭连接
-
-            } 
-            else if(events[i].events & EPOLLIN) {    // 当这一sockfd上有可读事件时，epoll_wait通知主线程
-
-                if(users[sockfd].read_once()) {      // 有读事件发生,一次性把所有数据都读到对应http_conn对象的缓冲区（主线程从这一sockfd循环读取数据, 直到没有更多数据可读）
-                    // 指针的加法是每次加一的时候实际上跳过指针类型大小的空间
-                    pool->append(users + sockfd);    // 添加到线程池中（将读取到的数据封装成一个请求对象并插入请求队列）
 
-                } 
-                else {
-
-                    users[sockfd].close_conn();      // 读数据失败的话把连接关闭
-
-                }
-            } 
-            else if(events[i].events & EPOLLOUT) {
-
-                if(!users[sockfd].write()) {         // 有写事件发生,一次性写完所有数据（当这一sockfd上有可写事件时，epoll_wait通知主线程。主线程往socket上写入服务器处理客户请求的结果）
-
-                    users[sockfd].close_conn();      // 写失败的话关闭连接
-
-                }
+        // 主线程运行唯一的reactor，负责accept和读写，process()交给线程池
+        if(reactor_cpu_count > 0 && !topology::pin_self(reactor_cpus[0])) {
+            LOG_WARN("cannot bind the reactor to cpu %d", reactor_cpus[0]);
+        }
+        reactor* r = new reactor(users, pool);
+        if(!r->init(cfg, false)) {
+            exit(-1);
+        }
+        reactors = &r;
+        reactor_count = 1;
+        if(!r->handle_signals(signals, on_signal)) {
+            exit(-1);
+        }
+        r->loop();
+        // 工作线程可能还在处理请求，不释放线程池、reactor和连接数组，进程退出时回收
+        LOG_INFO("server stopped");
+        return 0;
+    } else {
+        // 每个reactor线程拥有自己的epoll对象(或io_uring实例)和SO_REUSEPORT监听socket
+        reactors = new reactor*[cfg.reactor_threads];
+        for(int i = 0; i < cfg.reactor_threads; i++) {
+            if(cfg.use_uring) {
+                reactors[i] = new uring_reactor(users);
+            } else {
+                reactors[i] = new reactor(users, NULL);
+            }
+            if(!reactors[i]->init(cfg, true)) {
+                exit(-1);
+            }
+            if(reactor_cpu_count > 0) {
+                reactors[i]->set_cpu(reactor_cpus[i % reactor_cpu_count]);
+            }
+            reactor_count++;
+        }
+        if(!reactors[0]->handle_signals(signals, on_signal)) {
+            exit(-1);
+        }
+        for(int i = 0; i < cfg.reactor_threads; i++) {
+            LOG_INFO("Create the %d reactor", i);
+            if(!reactors[i]->start()) {
+                exit(-1);
             }
         }
+        for(int i = 0; i < cfg.reactor_threads; i++) {
+            reactors[i]->join();
+        }
+        for(int i = 0; i < cfg.reactor_threads; i++) {
+            delete reactors[i];
+        }
+        delete[] reactors;
+        reactors = NULL;
+        reactor_count = 0;
     }
 
-    close(epollfd);
-    close(listenfd);
-    delete[] users;
-    delete pool;
-
+    delete users;
+    users = NULL;
+    LOG_INFO("server stopped");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,119 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+
+/*
+    有界的多生产者多消费者无锁队列(Dmitry Vyukov的算法)
+    1. 环形数组，每个格子带一个序号: 序号等于pos时可以写入，等于pos + 1时可以读出，
+       读出后序号加上容量，留给下一圈的写入者；生产者和消费者各自用CAS抢占位置，不需要加锁
+    2. 入队和出队都没有内存分配，队列满或空时立即返回false，不会等待
+    3. 生产者位置、消费者位置和每个格子各占一个cache line，避免伪共享
+    T必须可以默认构造和赋值(线程池中是指针)
+*/
+template<typename T>
+class mpmc_queue {
+public:
+    explicit mpmc_queue(size_t capacity);  // 向上取2的幂
+    ~mpmc_queue();
+
+    bool enqueue(const T& value);          // 队列满时返回false
+    bool dequeue(T& value);                // 队列空时返回false
+    size_t capacity() const { return m_mask + 1; }
+    size_t size() const;                   // 近似值，只用于统计
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    struct cell {
+        std::atomic<size_t> sequence;
+        T data;
+    } __attribute__((aligned(CACHE_LINE)));
+
+    mpmc_queue(const mpmc_queue&);
+    mpmc_queue& operator=(const mpmc_queue&);
+
+private:
+    cell* m_cells;
+    size_t m_mask;
+    std::atomic<size_t> m_enqueue_pos __attribute__((aligned(CACHE_LINE)));
+    std::atomic<size_t> m_dequeue_pos __attribute__((aligned(CACHE_LINE)));
+};
+
+template<typename T>
+mpmc_queue<T>::mpmc_queue(size_t capacity): m_cells(NULL), m_mask(0), m_enqueue_pos(0), m_dequeue_pos(0) {
+    size_t size = 2;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_cells = new cell[size];  // C++17的new按cell的对齐分配
+    if(!m_cells) {
+        throw std::exception();
+    }
+    m_mask = size - 1;
+    for(size_t i = 0; i < size; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue() {
+    delete[] m_cells;
+}
+
+template<typename T>
+bool mpmc_queue<T>::enqueue(const T& value) {
+    cell* c;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+        if(diff == 0) {          // 格子空着，抢占这个位置
+            if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {    // 上一圈的数据还没有被读走: 满了
+            return false;
+        } else {                 // 被其它生产者抢先了，重新读位置
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    c->data = value;
+    c->sequence.store(pos + 1, std::memory_order_release);  // 发布给消费者
+    return true;
+}
+
+template<typename T>
+bool mpmc_queue<T>::dequeue(T& value) {
+    cell* c;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        long diff = (long)seq - (long)(pos + 1);
+        if(diff == 0) {          // 有数据，抢占这个位置
+            if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {    // 生产者还没有写入: 空
+            return false;
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    value = c->data;
+    c->sequence.store(pos + m_mask + 1, std::memory_order_release);  // 留给下一圈的生产者
+    return true;
+}
+
+template<typename T>
+size_t mpmc_queue<T>::size() const {
+    size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+    size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif
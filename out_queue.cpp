@@ -0,0 +1,263 @@
+#include "out_queue.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+int out_queue::m_window_size = 1 << 20;
+
+// 一次writev的iovec个数不能超过IOV_MAX
+static_assert(out_queue::MAX_SEGMENTS <= IOV_MAX, "MAX_SEGMENTS exceeds IOV_MAX");
+
+static bool is_data(const out_queue::segment& s) {
+    return s.type == out_queue::MEMORY || s.type == out_queue::FILE;
+}
+
+static int mode_of(const out_queue::segment& s) {
+    if(s.flags & out_queue::SENDFILE) {
+        return out_queue::MODE_SENDFILE;
+    }
+    return s.flags & out_queue::ZEROCOPY ? out_queue::MODE_ZEROCOPY : out_queue::MODE_COPY;
+}
+
+out_queue::segment* out_queue::push(int type) {
+    if(m_count == MAX_SEGMENTS) {
+        return NULL;
+    }
+    segment* s = &at(m_count++);
+    s->type = type;
+    s->flags = 0;
+    s->fd = -1;
+    s->data = NULL;
+    s->len = 0;
+    s->release = NULL;
+    s->object = NULL;
+    return s;
+}
+
+bool out_queue::push_memory(const char* data, size_t len, int flags) {
+    if(len == 0) {
+        return true;
+    }
+    segment* s = push(MEMORY);
+    if(!s) {
+        return false;
+    }
+    s->flags = flags & ZEROCOPY;
+    s->data = data;
+    s->len = len;
+    m_bytes += len;
+    return true;
+}
+
+bool out_queue::push_file(int fd, off_t offset, size_t len, int flags) {
+    if(len == 0) {
+        return true;
+    }
+    segment* s = push(FILE);
+    if(!s) {
+        return false;
+    }
+    s->flags = flags & (SENDFILE | ZEROCOPY);
+    s->fd = fd;
+    s->offset = offset;
+    s->len = len;
+    m_bytes += len;
+    return true;
+}
+
+bool out_queue::push_unmap(void* addr, size_t len) {
+    segment* s = push(UNMAP);
+    if(!s) {
+        return false;
+    }
+    s->data = (const char*)addr;
+    s->len = len;
+    return true;
+}
+
+bool out_queue::push_close(int fd) {
+    segment* s = push(CLOSE);
+    if(!s) {
+        return false;
+    }
+    s->fd = fd;
+    return true;
+}
+
+bool out_queue::push_release(release_fn release, void* owner, void* object) {
+    segment* s = push(RELEASE);
+    if(!s) {
+        return false;
+    }
+    s->release = release;
+    s->owner = owner;
+    s->object = object;
+    return true;
+}
+
+long long out_queue::head_left() const {
+    long long left = 0;
+    for(int i = 0; i < m_count; i++) {
+        const segment& s = at(i);
+        if(is_data(s)) {
+            left += s.len;
+        }
+        if(s.flags & END) {
+            break;
+        }
+    }
+    return left;
+}
+
+const out_queue::segment& out_queue::front() const {
+    int i = 0;
+    while(i + 1 < m_count && !is_data(at(i))) {
+        i++;
+    }
+    return at(i);
+}
+
+/*
+    窗口的起点按窗口大小对齐，同一个文件中相邻的范围(多个Range、分段发送的大文件)可以共用一个窗口；
+    映射不超过这个段的末尾，不会访问到文件末尾之后的页
+*/
+bool out_queue::map_window(int fd, off_t offset, off_t end) {
+    unmap_window();
+    off_t start = offset / m_window_size * m_window_size;
+    off_t len = end - start < m_window_size ? end - start : m_window_size;
+    void* addr = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, start);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    madvise(addr, len, MADV_WILLNEED);     // 让内核提前读入这个窗口
+    m_window = (char*)addr;
+    m_window_fd = fd;
+    m_window_start = start;
+    m_window_len = len;
+    return true;
+}
+
+void out_queue::unmap_window() {
+    if(m_window) {
+        munmap(m_window, m_window_len);
+        m_window = NULL;
+        m_window_fd = -1;
+    }
+}
+
+int out_queue::gather(int* mode, bool* more) {
+    int count = 0;
+    bool mapped = false;        // 这一批已经用了当前窗口，不能再换窗口
+    bool partial = false;       // 最后一段只收集了一部分
+    int i = 0;
+    *mode = -1;
+    for(; i < m_count; i++) {
+        segment& s = at(i);
+        if(!is_data(s)) {       // 释放标记不影响发送，跳过
+            continue;
+        }
+        int m = mode_of(s);
+        if(*mode < 0) {
+            *mode = m;
+        } else if(m != *mode || m == MODE_SENDFILE) {
+            break;
+        }
+        if(m == MODE_SENDFILE) {
+            continue;           // sendfile一次只发送一个段，由front()给出
+        }
+        if(s.type == MEMORY) {
+            m_iov[count].iov_base = (void*)s.data;
+            m_iov[count].iov_len = s.len;
+            count++;
+            continue;
+        }
+        // 文件段: 映射包含未发送位置的窗口，段的剩余部分在下一个窗口中时这一批到此为止
+        bool inside = m_window && s.fd == m_window_fd && s.offset >= m_window_start
+                      && s.offset < m_window_start + (off_t)m_window_len;
+        if(!inside) {
+            if(mapped) {
+                break;
+            }
+            if(!map_window(s.fd, s.offset, s.offset + s.len)) {
+                return -1;
+            }
+        }
+        mapped = true;
+        size_t avail = m_window_start + m_window_len - s.offset;
+        size_t len = s.len < avail ? s.len : avail;
+        m_iov[count].iov_base = m_window + (s.offset - m_window_start);
+        m_iov[count].iov_len = len;
+        count++;
+        if(len < s.len) {
+            partial = true;
+            i++;
+            break;
+        }
+    }
+    *more = partial;
+    for(; !*more && i < m_count; i++) {
+        *more = is_data(at(i));
+    }
+    if(*mode < 0) {
+        *mode = MODE_COPY;
+    }
+    return count;
+}
+
+int out_queue::consume(long long bytes) {
+    m_bytes -= bytes;
+    int done = 0;
+    while(m_count > 0) {
+        segment& s = at(0);
+        if(is_data(s)) {
+            size_t n = bytes < (long long)s.len ? bytes : s.len;
+            if(s.type == MEMORY) {
+                s.data += n;
+            } else {
+                s.offset += n;
+            }
+            s.len -= n;
+            bytes -= n;
+            if(s.len > 0) {
+                break;
+            }
+        } else {
+            finish(s);
+        }
+        if(s.flags & END) {
+            done++;
+        }
+        m_head = (m_head + 1) % MAX_SEGMENTS;
+        m_count--;
+    }
+    if(m_count == 0) {
+        unmap_window();
+    }
+    return done;
+}
+
+// 释放之后fd号可能被别的文件重新使用，窗口不能再按fd匹配，一起释放
+void out_queue::finish(segment& s) {
+    unmap_window();
+    if(s.type == UNMAP) {
+        munmap((void*)s.data, s.len);
+    } else if(s.type == CLOSE) {
+        close(s.fd);
+    } else if(s.type == RELEASE) {
+        s.release(s.owner, s.object);
+    }
+}
+
+void out_queue::clear() {
+    while(m_count > 0) {
+        segment& s = at(0);
+        if(!is_data(s)) {
+            finish(s);
+        }
+        m_head = (m_head + 1) % MAX_SEGMENTS;
+        m_count--;
+    }
+    m_head = 0;
+    m_bytes = 0;
+    unmap_window();
+}
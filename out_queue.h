@@ -0,0 +1,93 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <stddef.h>
+
+/*
+    连接的输出队列: 还没有发送完的应答按顺序排成一串段
+    1. MEMORY: 一段内存，例如写缓冲区中的头部、文件的整体映射、缓存的应答，内存不属于队列
+    2. FILE: 文件的一个范围[offset, offset + len)，带SENDFILE标志时用sendfile发送，
+       否则由队列按窗口映射(每次最多一个窗口)，和前后的内存段一起writev
+    3. UNMAP / CLOSE / RELEASE: 长度为0的标记，前面的段都发送完、标记到达队首时释放映射、关闭fd或
+       释放引用(文件缓存的条目、缓存的应答)，应答用到的资源就这样跟着应答的数据走，谁也不用单独记着
+    每个应答的最后一段带END标志，它被移出队列时这个应答就发送完了
+    发送时gather()从队首收集一批发送方式相同的段，consume()按实际发送的字节数推进，短写时停在段的中间
+*/
+class out_queue {
+public:
+    static const int MAX_SEGMENTS = 64;           // 队列的容量，也是一次writev的iovec个数上限
+    enum TYPE {MEMORY = 0, FILE, UNMAP, CLOSE, RELEASE};
+    enum FLAG {END = 1, SENDFILE = 2, ZEROCOPY = 4};
+    enum MODE {MODE_COPY = 0, MODE_SENDFILE, MODE_ZEROCOPY};   // 一批段的发送方式
+    typedef void (*release_fn)(void* owner, void* object);
+
+    struct segment {
+        unsigned char type;       // TYPE
+        unsigned char flags;      // FLAG
+        int fd;                   // FILE: 文件；CLOSE: 要关闭的fd
+        union {
+            const char* data;     // MEMORY: 未发送部分的起点；UNMAP: 映射的起点
+            off_t offset;         // FILE: 未发送部分在文件中的位置
+            void* owner;          // RELEASE: release(owner, object)
+        };
+        size_t len;               // MEMORY/FILE: 未发送的字节数；UNMAP: 映射的长度
+        release_fn release;
+        void* object;
+    };
+
+    out_queue(): m_head(0), m_count(0), m_bytes(0), m_window(NULL), m_window_fd(-1), m_window_start(0), m_window_len(0) {}
+    ~out_queue() { clear(); }
+
+    static void setup(int window) { m_window_size = window; }  // 文件段映射窗口的大小，页大小的整数倍
+
+    // 空间不够时返回false；长度为0的数据段不入队
+    bool push_memory(const char* data, size_t len, int flags = 0);
+    bool push_file(int fd, off_t offset, size_t len, int flags = 0);
+    bool push_unmap(void* addr, size_t len);
+    bool push_close(int fd);
+    bool push_release(release_fn release, void* owner, void* object);
+    void end_response() { if(m_count > 0) at(m_count - 1).flags |= END; }  // 最后入队的段是这个应答的最后一段
+
+    bool empty() const { return m_count == 0; }
+    int space() const { return MAX_SEGMENTS - m_count; }
+    long long bytes() const { return m_bytes; }       // 还没有发送的字节数
+    long long head_left() const;                      // 队首的应答还没有发送的字节数
+
+    /*
+        从队首收集一批可以用一次系统调用发送的段，mode为它们的发送方式:
+        MODE_COPY/MODE_ZEROCOPY返回iov()中的iovec个数；MODE_SENDFILE时只有一个文件段，由front()给出，返回0
+        more表示这一批之后还有数据；窗口映射失败时返回-1
+    */
+    int gather(int* mode, bool* more);
+    struct iovec* iov() { return m_iov; }
+    const segment& front() const;                     // 队首的数据段，gather()之后调用
+    int consume(long long bytes);                     // 记录发送了bytes字节，返回这次发送完的应答个数
+    void clear();                                     // 执行所有释放标记并清空队列，连接关闭时没发送完的应答也一样
+
+private:
+    out_queue(const out_queue&);
+    out_queue& operator=(const out_queue&);
+    segment& at(int i) { return m_segments[(m_head + i) % MAX_SEGMENTS]; }
+    const segment& at(int i) const { return m_segments[(m_head + i) % MAX_SEGMENTS]; }
+    segment* push(int type);
+    void finish(segment& s);                          // 标记到达队首时执行
+    bool map_window(int fd, off_t offset, off_t end); // 映射fd中包含offset的窗口，不超过end
+    void unmap_window();
+
+private:
+    segment m_segments[MAX_SEGMENTS];                 // 环形数组
+    int m_head;
+    int m_count;
+    long long m_bytes;
+    struct iovec m_iov[MAX_SEGMENTS];                 // gather()的结果，io_uring提交之后到完成之前要保持有效
+    char* m_window;                                   // 没有整体映射的文件段当前的窗口
+    int m_window_fd;
+    off_t m_window_start;
+    size_t m_window_len;
+    static int m_window_size;
+};
+
+#endif
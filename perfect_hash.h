@@ -0,0 +1,91 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <strings.h>
+
+/*
+    编译期生成的不区分大小写的完美哈希表，用于请求头部名、扩展名这类固定的小集合
+    1. 对小写化的key做带种子的FNV-1a，取高位得到槽位；编译期从1开始尝试种子，直到所有key落在不同的槽中
+       | 0x20对字母是转小写，对数字和-不变；其它字符的冲突由最后的比较排除
+    2. 下标0保留为"没有找到"，key从下标1开始；槽位中存key的下标，另存每个key的长度，
+       查找时一次哈希，先比较长度再比较内容，不会读到比查找的key短的名字之外
+    使用者定义一个constexpr的表，并用static_assert检查seed()不为0:
+        static constexpr perfect_hash<COUNT, 6> table(key_of);
+*/
+template<int N, int BITS>
+class perfect_hash {
+public:
+    static const int SLOTS = 1 << BITS;
+    static_assert(N <= 256, "slot index is stored in an unsigned char");
+    typedef const char* (*key_fn)(int i);     // 第i个key，i从1到N-1
+
+    constexpr explicit perfect_hash(key_fn key): m_key(key), m_seed(0), m_max_len(0), m_index(), m_len() {
+        for(int i = 1; i < N; i++) {
+            m_len[i] = length(key(i));
+            m_max_len = m_len[i] > m_max_len ? m_len[i] : m_max_len;
+        }
+        for(unsigned seed = 1; seed < 100000; seed++) {
+            if(is_perfect(seed)) {
+                m_seed = seed;
+                break;
+            }
+        }
+        if(m_seed != 0) {
+            for(int i = 1; i < N; i++) {
+                m_index[hash(key(i), m_len[i], m_seed)] = i;
+            }
+        }
+    }
+
+    constexpr unsigned seed() const { return m_seed; }   // 0表示没有找到完美哈希的种子，需要加大BITS
+
+    // s[0, len)对应的key的下标(不区分大小写)，不是已知的key时返回0；s不需要以\0结尾
+    int find(const char* s, int len) const {
+        if(len <= 0 || len > m_max_len) {
+            return 0;
+        }
+        int i = m_index[hash(s, len, m_seed)];
+        if(i != 0 && m_len[i] == len && strncasecmp(s, m_key(i), len) == 0) {
+            return i;
+        }
+        return 0;
+    }
+
+private:
+    static constexpr int length(const char* s) {
+        int n = 0;
+        while(s[n]) {
+            n++;
+        }
+        return n;
+    }
+
+    static constexpr unsigned hash(const char* s, int len, unsigned seed) {
+        unsigned h = 2166136261u ^ seed;
+        for(int i = 0; i < len; i++) {
+            h = (h ^ (unsigned char)(s[i] | 0x20)) * 16777619u;
+        }
+        return h >> (32 - BITS);
+    }
+
+    constexpr bool is_perfect(unsigned seed) const {
+        bool used[SLOTS] = {};
+        for(int i = 1; i < N; i++) {
+            unsigned slot = hash(m_key(i), m_len[i], seed);
+            if(used[slot]) {
+                return false;
+            }
+            used[slot] = true;
+        }
+        return true;
+    }
+
+private:
+    key_fn m_key;
+    unsigned m_seed;
+    int m_max_len;
+    unsigned char m_index[SLOTS];             // 槽位中key的下标，0为空槽
+    int m_len[N];                             // 每个key的长度
+};
+
+#endif
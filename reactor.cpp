@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include "reactor.h"
+#include "log.h"
+#include "topology.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);  // 添加文件描述符到epoll中，extern声明函数在外部定义
+
+reactor::reactor(conn_table* table, threadpool<http_conn>* pool):
+    m_listenfd(-1), m_table(table), m_users(table->users()), m_max_fd(0), m_wheel(NULL), m_timerfd(-1), m_wakefd(-1), m_signalfd(-1),
+    m_signal_handler(NULL), m_running(true), m_reserve_fd(-1), m_epollfd(-1), m_events(NULL),
+    m_max_events(0), m_listen_et(false), m_accept_batch(1), m_accept_pending(false), m_pool(pool), m_thread(0), m_cpu(-1) {
+}
+
+reactor::~reactor() {
+    if(m_epollfd != -1) {
+        close(m_epollfd);
+    }
+    if(m_listenfd != -1) {
+        close(m_listenfd);
+    }
+    if(m_timerfd != -1) {
+        close(m_timerfd);
+    }
+    if(m_wakefd != -1) {
+        close(m_wakefd);
+    }
+    if(m_signalfd != -1) {
+        close(m_signalfd);
+    }
+    if(m_reserve_fd != -1) {
+        close(m_reserve_fd);
+    }
+    delete m_wheel;
+    delete[] m_events;
+}
+
+bool reactor::create_listen(const config& cfg, bool reuse_port) {
+    m_max_fd = cfg.max_fd;
+    int port = cfg.port;
+
+    /*
+        socket编程
+    */
+    // 1.创建监听的socket文件描述符
+    m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_listenfd < 0) {
+        return false;
+    }
+
+    // struct sockaddr_in: IPv4专用的socket地址结构体
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    // 2.设置socket属性之端口复用，需要在绑定IP和PORT之前
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // 多reactor模式下每个reactor都绑定同一端口，由内核按四元组哈希把新连接分配给其中一个监听socket
+    if(reuse_port && setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        LOG_ERROR("setsockopt SO_REUSEPORT failure");
+        return false;
+    }
+
+    // 3.绑定IP和PORT地址
+    if(bind(m_listenfd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        LOG_ERROR("bind port %d failure: %s", port, strerror(errno));
+        return false;
+    }
+
+    // 缓冲区大小要在listen之前设置，窗口扩大选项在握手时就确定了
+    set_listen_options(cfg);
+
+    // 4.监听，创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前
+    if(listen(m_listenfd, cfg.backlog) < 0) {
+        return false;
+    }
+    FILE* fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    int somaxconn;
+    if(fp && fscanf(fp, "%d", &somaxconn) == 1 && somaxconn < cfg.backlog) {
+        LOG_WARN("backlog %d is capped to net.core.somaxconn %d", cfg.backlog, somaxconn);
+    }
+    if(fp) {
+        fclose(fp);
+    }
+    m_accept_batch = cfg.accept_batch;
+    reopen_reserve();
+    return true;
+}
+
+void reactor::set_listen_options(const config& cfg) {
+    int on = 1;
+    if(cfg.tcp_nodelay && setsockopt(m_listenfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+        LOG_WARN("setsockopt TCP_NODELAY failure: %s", strerror(errno));
+    }
+    if(cfg.defer_accept > 0 && setsockopt(m_listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &cfg.defer_accept, sizeof(cfg.defer_accept)) < 0) {
+        LOG_WARN("setsockopt TCP_DEFER_ACCEPT failure: %s", strerror(errno));
+    }
+    // 服务端还要求net.ipv4.tcp_fastopen的第2位(值2)打开
+    if(cfg.fastopen > 0 && setsockopt(m_listenfd, IPPROTO_TCP, TCP_FASTOPEN, &cfg.fastopen, sizeof(cfg.fastopen)) < 0) {
+        LOG_WARN("setsockopt TCP_FASTOPEN failure: %s", strerror(errno));
+    }
+    if(cfg.listen_sndbuf > 0 && setsockopt(m_listenfd, SOL_SOCKET, SO_SNDBUF, &cfg.listen_sndbuf, sizeof(cfg.listen_sndbuf)) < 0) {
+        LOG_WARN("setsockopt SO_SNDBUF failure: %s", strerror(errno));
+    }
+    if(cfg.listen_rcvbuf > 0 && setsockopt(m_listenfd, SOL_SOCKET, SO_RCVBUF, &cfg.listen_rcvbuf, sizeof(cfg.listen_rcvbuf)) < 0) {
+        LOG_WARN("setsockopt SO_RCVBUF failure: %s", strerror(errno));
+    }
+}
+
+void reactor::reopen_reserve() {
+    if(m_reserve_fd == -1) {
+        m_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+// 每1024次打印一次，fd用完时不要让日志也跟着刷屏
+void reactor::fd_exhausted() {
+    static std::atomic<long> count(0);
+    long n = ++count;
+    if((n & 1023) == 1) {
+        LOG_WARN("out of file descriptors, %ld connections rejected so far", n);
+    }
+}
+
+// 周期性的timerfd，和其它事件一样由事件循环等待，不需要SIGALRM
+bool reactor::create_timer(const config& cfg, bool nonblock) {
+    if(cfg.keepalive_timeout == 0 && cfg.header_timeout == 0 && cfg.send_timeout == 0) {
+        return true;
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (nonblock ? TFD_NONBLOCK : 0));
+    if(m_timerfd < 0) {
+        LOG_ERROR("timerfd_create failure: %s", strerror(errno));
+        return false;
+    }
+    struct itimerspec its;
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = TIMER_TICK_MS * 1000000L;
+    its.it_interval = its.it_value;
+    if(timerfd_settime(m_timerfd, 0, &its, NULL) < 0) {
+        LOG_ERROR("timerfd_settime failure: %s", strerror(errno));
+        return false;
+    }
+    m_wheel = new timer_wheel(TIMER_TICK_MS);
+    return true;
+}
+
+bool reactor::create_wakeup(bool nonblock) {
+    m_wakefd = eventfd(0, EFD_CLOEXEC | (nonblock ? EFD_NONBLOCK : 0));
+    if(m_wakefd < 0) {
+        LOG_ERROR("eventfd failure: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void reactor::timeout_callback(timer_node* node, void* arg) {
+    reactor* r = (reactor*) arg;
+    r->on_timeout((http_conn*) node->data - r->m_users);  // m_users以fd为下标
+}
+
+void reactor::expire_timers() {
+    m_wheel->advance(timer_wheel::now_ms(), timeout_callback, this);
+}
+
+void reactor::on_timeout(int sockfd) {
+    if(m_users[sockfd].expire()) {
+        m_users[sockfd].close_conn();
+    }
+}
+
+bool reactor::init(const config& cfg, bool reuse_port) {
+    if(!create_listen(cfg, reuse_port) || !create_timer(cfg, true) || !create_wakeup(true)) {
+        return false;
+    }
+    m_max_events = cfg.max_events;
+    m_listen_et = cfg.listen_et;
+
+    /*
+        epoll的代码
+        创建epoll对象，事件数组，添加监听fd
+    */
+    m_epollfd = epoll_create(5);
+    if(m_epollfd < 0) {
+        return false;
+    }
+    m_events = new epoll_event[m_max_events];
+    addfd(m_epollfd, m_listenfd, false, m_listen_et);  // 将listenfd放在本reactor的epoll树上
+    if(m_timerfd != -1) {
+        addfd(m_epollfd, m_timerfd, false, false);
+    }
+    addfd(m_epollfd, m_wakefd, false, false);
+    if(m_pool) {
+        m_pool->set_completion(completion_callback, this);  // 处理完的连接交还给本线程发送应答
+    }
+    return true;
+}
+
+bool reactor::handle_signals(const sigset_t& set, void (*handler)(int)) {
+    m_signalfd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    if(m_signalfd < 0) {
+        LOG_ERROR("signalfd failure: %s", strerror(errno));
+        return false;
+    }
+    m_signal_handler = handler;
+    addfd(m_epollfd, m_signalfd, false, false);
+    return true;
+}
+
+/*
+    接受新连接，新连接注册到本reactor的epoll对象上
+    accept4直接得到非阻塞、close-on-exec的fd，不需要再fcntl；每次最多accept m_accept_batch个，
+    连接风暴时不会一直占着reactor而让已有连接的事件等待。水平触发下没有accept完的连接会再次通知，
+    边缘触发不会，所以记下m_accept_pending，由loop()在下一轮继续
+    fd用完(EMFILE/ENFILE)时连接会一直留在监听队列中，水平触发下监听socket一直就绪，reactor空转；
+    这时关掉预留的fd腾出一个位置，accept之后回答503并关闭，再把预留的fd打开
+*/
+void reactor::accept_conn() {
+    m_accept_pending = false;
+    for(int i = 0; i < m_accept_batch; i++) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connfd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {  // 对方在accept之前就断开了
+                continue;
+            }
+            if((errno == EMFILE || errno == ENFILE) && m_reserve_fd != -1) {
+                close(m_reserve_fd);
+                m_reserve_fd = -1;
+                connfd = accept4(m_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(connfd < 0) {       // 分配fd在检查监听队列之前，队列空了也会报EMFILE
+                    reopen_reserve();
+                    return;
+                }
+                http_conn::reject(connfd);
+                reopen_reserve();
+                fd_exhausted();
+                continue;
+            }
+            return;                    // EAGAIN: 监听队列空了
+        }
+        if(connfd >= m_max_fd) {       // 连接表已满
+            http_conn::reject(connfd);
+            continue;
+        }
+        m_table->prepare(connfd);
+        m_users[connfd].init_conn(connfd, client_address, m_epollfd, m_wheel);   // 将新客户的连接数据初始化，放到user数组中
+    }
+    m_accept_pending = m_listen_et;
+}
+
+void reactor::loop() {
+    while(m_running) {
+        // 还有没accept完的连接时不阻塞，处理完这一批就绪事件后接着accept
+        int num = epoll_wait(m_epollfd, m_events, m_max_events, m_accept_pending ? 0 : -1);  // 等待监听一组fd上的事件产生，并将当前所有就绪的epoll_event复制到events数组中
+        if((num < 0) && (errno != EINTR)) {  // num代表检测到了几个事件,num<0表示epollwait失败了
+            LOG_ERROR("epoll failure: %s", strerror(errno));
+            break;
+        }
+
+        // 然后我们可以遍历事件数组以处理已经就绪的事件
+        bool timer_due = false;
+        bool accept_due = m_accept_pending;
+        for(int i = 0; i < num; i++) {
+            int sockfd = m_events[i].data.fd;  // 事件表中就绪的socket文件描述符
+            uint32_t events = m_events[i].events;
+            if(sockfd == m_listenfd) {  // 有客户端连接进来了，在这一批已有连接的事件之后accept
+                accept_due = true;
+            }
+            else if(sockfd == m_timerfd) {   // 超时的连接在这一批事件处理完后再关闭，避免后面的事件落到已关闭的fd上
+                uint64_t expirations;
+                if(read(m_timerfd, &expirations, sizeof(expirations)) > 0) {
+                    timer_due = true;
+                }
+            }
+            else if(sockfd == m_wakefd) {    // 线程池交还了连接，或者stop()
+                uint64_t count;
+                if(read(m_wakefd, &count, sizeof(count)) > 0) {
+                    drain_completions();
+                }
+            }
+            else if(sockfd == m_signalfd) {
+                read_signals();
+            }
+            else {
+                on_event(sockfd, events);
+            }
+        }
+        if(accept_due) {
+            accept_conn();
+        }
+        if(timer_due) {
+            expire_timers();
+        }
+    }
+}
+
+void reactor::on_event(int sockfd, uint32_t events) {
+    http_conn& conn = m_users[sockfd];
+    // ET模式下连接不用EPOLLONESHOT，在线程池中时也会收到事件，交还之后再处理
+    if(conn.processing()) {
+        conn.defer(events);
+        return;
+    }
+    // 错误队列上的MSG_ZEROCOPY完成通知也会触发EPOLLERR，回收之后连接仍然正常
+    if((events & EPOLLERR) && conn.reap_zerocopy()) {
+        events &= ~EPOLLERR;
+        if(!(events & (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP))) {
+            conn.rearm();
+            return;
+        }
+    }
+    if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {  // 对方异常断开或错误的事件发生了
+        conn.close_conn();                              // 关闭连接
+        return;
+    }
+    if(conn.sending()) {
+        // 正在发送应答: 可写时接着发送；ET模式下同时到达的读事件留到发送完之后处理
+        if(events & EPOLLIN) {
+            conn.defer(EPOLLIN);
+        }
+        if(!(events & EPOLLOUT)) {
+            return;
+        }
+        if(!conn.write()) {                             // 有写事件发生,一次性写完所有数据
+            conn.close_conn();                          // 写失败的话关闭连接
+            return;
+        }
+        conn.update_timer();
+        int next = conn.sending() ? NEXT_WAIT : after_response(sockfd);
+        if(next != NEXT_WAIT) {
+            serve(sockfd, next == NEXT_READ);
+        }
+    }
+    else if(events & EPOLLIN) {    // 当这一sockfd上有可读事件时，epoll_wait通知本线程
+        serve(sockfd, true);
+    }
+    else if(events & EPOLLOUT) {   // 没有要发送的数据: EPOLLONESHOT模式下重新注册EPOLLIN，ET模式下忽略
+        conn.rearm();
+    }
+}
+
+/*
+    读取并处理请求: 线程池模式下交给工作线程后返回，由drain_completions()接着处理；
+    多reactor模式下在本线程内处理并立即发送应答，还有流水线请求或socket中还有数据时继续循环
+*/
+void reactor::serve(int sockfd, bool read) {
+    http_conn& conn = m_users[sockfd];
+    while(true) {
+        if(read) {
+            if(!conn.read_once()) {         // 一次性把所有数据都读到对应http_conn对象的缓冲区
+                conn.close_conn();          // 读数据失败的话把连接关闭
+                return;
+            }
+            conn.update_timer();
+        }
+        if(m_pool) {
+            if(!m_pool->admit()) {          // 过载: 不排队，直接回答503
+                conn.shed();
+                return;
+            }
+            conn.mark_processing();         // 处理期间定时器到期时不关闭连接，到达的事件先记下
+            if(!m_pool->append(&conn)) {    // 单reactor模式: 添加到线程池中
+                LOG_WARN("request queue is full, rejecting connection %d", sockfd);
+                conn.shed();                // 处理中的标志在fd被重新使用时由init_conn清除
+            }
+            return;
+        }
+        conn.process();                     // 多reactor模式: 在本线程内直接处理，不经过任务队列
+        int next = finish(sockfd);
+        if(next == NEXT_WAIT) {
+            return;
+        }
+        read = next == NEXT_READ;
+    }
+}
+
+int reactor::finish(int sockfd) {
+    http_conn& conn = m_users[sockfd];
+    uint32_t deferred = conn.take_deferred();
+    if((deferred & EPOLLERR) && conn.reap_zerocopy()) {  // 处理期间到达的MSG_ZEROCOPY完成通知
+        deferred &= ~EPOLLERR;
+    }
+    if(!conn.respond() || (deferred & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        conn.close_conn();
+        return NEXT_WAIT;
+    }
+    conn.update_timer();
+    if(conn.sending()) {                    // 发送缓冲区满了，等EPOLLOUT
+        conn.defer(deferred & EPOLLIN);
+        return NEXT_WAIT;
+    }
+    if(conn.incomplete()) {                 // 没有应答，只有ET模式下读缓冲区满或处理期间又有数据时接着读
+        return (deferred & EPOLLIN) ? NEXT_READ : NEXT_WAIT;
+    }
+    conn.defer(deferred);
+    return after_response(sockfd);
+}
+
+// 读缓冲区中还有流水线请求时直接处理，不等新的EPOLLIN；ET模式下发送期间到达的数据接着读
+int reactor::after_response(int sockfd) {
+    http_conn& conn = m_users[sockfd];
+    if(conn.pipelined()) {
+        return NEXT_PROCESS;
+    }
+    return (conn.take_deferred() & EPOLLIN) ? NEXT_READ : NEXT_WAIT;
+}
+
+// 工作线程中调用: 放入完成队列，队列原来为空时才写eventfd，一批完成的连接只唤醒一次
+void reactor::completion_callback(http_conn* conn, void* arg) {
+    reactor* r = (reactor*) arg;
+    r->m_done_lock.lock();
+    bool empty = r->m_done.empty();
+    r->m_done.push_back(conn - r->m_users);
+    r->m_done_lock.unlock();
+    if(empty) {
+        r->wakeup();
+    }
+}
+
+void reactor::drain_completions() {
+    m_done_lock.lock();
+    m_done_local.swap(m_done);
+    m_done_lock.unlock();
+    for(size_t i = 0; i < m_done_local.size(); i++) {
+        int sockfd = m_done_local[i];
+        int next = finish(sockfd);
+        if(next != NEXT_WAIT) {
+            serve(sockfd, next == NEXT_READ);
+        }
+    }
+    m_done_local.clear();
+}
+
+void reactor::wakeup() {
+    uint64_t one = 1;
+    ssize_t ret = write(m_wakefd, &one, sizeof(one));
+    (void) ret;  // 计数器溢出之前reactor一定会读，写失败也已经有未读的唤醒
+}
+
+void reactor::stop() {
+    m_running = false;
+    wakeup();
+}
+
+void reactor::read_signals() {
+    struct signalfd_siginfo info;
+    while(read(m_signalfd, &info, sizeof(info)) == sizeof(info)) {
+        m_signal_handler(info.ssi_signo);
+    }
+}
+
+void* reactor::worker(void* arg) {
+    reactor* r = (reactor*) arg;
+    r->loop();
+    return r;
+}
+
+// 绑定CPU时线程从一开始就在这个CPU上运行，之后分配的内存(首次访问)都在本地节点
+bool reactor::start() {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(m_cpu >= 0 && !topology::set_affinity(&attr, m_cpu)) {
+        LOG_WARN("cannot bind reactor thread to cpu %d", m_cpu);
+    }
+    bool ok = pthread_create(&m_thread, &attr, worker, this) == 0;
+    pthread_attr_destroy(&attr);
+    return ok;
+}
+
+void reactor::join() {
+    pthread_join(m_thread, NULL);
+}
@@ -0,0 +1,95 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <vector>
+#include "threadpool.h"
+#include "http_conn.h"
+#include "conn_table.h"
+#include "config.h"
+#include "timer_wheel.h"
+
+/*
+    reactor: 一个epoll事件循环，拥有自己的epoll对象和监听socket
+    两种工作方式:
+    1. 单reactor + 线程池: 主线程负责accept和读写，process()交给threadpool的工作线程（原来的模式）
+    2. 多reactor(one loop per thread): 每个线程一个reactor，各自用SO_REUSEPORT监听同一端口，
+       由内核把新连接分散到各个监听socket上，连接从accept、读、处理到写都在同一个线程内完成
+    每个reactor有一个时间轮管理自己的连接的超时，由timerfd每TIMER_TICK_MS毫秒驱动一次，只在本线程内修改
+    其它线程通过eventfd唤醒reactor: 线程池把处理完的连接放进完成队列后唤醒它，stop()唤醒它退出循环
+    信号由其中一个reactor通过signalfd同步接收(handle_signals)，回调在reactor线程中执行，不受信号处理函数的限制
+*/
+class reactor {
+public:
+    // pool为NULL时在本线程内直接调用process()
+    reactor(conn_table* table, threadpool<http_conn>* pool);
+    virtual ~reactor();
+
+    virtual bool init(const config& cfg, bool reuse_port);  // 创建监听socket和epoll对象
+    virtual void loop();                           // 事件循环
+    bool start();                                  // 创建线程运行loop()
+    void set_cpu(int cpu) { m_cpu = cpu; }         // start()创建的线程绑定到cpu，-1为不绑定
+    void join();                                   // 等待线程结束
+    void stop();                                   // 可以在任何线程中调用，loop()处理完当前这批事件后返回
+    // 由本reactor接收set中的信号(调用者要先在所有线程中屏蔽它们)，收到时在本线程中调用handler(signo)
+    virtual bool handle_signals(const sigset_t& set, void (*handler)(int));
+
+protected:
+    static const int TIMER_TICK_MS = 100;          // 时间轮的精度
+
+    bool create_listen(const config& cfg, bool reuse_port); // 创建、绑定并监听socket，设置监听选项
+    void set_listen_options(const config& cfg);    // 监听选项组合中的socket选项，失败只打印警告
+    void reopen_reserve();                         // 重新打开预留的fd
+    static void fd_exhausted();                    // 因为fd用完拒绝了一个连接
+    bool create_timer(const config& cfg, bool nonblock);    // 所有超时都为0时不创建时间轮
+    void expire_timers();                          // timerfd到期后处理到期的定时器
+    virtual void on_timeout(int sockfd);           // 连接超时
+    bool create_wakeup(bool nonblock);             // 创建eventfd
+    void wakeup();                                 // 唤醒事件循环
+    void read_signals();                           // 读出signalfd上的信号并调用回调
+
+private:
+    static void* worker(void* arg);        // 线程的工作函数，arg为this
+    void accept_conn();                    // 接受新连接
+    void on_event(int sockfd, uint32_t events);  // 处理连接上的epoll事件
+    void serve(int sockfd, bool read);     // 读(read为true时)并处理请求，直到需要等待事件或交给了线程池
+    int finish(int sockfd);                // process()之后发送应答，返回接下来要做的(NEXT_ACTION)
+    int after_response(int sockfd);        // 应答发送完之后接下来要做的
+    void drain_completions();              // 处理线程池交还的连接
+    static void timeout_callback(timer_node* node, void* arg);
+    static void completion_callback(http_conn* conn, void* arg);  // 在工作线程中调用
+
+    enum NEXT_ACTION {NEXT_WAIT = 0, NEXT_PROCESS, NEXT_READ};
+
+protected:
+    int m_listenfd;                        // 监听socket
+    conn_table* m_table;                   // 所有reactor共享的连接表
+    http_conn* m_users;                    // 连接表中的数组，以fd为下标（fd在进程内唯一）
+    int m_max_fd;                          // m_users数组的大小，fd超过它的连接直接关闭
+    timer_wheel* m_wheel;                  // 本reactor的连接的定时器，NULL为不超时
+    int m_timerfd;                         // 驱动时间轮的周期timerfd
+    int m_wakefd;                          // eventfd，其它线程写入以唤醒事件循环
+    int m_signalfd;                        // 本reactor接收信号时的signalfd，否则为-1
+    void (*m_signal_handler)(int);
+    std::atomic<bool> m_running;
+    int m_reserve_fd;                      // 预留的fd(/dev/null)，fd用完时关掉它腾出一个位置，accept后立即拒绝
+
+private:
+    int m_epollfd;                         // 本reactor的epoll对象
+    epoll_event* m_events;                 // epoll_wait返回的就绪事件数组
+    int m_max_events;                      // m_events数组的大小
+    bool m_listen_et;                      // 监听socket是否使用边缘触发
+    int m_accept_batch;                    // 每次最多accept的连接数
+    bool m_accept_pending;                 // 边缘触发时上次用完了配额，监听队列中可能还有连接，不会再通知
+    threadpool<http_conn>* m_pool;         // 线程池，多reactor模式下为NULL
+    pthread_t m_thread;                    // 运行loop()的线程
+    int m_cpu;                             // m_thread绑定的CPU，-1为不绑定
+    locker m_done_lock;                    // 保护m_done
+    std::vector<int> m_done;               // 线程池处理完、等待本线程发送应答的连接
+    std::vector<int> m_done_local;         // 与m_done交换后在本线程中处理，避免持锁处理
+};
+
+#endif
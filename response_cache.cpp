@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <string.h>
+#include "response_cache.h"
+#include "file_cache.h"
+
+void frequency_sketch::init(int expected_entries) {
+    uint32_t width = 16;
+    while(width < (uint32_t)expected_entries && width < (1u << 24)) {
+        width <<= 1;
+    }
+    delete[] m_table;
+    m_table = new uint8_t[ROWS * width]();
+    m_mask = width - 1;
+    m_additions = 0;
+    m_sample_size = 10 * width;
+}
+
+// 每一行用不同的种子重新混合哈希值，得到该行的计数器下标
+int frequency_sketch::index(uint64_t hash, int row) const {
+    static const uint64_t SEEDS[ROWS] = {
+        0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+    };
+    uint64_t h = (hash + SEEDS[row]) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return row * (m_mask + 1) + (h & m_mask);
+}
+
+void frequency_sketch::increment(uint64_t hash) {
+    for(int i = 0; i < ROWS; i++) {
+        uint8_t& counter = m_table[index(hash, i)];
+        if(counter < MAX_COUNT) {
+            counter++;
+        }
+    }
+    if(++m_additions >= m_sample_size) {
+        reset();
+    }
+}
+
+// 取所有行中最小的计数，哈希冲突只会使估计偏大
+int frequency_sketch::frequency(uint64_t hash) const {
+    int freq = MAX_COUNT;
+    for(int i = 0; i < ROWS; i++) {
+        int count = m_table[index(hash, i)];
+        if(count < freq) {
+            freq = count;
+        }
+    }
+    return freq;
+}
+
+void frequency_sketch::reset() {
+    for(uint32_t i = 0; i < ROWS * (m_mask + 1); i++) {
+        m_table[i] >>= 1;
+    }
+    m_additions /= 2;
+}
+
+void response_cache::lru_list::push_front(response* resp) {
+    resp->prev = NULL;
+    resp->next = head;
+    if(head) {
+        head->prev = resp;
+    }
+    head = resp;
+    if(!tail) {
+        tail = resp;
+    }
+    bytes += resp->size;
+}
+
+void response_cache::lru_list::remove(response* resp) {
+    if(resp->prev) {
+        resp->prev->next = resp->next;
+    } else {
+        head = resp->next;
+    }
+    if(resp->next) {
+        resp->next->prev = resp->prev;
+    } else {
+        tail = resp->prev;
+    }
+    resp->prev = resp->next = NULL;
+    bytes -= resp->size;
+}
+
+response_cache::response_cache():
+    m_window_capacity(0), m_main_capacity(0), m_protected_capacity(0), m_max_object(0),
+    m_epoch(0), m_hits(0), m_misses(0), m_admitted(0), m_rejected(0), m_invalidations(0) {
+}
+
+response_cache::~response_cache() {
+    clear();
+}
+
+bool response_cache::init(long capacity, int max_object) {
+    long per_shard = capacity / SHARD_COUNT;
+    if(per_shard <= 0 || max_object <= 0) {
+        return false;
+    }
+    // 窗口占1%，主缓存中保护区占80%
+    m_window_capacity = per_shard / 100;
+    m_main_capacity = per_shard - m_window_capacity;
+    m_protected_capacity = m_main_capacity * 8 / 10;
+    m_max_object = max_object;
+    // 按平均1KB一个应答估计条目数，决定sketch的宽度
+    for(int i = 0; i < SHARD_COUNT; i++) {
+        m_shards[i].sketch.init(per_shard / 1024);
+    }
+    return true;
+}
+
+bool response_cache::make_key(const char* url, bool linger, std::string* key) {
+    char path[256];
+    if(!file_cache::normalize(url, path, sizeof(path))) {
+        return false;
+    }
+    key->assign(1, linger ? 'K' : 'C');
+    key->append(path);
+    return true;
+}
+
+uint64_t response_cache::hash_key(const std::string& key) {
+    return std::hash<std::string>()(key);
+}
+
+response_cache::shard& response_cache::get_shard(uint64_t hash) {
+    return m_shards[(hash >> 32) % SHARD_COUNT];
+}
+
+void response_cache::destroy(response* resp) {
+    delete[] resp->data;
+    delete resp;
+}
+
+void response_cache::release(response* resp) {
+    if(resp->refs.fetch_sub(1) == 1) {
+        destroy(resp);
+    }
+}
+
+void response_cache::evict(shard& s, response* resp) {
+    s.map.erase(resp->key);
+    s.lists[resp->region].remove(resp);
+    resp->cached = false;
+    release(resp);  // 释放缓存持有的引用，正在发送的连接仍然可以使用它
+}
+
+// 窗口和保护区中命中的条目移到链表头部，试用区中命中的条目升入保护区
+void response_cache::on_hit(shard& s, response* resp) {
+    lru_list& list = s.lists[resp->region];
+    if(resp->region != response::PROBATION) {
+        if(list.head != resp) {
+            list.remove(resp);
+            list.push_front(resp);
+        }
+        return;
+    }
+    list.remove(resp);
+    resp->region = response::PROTECTED;
+    s.lists[response::PROTECTED].push_front(resp);
+    // 保护区超出预算时，把最久没有命中的条目降回试用区
+    lru_list& prot = s.lists[response::PROTECTED];
+    while(prot.bytes > m_protected_capacity && prot.tail != resp) {
+        response* demoted = prot.tail;
+        prot.remove(demoted);
+        demoted->region = response::PROBATION;
+        s.lists[response::PROBATION].push_front(demoted);
+    }
+}
+
+/*
+    窗口挤出的候选条目进入主缓存前的准入判断(按大小感知):
+    主缓存放不下时，从试用区尾部(然后是保护区尾部)依次选出要淘汰的条目，直到腾出足够的空间，
+    只有候选条目的频率比其中每一个都高才淘汰它们并接纳候选条目，否则丢弃候选条目
+*/
+void response_cache::admit(shard& s, response* candidate) {
+    lru_list& prob = s.lists[response::PROBATION];
+    lru_list& prot = s.lists[response::PROTECTED];
+    long need = prob.bytes + prot.bytes + candidate->size - m_main_capacity;
+    if(need > 0) {
+        int freq = s.sketch.frequency(candidate->hash);
+        long freed = 0;
+        response* victim = prob.tail ? prob.tail : prot.tail;
+        while(freed < need) {
+            if(!victim || s.sketch.frequency(victim->hash) >= freq) {
+                s.map.erase(candidate->key);
+                candidate->cached = false;
+                release(candidate);
+                m_rejected++;
+                return;
+            }
+            freed += victim->size;
+            if(victim->prev) {
+                victim = victim->prev;
+            } else {
+                victim = victim->region == response::PROBATION ? prot.tail : NULL;
+            }
+        }
+        while(prob.bytes + prot.bytes + candidate->size > m_main_capacity) {
+            evict(s, prob.tail ? prob.tail : prot.tail);
+        }
+    }
+    candidate->region = response::PROBATION;
+    prob.push_front(candidate);
+    m_admitted++;
+}
+
+response* response_cache::lookup(const char* url, bool linger, unsigned* epoch) {
+    *epoch = m_epoch;  // 必须在查找之前取，保证插入时能发现这之后的失效
+    std::string key;
+    if(!make_key(url, linger, &key)) {
+        return NULL;
+    }
+    uint64_t hash = hash_key(key);
+    shard& s = get_shard(hash);
+
+    s.lock.lock();
+    s.sketch.increment(hash);  // 无论是否命中都记录一次访问
+    std::unordered_map<std::string, response*>::iterator it = s.map.find(key);
+    if(it == s.map.end()) {
+        s.lock.unlock();
+        m_misses++;
+        return NULL;
+    }
+    response* resp = it->second;
+    resp->refs++;
+    on_hit(s, resp);
+    s.lock.unlock();
+    m_hits++;
+    return resp;
+}
+
+response* response_cache::insert(const char* url, bool linger, const char* header, int header_len,
+                                  const char* body, int body_len, unsigned epoch) {
+    if(header_len + body_len > m_max_object) {
+        return NULL;
+    }
+    response* resp = new response;
+    if(!make_key(url, linger, &resp->key)) {
+        delete resp;
+        return NULL;
+    }
+    resp->hash = hash_key(resp->key);
+    resp->size = header_len + body_len;
+    resp->head_len = header_len;
+    resp->data = new char[resp->size];
+    memcpy(resp->data, header, header_len);
+    memcpy(resp->data + header_len, body, body_len);  // 在锁外拷贝
+    resp->region = response::WINDOW;
+    resp->cached = true;
+    resp->refs = 2;  // 缓存一个，调用者一个
+    resp->prev = resp->next = NULL;
+
+    shard& s = get_shard(resp->hash);
+    s.lock.lock();
+    if(m_epoch != epoch) {  // 查找之后有文件失效了，内容可能是旧的
+        s.lock.unlock();
+        destroy(resp);
+        return NULL;
+    }
+    std::unordered_map<std::string, response*>::iterator it = s.map.find(resp->key);
+    if(it != s.map.end()) {  // 其它线程已经插入了同一个应答
+        response* existing = it->second;
+        existing->refs++;
+        s.lock.unlock();
+        destroy(resp);
+        return existing;
+    }
+    s.map[resp->key] = resp;
+    lru_list& window = s.lists[response::WINDOW];
+    window.push_front(resp);
+    while(window.bytes > m_window_capacity && window.tail) {
+        response* candidate = window.tail;
+        window.remove(candidate);
+        admit(s, candidate);
+    }
+    s.lock.unlock();
+    return resp;
+}
+
+void response_cache::invalidate(const char* path) {
+    m_epoch++;
+    for(int i = 0; i < 2; i++) {
+        std::string key;
+        if(!make_key(path, i == 0, &key)) {
+            return;
+        }
+        uint64_t hash = hash_key(key);
+        shard& s = get_shard(hash);
+        s.lock.lock();
+        std::unordered_map<std::string, response*>::iterator it = s.map.find(key);
+        if(it != s.map.end()) {
+            evict(s, it->second);
+            m_invalidations++;
+        }
+        s.lock.unlock();
+    }
+}
+
+void response_cache::clear() {
+    m_epoch++;
+    for(int i = 0; i < SHARD_COUNT; i++) {
+        shard& s = m_shards[i];
+        s.lock.lock();
+        for(int r = 0; r < 3; r++) {
+            while(s.lists[r].head) {
+                evict(s, s.lists[r].head);
+                m_invalidations++;
+            }
+        }
+        s.lock.unlock();
+    }
+}
+
+void response_cache::on_file_invalidate(const char* path, void* arg) {
+    response_cache* cache = (response_cache*) arg;
+    if(path) {
+        cache->invalidate(path);
+    } else {
+        cache->clear();
+    }
+}
+
+void response_cache::print_stats() {
+    long bytes = 0;
+    long count = 0;
+    for(int i = 0; i < SHARD_COUNT; i++) {
+        shard& s = m_shards[i];
+        s.lock.lock();
+        for(int r = 0; r < 3; r++) {
+            bytes += s.lists[r].bytes;
+        }
+        count += s.map.size();
+        s.lock.unlock();
+    }
+    printf("response cache: hits=%ld misses=%ld admitted=%ld rejected=%ld invalidations=%ld entries=%ld bytes=%ld\n",
+           m_hits.load(), m_misses.load(), m_admitted.load(), m_rejected.load(),
+           m_invalidations.load(), count, bytes);
+}
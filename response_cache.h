@@ -0,0 +1,131 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+
+/*
+    应答缓存: 缓存小的热点文件的完整应答(状态行 + 头部 + 文件内容)，存放在一块连续、只读的内存中，
+    命中时不需要拼头部；只有Date和空行是发送时插在头部和文件内容之间的，一次writev就能发出整个应答
+    1. key为 连接状态('K'长连接 / 'C'短连接) + 规范化后的URL路径，两种连接的Connection头部不同
+    2. 按内存预算(字节)而不是条目数限制容量，超过max_object的应答不缓存
+    3. 准入策略为W-TinyLFU: 新应答先进入占1%预算的窗口LRU，被挤出窗口时用Count-Min Sketch估计的访问频率
+       与主缓存(SLRU: 20%试用区 + 80%保护区)中将被淘汰的条目比较，频率更高才能进入主缓存，
+       因此爬虫扫一遍resources/只会在窗口里打转，不会把index1.html挤出去
+    4. 条目带引用计数，连接在发送期间持有引用；文件变化时由file_cache的inotify线程调用invalidate使其失效
+*/
+
+/*缓存的应答*/
+struct response {
+    enum REGION {WINDOW = 0, PROBATION, PROTECTED};
+
+    std::string key;            // 缓存的key
+    uint64_t hash;              // key的哈希值，用于选择分片和估计频率
+    char* data;                 // 完整的应答
+    int size;                   // 应答的字节数
+    int head_len;               // 头部的字节数(不含Date和空行)，后面是文件内容
+    int region;                 // 所在的区域，分片锁保护
+    bool cached;                // 是否还在缓存中，分片锁保护
+    std::atomic<int> refs;      // 引用计数，缓存本身持有一个引用
+    response* prev;             // 所在区域的LRU链表，越靠前越新
+    response* next;
+};
+
+/*
+    频率估计: 4行的Count-Min Sketch，每个计数器最大为15
+    累计增加的次数达到采样上限(10倍宽度)后所有计数器减半，使旧的热点逐渐冷却
+*/
+class frequency_sketch {
+public:
+    frequency_sketch(): m_table(NULL), m_mask(0), m_additions(0), m_sample_size(0) {}
+    ~frequency_sketch() { delete[] m_table; }
+
+    void init(int expected_entries);
+    void increment(uint64_t hash);
+    int frequency(uint64_t hash) const;
+
+private:
+    int index(uint64_t hash, int row) const;
+    void reset();
+
+private:
+    static const int ROWS = 4;
+    static const int MAX_COUNT = 15;
+
+    uint8_t* m_table;           // ROWS * (m_mask + 1) 个计数器
+    uint32_t m_mask;            // 每行宽度 - 1，宽度为2的幂
+    int m_additions;
+    int m_sample_size;
+};
+
+class response_cache {
+public:
+    static const int SHARD_COUNT = 16;  // 分片个数
+
+    response_cache();
+    ~response_cache();
+
+    bool init(long capacity, int max_object);         // 设置内存预算和单个应答的最大字节数
+
+    // 查找url的应答，命中时返回持有一个引用的条目；未命中时通过epoch返回当前的失效计数，插入时要带回来
+    response* lookup(const char* url, bool linger, unsigned* epoch);
+    // 把header(不含Date和空行) + body拼成一个应答放入缓存，返回持有一个引用的条目；
+    // 查找之后发生过失效(文件可能已经变了)、应答太大或url非法时不缓存，返回NULL
+    response* insert(const char* url, bool linger, const char* header, int header_len,
+                     const char* body, int body_len, unsigned epoch);
+    void release(response* resp);                     // 释放lookup/insert得到的引用
+    void invalidate(const char* path);                // 使一个文件(规范化后的路径)的两种应答失效
+    void clear();                                     // 清空整个缓存
+    int max_object() const { return m_max_object; }
+
+    // 供file_cache的失效通知使用，path为NULL表示全部失效
+    static void on_file_invalidate(const char* path, void* arg);
+
+    void print_stats();
+
+private:
+    /*一个区域的LRU链表*/
+    struct lru_list {
+        response* head;
+        response* tail;
+        long bytes;
+        lru_list(): head(NULL), tail(NULL), bytes(0) {}
+        void push_front(response* resp);
+        void remove(response* resp);
+    };
+
+    struct shard {
+        locker lock;
+        std::unordered_map<std::string, response*> map;
+        frequency_sketch sketch;
+        lru_list lists[3];                             // 按response::REGION索引
+    };
+
+    static bool make_key(const char* url, bool linger, std::string* key);
+    static uint64_t hash_key(const std::string& key);
+    shard& get_shard(uint64_t hash);
+    void evict(shard& s, response* resp);              // 从分片中移除，调用者持有分片锁
+    void on_hit(shard& s, response* resp);
+    void admit(shard& s, response* candidate);         // 窗口挤出的条目尝试进入主缓存
+    static void destroy(response* resp);
+
+private:
+    long m_window_capacity;                            // 每个分片的窗口预算
+    long m_main_capacity;                              // 每个分片的主缓存预算
+    long m_protected_capacity;                         // 每个分片主缓存中保护区的预算
+    int m_max_object;
+    shard m_shards[SHARD_COUNT];
+
+    std::atomic<unsigned> m_epoch;                     // 失效计数，每次失效都加一
+
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_admitted;                      // 从窗口进入主缓存的次数
+    std::atomic<long> m_rejected;                      // 被准入策略拒绝的次数
+    std::atomic<long> m_invalidations;
+};
+
+#endif
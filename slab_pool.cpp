@@ -0,0 +1,56 @@
+#include "slab_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+std::atomic<int> slab_pool::m_pool_count(0);
+thread_local slab_pool::free_node* slab_pool::m_local[slab_pool::MAX_POOLS];
+
+slab_pool::slab_pool(size_t object_size, int per_slab): m_per_slab(per_slab), m_slabs(0), m_in_use(0) {
+    m_object_size = (object_size + 63) / 64 * 64;
+    m_id = m_pool_count.fetch_add(1);
+    if(m_id >= MAX_POOLS) {
+        abort();                                   // 池是启动时创建的，个数在编译期就确定了
+    }
+}
+
+bool slab_pool::grow() {
+    size_t size = m_object_size * m_per_slab;
+    char* slab = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(slab == MAP_FAILED) {
+        return false;
+    }
+    // 倒序挂到链表上，先分配出去的是slab开头的对象
+    free_node* head = m_local[m_id];
+    for(int i = m_per_slab - 1; i >= 0; i--) {
+        free_node* node = (free_node*)(slab + i * m_object_size);
+        node->next = head;
+        head = node;
+    }
+    m_local[m_id] = head;
+    m_slabs.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void* slab_pool::alloc() {
+    if(!m_local[m_id] && !grow()) {
+        return NULL;
+    }
+    free_node* node = m_local[m_id];
+    m_local[m_id] = node->next;
+    m_in_use.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+void slab_pool::free(void* p) {
+    free_node* node = (free_node*)p;
+    node->next = m_local[m_id];
+    m_local[m_id] = node;
+    m_in_use.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void slab_pool::print_stats(const char* name) const {
+    long slabs = m_slabs.load();
+    printf("%s pool: object=%lu in_use=%ld allocated=%ld (%ld KB)\n", name, (unsigned long)m_object_size,
+           m_in_use.load(), slabs * m_per_slab, slabs * m_per_slab * (long)m_object_size >> 10);
+}
@@ -0,0 +1,47 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+    定长对象池: 每次向系统要一整块(slab，OBJECTS_PER_SLAB个对象)，切成定长对象挂在空闲链表上
+    1. 每个线程有自己的空闲链表，alloc()/free()只操作本线程的链表，不加锁也没有原子操作
+       (统计计数除外)；在一个线程中释放的对象之后由这个线程重新使用
+    2. slab用mmap分配，不归还给系统，池子的大小停在同时使用的对象个数的峰值
+    3. 对象必须在分配它的线程中释放: 在别的线程中释放的对象会挂到那个线程的链表上，分配它的线程再也拿不到，
+       池子只会越长越大。线程池模式下工作线程也会处理请求，所以http_conn只在reactor线程中分配和释放
+       (读缓冲区在respond()/finish_write()中换回初始缓冲区，不在工作线程的init_request()中)
+*/
+class slab_pool {
+public:
+    static const int OBJECTS_PER_SLAB = 64;
+    static const int MAX_POOLS = 16;               // 进程内最多的池个数(每个池在每个线程中占一个空闲链表)
+
+    // 对象大小向上取64字节(cache line)的整数倍；大对象的池可以用较小的per_slab，免得一个slab太大
+    explicit slab_pool(size_t object_size, int per_slab = OBJECTS_PER_SLAB);
+    void* alloc();                                 // 失败返回NULL
+    void free(void* p);
+    size_t object_size() const { return m_object_size; }
+    void print_stats(const char* name) const;
+
+private:
+    struct free_node {
+        free_node* next;
+    };
+
+    slab_pool(const slab_pool&);
+    slab_pool& operator=(const slab_pool&);
+    bool grow();                                   // 给本线程的空闲链表分配一个新的slab
+
+private:
+    size_t m_object_size;
+    int m_per_slab;                                // 每个slab的对象个数
+    int m_id;                                      // 本线程空闲链表在m_local中的下标
+    std::atomic<long> m_slabs;                     // 分配过的slab个数
+    std::atomic<long> m_in_use;                    // 正在使用的对象个数
+    static std::atomic<int> m_pool_count;
+    static thread_local free_node* m_local[MAX_POOLS];
+};
+
+#endif
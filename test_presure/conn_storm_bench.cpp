@@ -0,0 +1,215 @@
+/*
+    连接风暴压测工具: 保持N个并发的短连接，每个连接 建立 -> 发送一个请求(Connection: close) -> 读完应答 -> 关闭，
+    然后立即建立下一个，统计每秒建立的连接数、建立连接(connect到可写)和整个请求的时延分布，以及失败和503的个数
+    用来比较accept_batch、backlog和listen_profile(TCP_DEFER_ACCEPT、TCP_FASTOPEN)的效果
+    单线程用epoll驱动所有连接，connect是非阻塞的；fastopen为1时用sendto(MSG_FASTOPEN)在SYN中带上请求，
+    需要客户端和服务器的net.ipv4.tcp_fastopen都打开(值3)，服务器用--fastopen N或--listen_profile latency
+
+    编译: g++ -O2 -o conn_storm_bench conn_storm_bench.cpp
+    用法: ./conn_storm_bench ip port path [concurrency] [seconds] [fastopen]
+    例如: ./conn_storm_bench 127.0.0.1 10000 /index1.html 1000 10
+    1. 客户端主动关闭的连接会留在TIME_WAIT，工具关闭时发RST(SO_LINGER 0)，不占用本地端口
+    2. 目标是回环地址时轮流从127.0.0.1 ~ 127.0.0.N绑定源地址，避开一个源地址的临时端口上限
+    3. 并发数超过1024时需要调大ulimit -n；服务器的--backlog和net.core.somaxconn决定能排队多少个握手完成的连接
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+#define BUFFER_SIZE 65536
+#define SOURCE_ADDRS 16
+
+struct storm_conn {
+    int fd;
+    bool connected;   // 连接已经建立(可写)
+    bool sent;        // 请求已经随SYN发出
+    double start;     // 开始建立连接的时间
+    int status;       // 应答的状态码，0为还没有读到
+};
+
+static char request[512];
+static int request_len;
+static bool fastopen = false;
+static bool loopback = false;
+static struct sockaddr_in server;
+static unsigned next_source = 0;
+static long done = 0;             // 读完应答的连接
+static long failed = 0;           // 建立失败、被重置或没有读到应答就被关闭
+static long rejected = 0;         // 503应答(连接表已满或fd用完)
+static std::vector<float> connect_latency;   // 毫秒
+static std::vector<float> request_latency;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float percentile(std::vector<float>& v, double p) {
+    if(v.empty()) {
+        return 0;
+    }
+    return v[(size_t)(p * (v.size() - 1))];
+}
+
+// 开始建立一个新连接并注册到epoll上，失败时返回false
+static bool open_conn(int epollfd, storm_conn* c, int index) {
+    c->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd < 0) {
+        return false;
+    }
+    c->connected = false;
+    c->sent = false;
+    c->status = 0;
+    c->start = now();
+    struct linger lg = {1, 0};
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    if(loopback) {
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(0x7f000001 + next_source++ % SOURCE_ADDRS);
+        bind(c->fd, (struct sockaddr*)&local, sizeof(local));
+    }
+    int ret;
+    if(fastopen) {  // 请求随SYN发出；还没有cookie时内核只发出请求cookie的普通SYN，返回EINPROGRESS，请求在握手后再发
+        ret = sendto(c->fd, request, request_len, MSG_FASTOPEN | MSG_NOSIGNAL, (struct sockaddr*)&server, sizeof(server));
+        c->sent = ret > 0;
+    } else {
+        ret = connect(c->fd, (struct sockaddr*)&server, sizeof(server));
+    }
+    if(ret < 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u32 = index;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &event);
+    return true;
+}
+
+static void close_conn(int epollfd, storm_conn* c) {
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, 0);
+    close(c->fd);
+    c->fd = -1;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s ip port path [concurrency] [seconds] [fastopen]\n", basename(argv[0]));
+        return 1;
+    }
+    int conns = argc > 4 ? atoi(argv[4]) : 1000;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    fastopen = argc > 6 && atoi(argv[6]) != 0;
+    request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", argv[3], argv[1]);
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &server.sin_addr);
+    loopback = (ntohl(server.sin_addr.s_addr) >> 24) == 127;
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < (rlim_t)conns + 16) {
+        limit.rlim_cur = limit.rlim_max < (rlim_t)conns + 16 ? limit.rlim_max : conns + 16;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int epollfd = epoll_create(5);
+    storm_conn* users = new storm_conn[conns];
+    for(int i = 0; i < conns; i++) {
+        if(!open_conn(epollfd, &users[i], i)) {
+            printf("socket failure: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    static char buf[BUFFER_SIZE];
+    epoll_event events[1024];
+    double start = now();
+    double deadline = start + seconds;
+    while(now() < deadline) {
+        int num = epoll_wait(epollfd, events, 1024, 100);
+        for(int i = 0; i < num; i++) {
+            int index = events[i].data.u32;
+            storm_conn* c = &users[index];
+            if(c->fd < 0) {
+                continue;
+            }
+            bool finished = false;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                finished = true;
+            } else if(!c->connected && (events[i].events & EPOLLOUT)) {
+                c->connected = true;
+                connect_latency.push_back((now() - c->start) * 1000);
+                if(!c->sent) {
+                    send(c->fd, request, request_len, MSG_NOSIGNAL);
+                }
+                epoll_event event;
+                event.events = EPOLLIN;
+                event.data.u32 = index;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &event);
+            }
+            if(!finished && (events[i].events & EPOLLIN)) {
+                while(true) {   // 只关心状态码，读到服务器关闭为止
+                    int n = recv(c->fd, buf, sizeof(buf), 0);
+                    if(n > 0) {
+                        if(c->status == 0 && n > 12) {
+                            c->status = atoi(buf + 9);  // "HTTP/1.1 200"
+                        }
+                        continue;
+                    }
+                    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    }
+                    finished = true;
+                    break;
+                }
+            }
+            if(!finished) {
+                continue;
+            }
+            if(c->status == 0) {
+                failed++;
+            } else if(c->status == 503) {
+                rejected++;
+            } else {
+                done++;
+                request_latency.push_back((now() - c->start) * 1000);
+            }
+            close_conn(epollfd, c);
+            if(!open_conn(epollfd, c, index)) {
+                failed++;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    std::sort(connect_latency.begin(), connect_latency.end());
+    std::sort(request_latency.begin(), request_latency.end());
+    printf("%d concurrent connections%s, running %d sec.\n", conns, fastopen ? " (TCP Fast Open)" : "", seconds);
+    printf("Connections: %ld completed (%.0f/sec), %ld rejected (503), %ld failed\n",
+           done, done / elapsed, rejected, failed);
+    printf("Connect latency (ms): p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+           percentile(connect_latency, 0.5), percentile(connect_latency, 0.9),
+           percentile(connect_latency, 0.99), percentile(connect_latency, 1.0));
+    printf("Request latency (ms): p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+           percentile(request_latency, 0.5), percentile(request_latency, 0.9),
+           percentile(request_latency, 0.99), percentile(request_latency, 1.0));
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+    空闲连接内存压测工具: 建立大量空闲的长连接(C100K/C1M)，比较建立前后服务器进程的常驻内存(VmRSS)，
+    得到每个空闲连接占用的内存。指定path时每个连接先完成一个请求再空闲，这时连接经历过完整的请求，
+    请求状态和缓冲区应该已经还给池，不应该继续占用内存
+    服务器和本工具需要在同一台机器上(从/proc/<pid>/status读服务器的内存)
+
+    编译: g++ -O2 -o idle_conn_bench idle_conn_bench.cpp
+    用法: ./idle_conn_bench ip port server_pid connections [path]
+    例如: ./idle_conn_bench 127.0.0.1 10000 $(pidof server) 100000 /index1.html
+    连接数超过几万时需要:
+    1. 调大两边的ulimit -n，服务器的--max_fd要大于连接数
+    2. 一个源地址最多约28000个临时端口(ip_local_port_range)，工具会轮流从127.0.0.1 ~ 127.0.0.N绑定源地址，
+       每个源地址SOURCE_CONNS个连接，所以目标地址要用回环地址
+    3. 服务器的--backlog和net.core.somaxconn调大，否则建立连接的速度受限
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SOURCE_CONNS 25000
+#define BUFFER_SIZE 65536
+
+// 读取进程的常驻内存(KB)
+static long read_rss(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* fp = fopen(path, "r");
+    if(!fp) {
+        return -1;
+    }
+    char line[256];
+    long rss = -1;
+    while(fgets(line, sizeof(line), fp)) {
+        if(strncmp(line, "VmRSS:", 6) == 0) {
+            rss = atol(line + 6);
+            break;
+        }
+    }
+    fclose(fp);
+    return rss;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 发送一个请求并读完应答，应答只用Content-Length判断结束
+static bool request_once(int fd, const char* request, int len) {
+    static char buf[BUFFER_SIZE];
+    if(send(fd, request, len, MSG_NOSIGNAL) != len) {
+        return false;
+    }
+    int have = 0;
+    long need = -1;
+    while(true) {
+        int n = recv(fd, buf + have, sizeof(buf) - 1 - have, 0);
+        if(n <= 0) {
+            return false;
+        }
+        have += n;
+        buf[have] = '\0';
+        if(need < 0) {
+            char* end = strstr(buf, "\r\n\r\n");
+            if(!end) {
+                continue;
+            }
+            char* cl = strcasestr(buf, "Content-Length:");
+            need = (end + 4 - buf) + (cl ? atol(cl + 15) : 0);
+        }
+        if(have >= need) {
+            return true;
+        }
+        if(have > BUFFER_SIZE / 2) {  // 只关心结束，丢掉已经读到的正文
+            need -= have;
+            have = 0;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 5) {
+        printf("usage: %s ip port server_pid connections [path]\n", basename(argv[0]));
+        return 1;
+    }
+    int pid = atoi(argv[3]);
+    int conns = atoi(argv[4]);
+    const char* path = argc > 5 ? argv[5] : NULL;
+    char request[512];
+    int request_len = 0;
+    if(path) {
+        request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", path, argv[1]);
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < (rlim_t)conns + 16) {
+        limit.rlim_cur = limit.rlim_max < (rlim_t)conns + 16 ? limit.rlim_max : conns + 16;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+    bool loopback = (ntohl(addr.sin_addr.s_addr) >> 24) == 127;
+
+    long before = read_rss(pid);
+    if(before < 0) {
+        printf("cannot read /proc/%d/status\n", pid);
+        return 1;
+    }
+    double start = now();
+    int opened = 0;
+    for(; opened < conns; opened++) {
+        int fd = socket(PF_INET, SOCK_STREAM, 0);
+        if(fd < 0) {
+            printf("socket failure after %d connections: %s\n", opened, strerror(errno));
+            break;
+        }
+        if(loopback) {  // 每SOURCE_CONNS个连接换一个源地址
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(0x7f000001 + opened / SOURCE_CONNS);
+            bind(fd, (struct sockaddr*)&local, sizeof(local));
+        }
+        struct linger lg = {1, 0};  // 退出时发RST，不在本端留下TIME_WAIT占用端口
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            printf("connect failure after %d connections: %s\n", opened, strerror(errno));
+            close(fd);
+            break;
+        }
+        if(path && !request_once(fd, request, request_len)) {
+            printf("request failure after %d connections\n", opened);
+            close(fd);
+            break;
+        }
+    }
+    double elapsed = now() - start;
+    sleep(2);  // 等服务器accept完所有连接
+    long after = read_rss(pid);
+    printf("%d idle connections%s, opened in %.1f sec.\n", opened, path ? " (one request each)" : "", elapsed);
+    printf("server VmRSS: %ld KB -> %ld KB, %.0f bytes per connection\n", before, after,
+           opened > 0 ? (after - before) * 1024.0 / opened : 0.0);
+    // 进程退出时关闭所有连接
+    return 0;
+}
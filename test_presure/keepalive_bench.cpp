@@ -0,0 +1,178 @@
+/*
+    长连接压测工具: webbench每个请求都新建一个连接，测不出事件后端在keep-alive下的差别
+    单线程用epoll驱动N个长连接，每个连接收到完整应答后立即发送下一个请求，统计每秒完成的请求数
+    depth大于1时使用HTTP流水线: 每个连接一次发送depth个请求，收齐depth个应答后再发送下一批
+
+    编译: g++ -O2 -o keepalive_bench keepalive_bench.cpp
+    用法: ./keepalive_bench ip port path [connections] [seconds] [depth]
+    例如: ./keepalive_bench 127.0.0.1 10000 /index1.html 100 10 16
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BUFFER_SIZE 65536
+
+struct bench_conn {
+    int fd;
+    long need;        // 当前应答还需要读取的字节数，-1表示还没有读完头部
+    int head_len;     // 已读到的头部字节数
+    int pending;      // 这一批还没有收到应答的请求数
+    char head[1024];  // 应答头部
+};
+
+static char request[512 * 64];  // depth个请求连在一起
+static int request_len;
+static long completed = 0;
+static long failed = 0;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const struct sockaddr_in* addr) {
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// 消费读到的数据，返回读完的应答个数
+static int consume(bench_conn* c, const char* data, int len) {
+    int done = 0;
+    while(len > 0) {
+        if(c->need < 0) {  // 还在读头部
+            int n = len < (int)sizeof(c->head) - 1 - c->head_len ? len : (int)sizeof(c->head) - 1 - c->head_len;
+            memcpy(c->head + c->head_len, data, n);
+            c->head_len += n;
+            c->head[c->head_len] = '\0';
+            char* end = strstr(c->head, "\r\n\r\n");
+            if(!end) {
+                return done;
+            }
+            int head_size = end + 4 - c->head;
+            char* cl = strcasestr(c->head, "Content-Length:");
+            long body = cl ? atol(cl + 15) : 0;
+            int extra = c->head_len - head_size;  // 头部之后已经读到的正文
+            int used = n - extra;
+            data += used;
+            len -= used;
+            c->need = body;
+            c->head_len = 0;
+        }
+        long n = len < c->need ? len : c->need;
+        c->need -= n;
+        data += n;
+        len -= n;
+        if(c->need == 0) {
+            c->need = -1;
+            done++;
+        }
+    }
+    return done;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s ip port path [connections] [seconds] [depth]\n", basename(argv[0]));
+        return 1;
+    }
+    int conns = argc > 4 ? atoi(argv[4]) : 100;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    int depth = argc > 6 ? atoi(argv[6]) : 1;
+    if(depth < 1 || depth > 64) {
+        printf("depth must be 1..64\n");
+        return 1;
+    }
+    for(int i = 0; i < depth; i++) {
+        request_len += snprintf(request + request_len, sizeof(request) - request_len,
+            "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", argv[3], argv[1]);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+
+    int epollfd = epoll_create(5);
+    bench_conn* users = new bench_conn[conns];
+    for(int i = 0; i < conns; i++) {
+        users[i].fd = connect_to(&addr);
+        if(users[i].fd < 0) {
+            printf("connect failure: %s\n", strerror(errno));
+            return 1;
+        }
+        users[i].need = -1;
+        users[i].head_len = 0;
+        users[i].pending = depth;
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, users[i].fd, &event);
+        send(users[i].fd, request, request_len, 0);
+    }
+
+    static char buf[BUFFER_SIZE];
+    epoll_event events[1024];
+    double start = now();
+    double deadline = start + seconds;
+    while(now() < deadline) {
+        int num = epoll_wait(epollfd, events, 1024, 100);
+        for(int i = 0; i < num; i++) {
+            bench_conn* c = &users[events[i].data.u32];
+            while(true) {
+                int n = recv(c->fd, buf, sizeof(buf), 0);
+                if(n > 0) {
+                    int done = consume(c, buf, n);
+                    completed += done;
+                    c->pending -= done;
+                    if(c->pending <= 0) {  // 这一批的应答都收齐了
+                        c->pending = depth;
+                        send(c->fd, request, request_len, 0);
+                    }
+                    continue;
+                }
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                // 服务器关闭了连接，重新建立
+                failed++;
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, 0);
+                close(c->fd);
+                c->fd = connect_to(&addr);
+                c->need = -1;
+                c->head_len = 0;
+                c->pending = depth;
+                if(c->fd >= 0) {
+                    epoll_event event;
+                    event.events = EPOLLIN;
+                    event.data.u32 = events[i].data.u32;
+                    epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &event);
+                    send(c->fd, request, request_len, 0);
+                }
+                break;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    printf("%d connections, pipeline depth %d, running %d sec.\n", conns, depth, seconds);
+    printf("Requests: %ld succeed, %ld reconnect, %.0f requests/sec.\n", completed, failed, completed / elapsed);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+# 大文件测试: 在doc_root下创建一个稀疏文件(默认5GB，超过2GB的int上限)，在几个位置写入标记，
+# 通过回环地址完整下载并与原文件比较md5，同时检查Content-Length，结束后删除文件
+# 服务器需要已经在运行，设置SERVER_PID时打印下载过程中服务器的VmRSS，用来确认每个连接的内存不随文件大小增长
+#
+# 用法: ./large_file_test.sh doc_root [port] [size_gb]
+# 例如: SERVER_PID=$(pgrep -x server) ./large_file_test.sh /home/admin1/Simple-Web-Server/resources 10000 5
+
+DOC_ROOT=$1
+PORT=${2:-10000}
+SIZE_GB=${3:-5}
+if [ -z "$DOC_ROOT" ]; then
+    echo "usage: $0 doc_root [port] [size_gb]"
+    exit 1
+fi
+
+FILE=$DOC_ROOT/large_file_test.bin
+URL=http://127.0.0.1:$PORT/large_file_test.bin
+SIZE=$((SIZE_GB * 1024 * 1024 * 1024))
+
+truncate -s $SIZE "$FILE" || exit 1
+chmod o+r "$FILE"
+# 开头、2GB和4GB附近以及结尾写入标记，offset超过int范围时出错就能发现
+for offset in 0 $((2 * 1024 * 1024 * 1024 + 1)) $((4 * 1024 * 1024 * 1024 - 7)) $((SIZE - 16)); do
+    if [ $offset -lt $SIZE ]; then
+        printf "marker@%-9d" $((offset % 1000000000)) | dd of="$FILE" bs=1 seek=$offset conv=notrunc status=none
+    fi
+done
+
+ok=1
+expected=$(md5sum < "$FILE" | cut -d' ' -f1)
+if [ -n "$SERVER_PID" ]; then
+    (sleep 2; grep VmRSS /proc/$SERVER_PID/status | sed 's/^/server during download: /') &
+fi
+start=$(date +%s.%N)
+HEADERS=$(mktemp)
+actual=$(curl -s --max-time 600 -D $HEADERS $URL | md5sum | cut -d' ' -f1)
+end=$(date +%s.%N)
+wait
+
+length=$(tr -d '\r' < $HEADERS | awk 'tolower($1) == "content-length:" {print $2}')
+rm -f $HEADERS
+if [ "$length" != "$SIZE" ]; then
+    echo "FAIL Content-Length: expected $SIZE, got $length"
+    ok=0
+fi
+
+if [ "$expected" = "$actual" ]; then
+    echo "OK ${SIZE_GB}GB body matches ($(awk "BEGIN {printf \"%.0f\", $SIZE / ($end - $start) / 1048576}") MB/s)"
+else
+    echo "FAIL body md5: expected $expected, got $actual"
+    ok=0
+fi
+
+rm -f "$FILE"
+[ $ok = 1 ]
@@ -0,0 +1,106 @@
+/*
+    日志的微基准: N个线程同时写日志，比较
+    1. printf: 原来的做法，所有线程竞争stdout的锁；printf-line为stdout是终端时的行缓冲，每行一次write
+    2. logger: 每个线程写自己的无锁缓冲区，后台线程批量写出
+    3. 关闭的级别: LOG_DEBUG在运行时级别为INFO时的开销，参数不会被求值
+    输出都写到文件(默认/tmp/log_bench.out)，每种情况结束后删除
+
+    编译: g++ -O2 -o log_bench log_bench.cpp ../log.cpp -pthread
+    用法: ./log_bench [threads] [lines_per_thread] [output_file]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "../log.h"
+
+static long lines_per_thread = 200000;
+static FILE* out = NULL;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 参数求值有副作用，用来确认关闭的级别不会求值
+static long evaluated = 0;
+static int expensive() {
+    evaluated++;
+    return 42;
+}
+
+static void* printf_worker(void* arg) {
+    long id = (long) arg;
+    for(long i = 0; i < lines_per_thread; i++) {
+        fprintf(out, "[INFO] thread %ld request %ld: GET /index.html HTTP/1.1 200 %d\n", id, i, 1024);
+    }
+    return NULL;
+}
+
+static void* logger_worker(void* arg) {
+    long id = (long) arg;
+    for(long i = 0; i < lines_per_thread; i++) {
+        LOG_INFO("thread %ld request %ld: GET /index.html HTTP/1.1 200 %d", id, i, 1024);
+    }
+    return NULL;
+}
+
+static void* disabled_worker(void* arg) {
+    long id = (long) arg;
+    for(long i = 0; i < lines_per_thread; i++) {
+        LOG_DEBUG("thread %ld request %ld: %d", id, i, expensive());
+    }
+    return NULL;
+}
+
+static double run(int threads, void* (*worker)(void*)) {
+    pthread_t* tids = new pthread_t[threads];
+    double start = now();
+    for(long i = 0; i < threads; i++) {
+        pthread_create(tids + i, NULL, worker, (void*) i);
+    }
+    for(int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    delete[] tids;
+    return now() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    lines_per_thread = argc > 2 ? atol(argv[2]) : lines_per_thread;
+    const char* path = argc > 3 ? argv[3] : "/tmp/log_bench.out";
+    long total = threads * lines_per_thread;
+
+    printf("%d threads x %ld lines\n", threads, lines_per_thread);
+    printf("%12s %12s %12s\n", "method", "ns/line", "lines/s");
+
+    out = fopen(path, "w");
+    double t = run(threads, printf_worker);
+    fclose(out);
+    unlink(path);
+    printf("%12s %12.1f %12.0f\n", "printf", t * 1e9 / total, total / t);
+
+    out = fopen(path, "w");
+    setvbuf(out, NULL, _IOLBF, BUFSIZ);
+    t = run(threads, printf_worker);
+    fclose(out);
+    unlink(path);
+    printf("%12s %12.1f %12.0f\n", "printf-line", t * 1e9 / total, total / t);
+
+    // 缓冲区足够大，不丢弃；计时包括最后写出的时间
+    logger::init(path, logger::INFO, 0, 0, 32 << 20);
+    double start = now();
+    run(threads, logger_worker);
+    logger::shutdown();
+    t = now() - start;
+    printf("%12s %12.1f %12.0f  dropped=%ld\n", "logger", t * 1e9 / total, total / t, logger::dropped());
+    unlink(path);
+
+    t = run(threads, disabled_worker);
+    printf("%12s %12.1f %12.0f  evaluated=%ld\n", "disabled", t * 1e9 / total, total / t, evaluated);
+    return 0;
+}
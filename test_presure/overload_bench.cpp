@@ -0,0 +1,200 @@
+/*
+    过载压测工具: 用远多于服务器处理能力的并发长连接压测单reactor + 线程池模式，
+    统计200应答的时延分布和503应答(过载控制拒绝)的个数，比较开启和关闭过载控制(--codel_target 0)时被接受的请求的尾时延
+    单线程用epoll驱动N个长连接，每个连接收到应答后立即发送下一个请求；收到503后服务器关闭连接，重新连接后继续
+    并发数远大于每秒处理能力 * 目标时延时，不控制的话请求在线程池队列中排队的时间随并发数增长
+
+    编译: g++ -O2 -o overload_bench overload_bench.cpp
+    用法: ./overload_bench ip port path [connections] [seconds]
+    例如: ./overload_bench 127.0.0.1 10000 /index1.html 4000 10
+    连接数超过服务器的backlog时需要调大服务器的--backlog，超过1024时需要调大ulimit -n
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+#define BUFFER_SIZE 65536
+
+struct bench_conn {
+    int fd;
+    long need;        // 当前应答还需要读取的字节数，-1表示还没有读完头部
+    int head_len;     // 已读到的头部字节数
+    int status;       // 当前应答的状态码
+    double sent;      // 当前请求的发送时间
+    char head[1024];  // 应答头部
+};
+
+static char request[512];
+static int request_len;
+static long ok = 0;             // 200应答
+static long shed = 0;           // 503应答
+static long other = 0;          // 其它状态码
+static long reconnects = 0;     // 服务器关闭连接的次数
+static std::vector<float> latency;  // 200应答的时延(毫秒)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(const struct sockaddr_in* addr) {
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void send_request(bench_conn* c) {
+    c->need = -1;
+    c->head_len = 0;
+    c->sent = now();
+    send(c->fd, request, request_len, MSG_NOSIGNAL);
+}
+
+// 消费读到的数据，读完一个应答时记录结果并返回true
+static bool consume(bench_conn* c, const char* data, int len) {
+    while(len > 0) {
+        if(c->need < 0) {  // 还在读头部
+            int n = len < (int)sizeof(c->head) - 1 - c->head_len ? len : (int)sizeof(c->head) - 1 - c->head_len;
+            memcpy(c->head + c->head_len, data, n);
+            c->head_len += n;
+            c->head[c->head_len] = '\0';
+            char* end = strstr(c->head, "\r\n\r\n");
+            if(!end) {
+                return false;
+            }
+            int head_size = end + 4 - c->head;
+            char* cl = strcasestr(c->head, "Content-Length:");
+            c->status = atoi(c->head + 9);  // "HTTP/1.1 200"
+            int extra = c->head_len - head_size;  // 头部之后已经读到的正文
+            int used = n - extra;
+            data += used;
+            len -= used;
+            c->need = cl ? atol(cl + 15) : 0;
+            c->head_len = 0;
+        }
+        long n = len < c->need ? len : c->need;
+        c->need -= n;
+        data += n;
+        len -= n;
+        if(c->need == 0) {
+            if(c->status == 200) {
+                ok++;
+                latency.push_back((now() - c->sent) * 1000);
+            } else if(c->status == 503) {
+                shed++;
+            } else {
+                other++;
+            }
+            return true;  // 每个连接只有一个未完成的请求，剩下的数据不会再有
+        }
+    }
+    return false;
+}
+
+static float percentile(double p) {
+    if(latency.empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (latency.size() - 1));
+    return latency[i];
+}
+
+static void reconnect(int epollfd, bench_conn* c, int index, const struct sockaddr_in* addr) {
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, 0);
+    close(c->fd);
+    c->fd = connect_to(addr);
+    if(c->fd >= 0) {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &event);
+        send_request(c);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 4) {
+        printf("usage: %s ip port path [connections] [seconds]\n", basename(argv[0]));
+        return 1;
+    }
+    int conns = argc > 4 ? atoi(argv[4]) : 2000;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+    request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", argv[3], argv[1]);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+
+    int epollfd = epoll_create(5);
+    bench_conn* users = new bench_conn[conns];
+    for(int i = 0; i < conns; i++) {
+        users[i].fd = connect_to(&addr);
+        if(users[i].fd < 0) {
+            printf("connect failure: %s\n", strerror(errno));
+            return 1;
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, users[i].fd, &event);
+    }
+    for(int i = 0; i < conns; i++) {  // 连接都建立之后同时开始发送
+        send_request(&users[i]);
+    }
+
+    static char buf[BUFFER_SIZE];
+    epoll_event events[1024];
+    double start = now();
+    double deadline = start + seconds;
+    while(now() < deadline) {
+        int num = epoll_wait(epollfd, events, 1024, 100);
+        for(int i = 0; i < num; i++) {
+            int index = events[i].data.u32;
+            bench_conn* c = &users[index];
+            while(true) {
+                int n = recv(c->fd, buf, sizeof(buf), 0);
+                if(n > 0) {
+                    if(consume(c, buf, n) && c->status != 503) {
+                        send_request(c);
+                    }
+                    continue;
+                }
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                // 服务器关闭了连接(503之后或出错)，重新建立
+                reconnects++;
+                reconnect(epollfd, c, index, &addr);
+                break;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    std::sort(latency.begin(), latency.end());
+    printf("%d connections, running %d sec.\n", conns, seconds);
+    printf("Responses: %ld ok (%.0f/sec), %ld shed (503), %ld other, %ld reconnect\n",
+           ok, ok / elapsed, shed, other, reconnects);
+    printf("Latency of ok responses (ms): p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+    线程池请求队列的微基准，比较
+    1. locked: 原来的实现，std::list + 互斥锁 + 信号量，每次入队分配一个链表节点
+    2. mpmc: 现在的实现，有界无锁MPMC队列 + eventcount，和threadpool::append()/take()的做法相同
+    两种场景，线程数从1到64:
+    pairs: N个线程各自反复入队一个任务再取出一个任务，所有线程竞争同一个队列
+    handoff: 1个生产者(相当于reactor)入队，N个消费者(相当于工作线程)取出，队列空时消费者睡眠
+    结果是每秒完成的任务数(入队 + 出队算一个)
+
+    编译: g++ -O2 -o queue_bench queue_bench.cpp -pthread
+    用法: ./queue_bench [tasks] [max_threads]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <list>
+#include "../locker.h"
+#include "../mpmc_queue.h"
+
+static const int CAPACITY = 16384;
+static const int SPIN_COUNT = 64;
+
+// 原来threadpool中的请求队列
+class locked_queue {
+public:
+    bool push(long* task) {
+        m_lock.lock();
+        if(m_list.size() > CAPACITY) {
+            m_lock.unlock();
+            return false;
+        }
+        m_list.push_back(task);
+        m_lock.unlock();
+        m_stat.post();
+        return true;
+    }
+    long* pop() {
+        while(true) {
+            m_stat.wait();
+            m_lock.lock();
+            if(m_list.empty()) {
+                m_lock.unlock();
+                continue;
+            }
+            long* task = m_list.front();
+            m_list.pop_front();
+            m_lock.unlock();
+            return task;
+        }
+    }
+
+private:
+    std::list<long*> m_list;
+    locker m_lock;
+    sem m_stat;
+};
+
+// 现在threadpool中的请求队列
+class lockfree_queue {
+public:
+    lockfree_queue(): m_queue(CAPACITY), m_spin(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0) {}
+    bool push(long* task) {
+        if(!m_queue.enqueue(task)) {
+            return false;
+        }
+        m_stat.notify();
+        return true;
+    }
+    long* pop() {
+        long* task;
+        while(true) {
+            for(int i = 0; i < m_spin; i++) {
+                if(m_queue.dequeue(task)) {
+                    return task;
+                }
+                cpu_relax();
+            }
+            int key = m_stat.prepare_wait();
+            if(m_queue.dequeue(task)) {
+                m_stat.cancel_wait();
+                return task;
+            }
+            m_stat.wait(key);
+        }
+    }
+
+private:
+    mpmc_queue<long*> m_queue;
+    eventcount m_stat;
+    int m_spin;
+};
+
+static long tasks = 2000000;
+static long token = 0;  // 入队的都是它的地址，NULL表示结束
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template<typename Q>
+struct bench_arg {
+    Q* queue;
+    long count;
+};
+
+template<typename Q>
+static void push_wait(Q* q, long* task) {
+    while(!q->push(task)) {  // 满了让消费者先取
+        sched_yield();
+    }
+}
+
+template<typename Q>
+static void* pairs_worker(void* p) {
+    bench_arg<Q>* arg = (bench_arg<Q>*) p;
+    for(long i = 0; i < arg->count; i++) {
+        push_wait(arg->queue, &token);
+        arg->queue->pop();
+    }
+    return NULL;
+}
+
+template<typename Q>
+static void* consumer(void* p) {
+    bench_arg<Q>* arg = (bench_arg<Q>*) p;
+    while(arg->queue->pop()) {
+        arg->count++;
+    }
+    return NULL;
+}
+
+// 返回每秒完成的任务数
+template<typename Q>
+static double run_pairs(int threads) {
+    Q queue;
+    pthread_t tid[64];
+    bench_arg<Q> args[64];
+    double start = now();
+    for(int i = 0; i < threads; i++) {
+        args[i].queue = &queue;
+        args[i].count = tasks / threads;
+        pthread_create(tid + i, NULL, pairs_worker<Q>, args + i);
+    }
+    for(int i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    return tasks / threads * threads / (now() - start);
+}
+
+template<typename Q>
+static double run_handoff(int threads) {
+    Q queue;
+    pthread_t tid[64];
+    bench_arg<Q> args[64];
+    double start = now();
+    for(int i = 0; i < threads; i++) {
+        args[i].queue = &queue;
+        args[i].count = 0;
+        pthread_create(tid + i, NULL, consumer<Q>, args + i);
+    }
+    for(long i = 0; i < tasks; i++) {
+        push_wait(&queue, &token);
+    }
+    for(int i = 0; i < threads; i++) {
+        push_wait(&queue, (long*) NULL);
+    }
+    long done = 0;
+    for(int i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+        done += args[i].count;
+    }
+    double elapsed = now() - start;
+    if(done != tasks) {
+        printf("handoff lost tasks: %ld of %ld\n", done, tasks);
+    }
+    return tasks / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc > 1) {
+        tasks = atol(argv[1]);
+    }
+    int max_threads = argc > 2 ? atoi(argv[2]) : 64;
+    if(max_threads > 64) {
+        max_threads = 64;
+    }
+    printf("%ld tasks per run, %ld CPUs\n", tasks, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %14s %14s %14s\n", "threads", "pairs locked", "pairs mpmc", "handoff locked", "handoff mpmc");
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        double pl = run_pairs<locked_queue>(threads);
+        double pm = run_pairs<lockfree_queue>(threads);
+        double hl = run_handoff<locked_queue>(threads);
+        double hm = run_handoff<lockfree_queue>(threads);
+        printf("%8d %13.2fM %13.2fM %13.2fM %13.2fM\n", threads, pl / 1e6, pm / 1e6, hl / 1e6, hm / 1e6);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+    请求扫描的微基准: 在典型的浏览器请求(600-1500字节，带Cookie等头部)上比较
+    原来逐字节的parse_line + strpbrk与http_scanner的标量、SSE4.2、AVX2实现
+    每个请求先拷贝到读缓冲区(解析时会把\r\n改成\0)，再切分出所有的行；
+    http_scanner版本同时校验方法名、URL和每个头部名的字符，原来的版本不做这些校验
+    开始之前先用随机数据检查各个实现的结果是否一致
+
+    编译: g++ -O2 -o scan_bench scan_bench.cpp ../http_scanner.cpp
+    用法: ./scan_bench [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../http_scanner.h"
+
+static const char* requests[] = {
+    // Chrome打开首页
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,"
+    "*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n",
+    // Chrome加载图片，带Cookie和条件请求头部
+    "GET /images/image1.jpg HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://www.example.com/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; _ga_ABCDEF1234=GS1.1.1700000000.3.1.1700000500.0.0.0; "
+    "session_id=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=zh-CN; "
+    "csrftoken=Yl0cB4x2QkPz9mT1nV7sW3eR8uJ5hG6aF0dK2lM4; _gid=GA1.2.987654321.1700000000\r\n"
+    "If-None-Match: \"1a2b3c-17f0e2d4c5b6a798\"\r\n"
+    "If-Modified-Since: Tue, 14 Nov 2023 22:13:20 GMT\r\n"
+    "\r\n",
+    // Firefox，带很长的Cookie
+    "GET /index2.html?from=search&q=simple+web+server&page=2 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.search-engine.example/search?q=simple+web+server&source=hp&ei=abcdefghijkl\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; _ga_ABCDEF1234=GS1.1.1700000000.3.1.1700000500.0.0.0; "
+    "session_id=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=zh-CN; "
+    "csrftoken=Yl0cB4x2QkPz9mT1nV7sW3eR8uJ5hG6aF0dK2lM4; _gid=GA1.2.987654321.1700000000; "
+    "ab_test=variant_b; recently_viewed=1023%2C2048%2C4096%2C8192%2C16384; "
+    "consent=%7B%22necessary%22%3Atrue%2C%22analytics%22%3Atrue%2C%22marketing%22%3Afalse%7D; "
+    "_fbp=fb.1.1700000000000.1234567890; _hjSessionUser_123456=eyJpZCI6ImFiY2RlZi0xMjM0LTU2Nzgi"
+    "LCJjcmVhdGVkIjoxNzAwMDAwMDAwMDAwLCJleGlzdGluZyI6dHJ1ZX0=\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: cross-site\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Priority: u=1\r\n"
+    "\r\n",
+};
+static const int request_count = sizeof(requests) / sizeof(requests[0]);
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 原来的从状态机: 逐字节找\r\n，并把它改成\0\0
+static int old_parse(char* buf, int len) {
+    int lines = 0;
+    int checked = 0;
+    char* line = buf;
+    while(checked < len) {
+        char c = buf[checked];
+        if(c == '\r' && checked + 1 < len && buf[checked + 1] == '\n') {
+            buf[checked++] = '\0';
+            buf[checked++] = '\0';
+            if(lines++ == 0) {  // 请求行用strpbrk切分
+                char* url = strpbrk(line, " \t");
+                if(!url) {
+                    return -1;
+                }
+                *url++ = '\0';
+                char* version = strpbrk(url, " \t");
+                if(!version) {
+                    return -1;
+                }
+                *version = '\0';
+            }
+            line = buf + checked;
+        } else {
+            checked++;
+        }
+    }
+    return lines;
+}
+
+// http_scanner: 按块找控制字符，同时校验请求行和头部名
+static int new_parse(char* buf, int len) {
+    int lines = 0;
+    const char* end = buf + len;
+    char* line = buf;
+    while(true) {
+        char* p = (char*)http_scanner::find_ctl(line, end);
+        if(p == end || p[0] != '\r' || p + 1 == end || p[1] != '\n') {
+            return p == end ? lines : -1;
+        }
+        p[0] = p[1] = '\0';
+        if(lines++ == 0) {
+            char* sep = (char*)http_scanner::find_non_token(line, end);
+            if(sep == line || *sep != ' ') {
+                return -1;
+            }
+            *sep = '\0';
+            char* url = sep + 1;
+            sep = (char*)http_scanner::find_non_vchar(url, end);
+            if(sep == url || *sep != ' ') {
+                return -1;
+            }
+            *sep = '\0';
+        } else if(line[0] != '\0') {
+            const char* colon = http_scanner::find_non_token(line, end);
+            if(colon == line || *colon != ':') {
+                return -1;
+            }
+        }
+        line = p + 2;
+    }
+}
+
+// 用随机数据对比各个实现与标量实现的结果，返回不一致的次数
+static int check_consistency() {
+    static const unsigned char alphabet[] = {'a', 'Z', '0', '-', '!', '|', '~', '{', '}', '"', '(', ' ', '\t',
+                                             '\r', '\n', 0x00, 0x1f, 0x7f, 0x80, 0xff, ':', '/', '@', '^', '`'};
+    static char buf[256];
+    srand(1);
+    int errors = 0;
+    for(int round = 0; round < 20000; round++) {
+        int len = rand() % sizeof(buf);
+        for(int i = 0; i < len; i++) {
+            // 大部分是普通字符，偶尔插入边界字符
+            buf[i] = rand() % 8 ? 'a' + rand() % 26 : alphabet[rand() % sizeof(alphabet)];
+        }
+        int start = len ? rand() % len : 0;
+        const char* expected[3];
+        http_scanner::init(http_scanner::SCALAR);
+        expected[0] = http_scanner::find_ctl(buf + start, buf + len);
+        expected[1] = http_scanner::find_non_token(buf + start, buf + len);
+        expected[2] = http_scanner::find_non_vchar(buf + start, buf + len);
+        for(int isa = http_scanner::SSE42; isa <= http_scanner::AVX2; isa++) {
+            if(http_scanner::init((http_scanner::ISA)isa) != isa) {
+                continue;
+            }
+            errors += http_scanner::find_ctl(buf + start, buf + len) != expected[0];
+            errors += http_scanner::find_non_token(buf + start, buf + len) != expected[1];
+            errors += http_scanner::find_non_vchar(buf + start, buf + len) != expected[2];
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+    int errors = check_consistency();
+    printf("consistency check: %s\n", errors ? "FAIL" : "OK");
+    if(errors) {
+        printf("%d mismatches\n", errors);
+        return 1;
+    }
+
+    long total_bytes = 0;
+    int lengths[request_count];
+    for(int i = 0; i < request_count; i++) {
+        lengths[i] = strlen(requests[i]);
+        total_bytes += lengths[i];
+        // 两种解析切分出的行数必须相同
+        static char copy[4096];
+        memcpy(copy, requests[i], lengths[i]);
+        int expected = old_parse(copy, lengths[i]);
+        memcpy(copy, requests[i], lengths[i]);
+        if(expected <= 0 || new_parse(copy, lengths[i]) != expected) {
+            printf("request %d: parse failure\n", i);
+            return 1;
+        }
+        printf("request %d: %d bytes, %d lines\n", i, lengths[i], expected);
+    }
+
+    static char buf[4096];
+    printf("%10s %12s %10s %10s\n", "scanner", "ns/request", "MB/s", "lines");
+    for(int impl = -1; impl <= http_scanner::AVX2; impl++) {
+        const char* name = "old";
+        if(impl >= 0) {
+            if(http_scanner::init((http_scanner::ISA)impl) != impl) {
+                continue;  // CPU不支持
+            }
+            name = http_scanner::isa_name((http_scanner::ISA)impl);
+        }
+        long lines = 0;
+        double start = now();
+        for(long n = 0; n < iterations; n++) {
+            int r = n % request_count;
+            memcpy(buf, requests[r], lengths[r]);
+            lines += impl < 0 ? old_parse(buf, lengths[r]) : new_parse(buf, lengths[r]);
+        }
+        double elapsed = now() - start;
+        printf("%10s %12.1f %10.0f %10ld\n", name, elapsed * 1e9 / iterations,
+               iterations * (double)total_bytes / request_count / elapsed / (1 << 20), lines);
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+    文件发送方式对比: mmap + writev、头部MSG_MORE + sendfile、sendmsg(MSG_ZEROCOPY)
+    不经过服务器，直接在一条TCP连接上重复发送"头部 + 文件内容"，另一个线程接收并丢弃，
+    对每种文件大小和发送方式统计每秒发送的应答数和吞吐量
+
+    编译: g++ -O2 -o send_bench send_bench.cpp -pthread
+    用法: ./send_bench [seconds_per_case] [ip:port]
+    不指定ip:port时接收端在本进程内(127.0.0.1)；指定时需要在对端运行一个丢弃数据的服务，例如
+        nc -lk 9999 > /dev/null，然后 ./send_bench 5 10.0.0.2:9999
+    注意: 回环网卡上MSG_ZEROCOPY总是退化为拷贝(输出的copied列)，只有真实网卡才能看到它的收益
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+enum METHOD {WRITEV = 0, SENDFILE, ZEROCOPY};
+static const char* method_names[] = {"writev", "sendfile", "zerocopy"};
+
+static char header[256];
+static int header_len;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 接收端: 读到的数据全部丢弃，直到发送端关闭连接
+static void* receiver(void* arg) {
+    int fd = (int)(long) arg;
+    static char buf[1 << 18];
+    while(recv(fd, buf, sizeof(buf), 0) > 0) {
+    }
+    return NULL;
+}
+
+// 创建一个size字节的临时文件
+static int make_file(long size) {
+    char path[] = "/tmp/send_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    static char block[1 << 16];
+    memset(block, 'x', sizeof(block));
+    for(long left = size; left > 0; ) {
+        int n = left < (long)sizeof(block) ? left : sizeof(block);
+        if(write(fd, block, n) != n) {
+            close(fd);
+            return -1;
+        }
+        left -= n;
+    }
+    return fd;
+}
+
+// 回收错误队列上的完成通知，wait为true时至少等到一条通知
+static long zc_completed = 0;
+static long zc_copied = 0;
+static void reap(int sock, bool wait) {
+    while(true) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if(!wait) {
+                return;
+            }
+            struct pollfd pfd = {sock, 0, 0};
+            poll(&pfd, 1, 100);  // 错误队列非空时报告POLLERR
+            wait = false;
+            continue;
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+            if(err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            long count = err->ee_data - err->ee_info + 1;
+            zc_completed += count;
+            if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc_copied += count;
+            }
+        }
+    }
+}
+
+// 发送一个完整的应答，失败返回false
+static bool send_response(int sock, METHOD method, int file_fd, char* addr, long size) {
+    if(method == SENDFILE) {
+        if(send(sock, header, header_len, MSG_MORE) != header_len) {
+            return false;
+        }
+        off_t offset = 0;
+        while(offset < size) {
+            if(sendfile(sock, file_fd, &offset, size - offset) <= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    struct iovec iv[2];
+    iv[0].iov_base = header;
+    iv[0].iov_len = header_len;
+    iv[1].iov_base = addr;
+    iv[1].iov_len = size;
+    int count = 2;
+    while(count > 0) {
+        long n;
+        if(method == ZEROCOPY) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iv + (2 - count);
+            msg.msg_iovlen = count;
+            n = sendmsg(sock, &msg, MSG_ZEROCOPY);
+            if(n < 0 && errno == ENOBUFS) {  // 完成通知太多，先回收
+                reap(sock, true);
+                continue;
+            }
+        } else {
+            n = writev(sock, iv + (2 - count), count);
+        }
+        if(n < 0) {
+            return false;
+        }
+        for(int i = 2 - count; i < 2 && n > 0; i++) {
+            long m = n < (long)iv[i].iov_len ? n : (long)iv[i].iov_len;
+            iv[i].iov_base = (char*)iv[i].iov_base + m;
+            iv[i].iov_len -= m;
+            n -= m;
+        }
+        while(count > 0 && iv[2 - count].iov_len == 0) {
+            count--;
+        }
+    }
+    if(method == ZEROCOPY) {
+        reap(sock, false);
+    }
+    return true;
+}
+
+static int connect_to(const struct sockaddr_in* addr) {
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 3;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    int listenfd = -1;
+    if(argc > 2) {  // 发往外部的丢弃服务
+        char host[64];
+        snprintf(host, sizeof(host), "%s", argv[2]);
+        char* colon = strchr(host, ':');
+        if(!colon) {
+            printf("usage: %s [seconds_per_case] [ip:port]\n", argv[0]);
+            return 1;
+        }
+        *colon = '\0';
+        inet_pton(AF_INET, host, &addr.sin_addr);
+        addr.sin_port = htons(atoi(colon + 1));
+    } else {  // 本进程内的接收端
+        listenfd = socket(PF_INET, SOCK_STREAM, 0);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        socklen_t len = sizeof(addr);
+        if(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenfd, 8) < 0
+           || getsockname(listenfd, (struct sockaddr*)&addr, &len) < 0) {
+            printf("listen failure: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    // 内核不支持SO_ZEROCOPY时只比较前两种
+    int last_method = ZEROCOPY;
+    int probe = socket(PF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if(setsockopt(probe, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        printf("SO_ZEROCOPY not supported, skipping zerocopy\n");
+        last_method = SENDFILE;
+    }
+    close(probe);
+
+    static const long sizes[] = {4 << 10, 64 << 10, 1 << 20, 16 << 20, 128 << 20};
+    printf("%10s %10s %12s %10s %8s\n", "size", "method", "responses/s", "MB/s", "copied");
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        long size = sizes[s];
+        int file_fd = make_file(size);
+        char* file_addr = file_fd < 0 ? (char*)MAP_FAILED
+                        : (char*)mmap(0, size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+        if(file_addr == MAP_FAILED) {
+            printf("cannot create a %ld byte file\n", size);
+            return 1;
+        }
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nContent-Type: text/html\r\n"
+                              "Connection: keep-alive\r\n\r\n", size);
+
+        for(int m = WRITEV; m <= last_method; m++) {
+            // 每种情况一条新连接，互不影响
+            int sock = connect_to(&addr);
+            if(sock < 0) {
+                printf("connect failure: %s\n", strerror(errno));
+                return 1;
+            }
+            pthread_t thread = 0;
+            int peer = -1;
+            if(listenfd != -1) {
+                peer = accept(listenfd, NULL, NULL);
+                pthread_create(&thread, NULL, receiver, (void*)(long) peer);
+            }
+            if(m == ZEROCOPY) {
+                setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+            }
+            zc_completed = zc_copied = 0;
+
+            long responses = 0;
+            double start = now();
+            double elapsed = 0;
+            while(elapsed < seconds) {
+                if(!send_response(sock, (METHOD)m, file_fd, file_addr, size)) {
+                    printf("send failure: %s\n", strerror(errno));
+                    break;
+                }
+                responses++;
+                elapsed = now() - start;
+            }
+            if(m == ZEROCOPY) {
+                reap(sock, true);  // 等最后一批完成通知
+            }
+            char copied[32] = "-";
+            if(m == ZEROCOPY && zc_completed > 0) {
+                snprintf(copied, sizeof(copied), "%ld%%", zc_copied * 100 / zc_completed);
+            }
+            printf("%10ld %10s %12.0f %10.1f %8s\n", size, method_names[m], responses / elapsed,
+                   responses * (double)(size + header_len) / elapsed / (1 << 20), copied);
+            fflush(stdout);
+
+            shutdown(sock, SHUT_WR);
+            close(sock);
+            if(thread) {
+                pthread_join(thread, NULL);
+                close(peer);
+            }
+        }
+        munmap(file_addr, size);
+        close(file_fd);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+    定时器的微基准: N个连接，每次操作模拟一个随机的连接上有活动(收到请求)，把它的超时重置为现在 + 60秒
+    1. sort_timer_lst: noactive/中的升序链表，重置时adjust_timer从原位置向后查找插入点，O(n)
+    2. timer_wheel: 分层时间轮，重置是O(1)的链表操作，每个tick推进一次
+    模拟时间每100次操作前进1毫秒，测试期间没有定时器到期，只比较重置的开销
+
+    编译: g++ -O2 -o timer_bench timer_bench.cpp ../timer_wheel.cpp
+    用法: ./timer_bench [operations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "../noactive/lst_timer.h"
+#include "../timer_wheel.h"
+
+static const long TIMEOUT_MS = 60000;
+static const long TICK_MS = 100;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_list(int conns, long ops) {
+    sort_timer_lst lst;  // 析构时释放所有定时器
+    std::vector<util_timer*> timers(conns);
+    long t = 0;
+    for(int i = 0; i < conns; i++) {
+        timers[i] = new util_timer;
+        timers[i]->expire = t + TIMEOUT_MS - i;  // 递减插入，每个都插在头部，建表不是O(n^2)
+        lst.add_timer(timers[i]);
+    }
+    srand(1);
+    double start = now();
+    for(long op = 0; op < ops; op++) {
+        if(op % 100 == 0) {
+            t++;
+        }
+        util_timer* timer = timers[rand() % conns];
+        timer->expire = t + TIMEOUT_MS;
+        lst.adjust_timer(timer);
+    }
+    return now() - start;
+}
+
+static long expired = 0;
+static void on_expire(timer_node*, void*) {
+    expired++;
+}
+
+static double bench_wheel(int conns, long ops) {
+    std::vector<timer_node> nodes(conns);  // 节点要比时间轮活得长
+    timer_wheel wheel(TICK_MS);
+    unsigned long base = timer_wheel::now_ms();
+    for(int i = 0; i < conns; i++) {
+        wheel.schedule(&nodes[i], TIMEOUT_MS);
+    }
+    srand(1);
+    unsigned long t = base;
+    double start = now();
+    for(long op = 0; op < ops; op++) {
+        if(op % 100 == 0) {
+            t++;
+            if(t % TICK_MS == 0) {
+                wheel.advance(t, on_expire, NULL);
+            }
+        }
+        wheel.schedule(&nodes[rand() % conns], TIMEOUT_MS);
+    }
+    return now() - start;
+}
+
+int main(int argc, char* argv[]) {
+    long ops = argc > 1 ? atol(argv[1]) : 20000;  // 链表在65536个连接时每次重置约1ms
+    static const int conns[] = {100, 1000, 10000, 65536};
+    printf("%ld resets per run\n", ops);
+    printf("%8s %16s %16s\n", "conns", "list ns/reset", "wheel ns/reset");
+    for(unsigned i = 0; i < sizeof(conns) / sizeof(conns[0]); i++) {
+        double l = bench_list(conns[i], ops);
+        double w = bench_wheel(conns[i], ops);
+        printf("%8d %16.1f %16.1f\n", conns[i], l * 1e9 / ops, w * 1e9 / ops);
+    }
+    if(expired) {
+        printf("unexpected expirations: %ld\n", expired);
+    }
+    return 0;
+}
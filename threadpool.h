@@ -1,58 +1,132 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <stdio.h>
 #include <pthread.h>
-#include <list>
+#include <unistd.h>
+#include <atomic>
 #include <exception>
-#include <cstdio>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "ws_deque.h"
+#include "topology.h"
+#include "codel.h"
+#include "log.h"
 
 /*线程池模板类，为了代码的复用*/
 /*模板参数T就是任务类*/
+/*
+    两种调度方式，append()的用法相同:
+    1. FIFO: 所有线程共用一个有界的无锁MPMC队列，入队和出队都不加锁、不分配内存
+    2. work stealing: 每个工作线程一个Chase-Lev队列，append()轮流放到各个线程的队列中，
+       工作线程先取自己队列中的任务，没有时随机选其它线程的队列去偷，不再所有线程竞争同一个队列头
+    空闲的工作线程先短暂自旋，再通过eventcount在futex上睡眠；一直有任务时生产者和消费者都不进入内核
+    设置了过载控制(set_codel)时，append()记下任务入队的时间，工作线程取出时把等待时间报告给codel，
+    调用者在放入任务之前用admit()询问是否过载；这时任务类要提供set_enqueue_time()/enqueue_time()
+*/
 template<typename T>
 class threadpool {
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);  // 构造函数，初始化线程数量和最大请求数量
+    // stealing为true时使用work stealing调度；cpus不为空时第i个线程绑定到cpus[i % cpu_count]
+    threadpool(int thread_number = 8, int max_requests = 10000, bool stealing = false,
+               const int* cpus = NULL, int cpu_count = 0);  // 构造函数，初始化线程数量和最大请求数量
     ~threadpool();                // 析构
-    bool append(T* request);      // 添加任务
+    bool append(T* request);      // 添加任务，可以在多个线程中调用
+    // 任务的process()完成后在工作线程中调用done(request, arg)，例如把结果交还给事件循环
+    void set_completion(void (*done)(T*, void*), void* arg) { m_done = done; m_done_arg = arg; }
+    void set_codel(codel* c) { m_codel = c; }  // 开启基于排队时延的过载控制，要在append()之前设置
+    bool admit() { return !m_codel || m_codel->admit(); }  // 过载时返回false，调用者应当拒绝请求而不是放入队列
+    void print_stats() const;     // 打印每个工作线程执行和偷到的任务数
 
 private:
+    // 每个工作线程的状态，各占cache line，计数器只由本线程修改
+    struct worker_slot {
+        threadpool* pool;
+        int id;
+        ws_deque<T*>* deque;              // work stealing模式下本线程的队列，FIFO模式为NULL
+        std::atomic<bool> pushing;        // 有线程正在往deque中放任务(deque只允许一个线程push)
+        unsigned seed;                    // 选择偷取对象的随机数种子
+        std::atomic<long> executed;       // 执行的任务数
+        std::atomic<long> stolen;         // 其中从其它线程的队列偷到的任务数
+    } __attribute__((aligned(64)));
+
     /*线程的工作函数worker()定义——函数指针*/
     /*必须是静态成员函数，因为非静态会有this指针，导致调用时参数个数不匹配*/
     static void* worker(void* arg);
     /*线程池工作函数run()的定义*/
     /*从工作队列中取数据*/
-    void run();
+    void run(worker_slot& self);
+    bool take(worker_slot& self, T*& request);  // 取一个任务，没有任务时睡眠，线程池停止时返回false
+    bool try_take(worker_slot& self, T*& request);  // 不睡眠地取一个任务
+    bool push(T* request);        // work stealing模式下放入一个线程的队列
+
+    static const int SPIN_COUNT = 64;  // 多核时睡眠前检查队列的次数
 
 private:
     int m_thread_number;         // 成员1:线程的数量
     pthread_t* m_threads;        // 成员2:线程池数组，大小为m_thread_number，存放线程ID
-    int m_max_requests;          // 成员3:请求队列中最多允许的，等待处理的请求数量
-    std::list<T*> m_workqueue;   // 成员4:请求队列
-    locker m_queuelocker;        // 成员5:互斥锁
-    sem m_queuestat;             // 成员6:信号量，用来判断是否有任务需要处理
-    bool m_stop;                 // 成员7:是否结束线程
+    int m_max_requests;          // 成员3:请求队列中最多允许的，等待处理的请求数量(向上取2的幂)
+    mpmc_queue<T*> m_workqueue;  // 成员4:FIFO模式的请求队列
+    eventcount m_queuestat;      // 成员5:空闲线程在这里睡眠，append()时唤醒一个
+    std::atomic<bool> m_stop;    // 成员6:是否结束线程
+    int m_spin;                  // 自旋次数，单核时自旋只会占用生产者的时间，不自旋
+    void (*m_done)(T*, void*);   // 成员7:任务完成时的回调，NULL为不回调
+    void* m_done_arg;
+    codel* m_codel;              // 过载控制，NULL为不控制
+    bool m_stealing;             // 成员8:是否使用work stealing
+    worker_slot* m_slots;        // 成员9:每个工作线程的状态
+    std::atomic<unsigned> m_next;  // append()下一个选择的线程
 };
 
 /*类模板的构造函数在类外实现*/
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests):
+threadpool<T>::threadpool(int thread_number, int max_requests, bool stealing, const int* cpus, int cpu_count):
     m_thread_number(thread_number), m_max_requests(max_requests),
-    m_stop(false), m_threads(NULL) {
+    m_workqueue(max_requests > 0 && !stealing ? max_requests : 1),  // work stealing模式下不使用共享队列
+    m_stop(false), m_threads(NULL), m_done(NULL), m_done_arg(NULL), m_codel(NULL), m_stealing(stealing), m_slots(NULL), m_next(0) {
         if(thread_number <= 0 || max_requests <= 0) {  // 传入的初始化参数合法性判断
             throw std::exception();
         }
+        m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+        m_slots = new worker_slot[m_thread_number];
+        for(int i = 0; i < m_thread_number; i++) {
+            m_slots[i].pool = this;
+            m_slots[i].id = i;
+            m_slots[i].deque = NULL;
+            m_slots[i].pushing = false;
+            m_slots[i].seed = i * 2654435761u + 1;
+            m_slots[i].executed = 0;
+            m_slots[i].stolen = 0;
+        }
+        if(m_stealing) {
+            // 请求总数的上限平均分到每个线程的队列
+            int per_thread = (max_requests + m_thread_number - 1) / m_thread_number;
+            for(int i = 0; i < m_thread_number; i++) {
+                m_slots[i].deque = new ws_deque<T*>(per_thread);
+            }
+            m_max_requests = m_slots[0].deque->capacity() * m_thread_number;
+        } else {
+            m_max_requests = m_workqueue.capacity();
+        }
         m_threads = new pthread_t[m_thread_number];    // 创建线程池数组(返回该数组的首地址)并判断是否创建成功
         if(!m_threads) {
             throw std::exception();
         }
         /*创建thread_number个线程，并将它们设置为线程脱离(线程结束后自己释放资源)*/
         for(int i = 0; i < thread_number; i++) {
-            std::printf("Create the %d thread\n", i);
-            /*此处将this作为参数传递给static成员函数worker()，使它可以访问到成员变量*/
-            if(pthread_create(m_threads + i, NULL, worker, this) != 0) {  //将创建的线程的ID存到m_threads + i中，也就是说数组m_threads中存放了线程的ID
+            LOG_INFO("Create the %d thread", i);
+            /*绑定CPU时线程从一开始就在这个CPU上运行，不会先在别的核上分配内存*/
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            if(cpu_count > 0 && !topology::set_affinity(&attr, cpus[i % cpu_count])) {
+                LOG_WARN("cannot bind worker %d to cpu %d", i, cpus[i % cpu_count]);
+            }
+            /*此处将本线程的状态(其中有this)作为参数传递给static成员函数worker()，使它可以访问到成员变量*/
+            int ret = pthread_create(m_threads + i, &attr, worker, m_slots + i);  //将创建的线程的ID存到m_threads + i中，也就是说数组m_threads中存放了线程的ID
+            pthread_attr_destroy(&attr);
+            if(ret != 0) {
                 /*创建失败: 释放数组，抛出异常*/
-                delete[] m_threads; 
+                delete[] m_threads;
                 throw std::exception();
             }
             /*创建成功后设置脱离: 设置失败，释放数组，抛出异常*/
@@ -64,52 +138,143 @@ threadpool<T>::threadpool(int thread_number, int max_requests):
     }
 
 /*类模板的析构函数在类外实现*/
+/*线程是脱离的，不等待它们结束，所以不释放m_slots和队列*/
 template<typename T>
 threadpool<T>::~threadpool() {
     delete[] m_threads;
     m_stop = true;
+    m_queuestat.notify(true);
 }
 
 /*类模板的成员函数在类外实现*/
-/*往队列中添加任务，需用锁保证线程同步*/
+/*往队列中添加任务，不加锁；只有有线程在睡眠时才唤醒，进入内核*/
 template<typename T>
 bool threadpool<T>::append(T* request) {
-    m_queuelocker.lock();                        // 互斥锁上锁
-    if(m_workqueue.size() > m_max_requests) {    // 如果请求队列超出最大量了，解锁并返回false
-        m_queuelocker.unlock();
+    if(m_codel) {
+        request->set_enqueue_time(codel::now_us());
+    }
+    bool ok = m_stealing ? push(request) : m_workqueue.enqueue(request);
+    if(!ok) {                                    // 如果请求队列满了，返回false
         return false;
     }
-    m_workqueue.push_back(request);              // 否则正常添加任务，并解锁
-    m_queuelocker.unlock();                      // 解锁
-    m_queuestat.post();                          // 信号量加1，当信号量值大于0时，其他正在调用wait()等待信号量的线程将被唤醒
+    m_queuestat.notify();                        // 被唤醒的不一定是队列的拥有者，它会去偷
     return true;
 }
 
+/*
+    轮流选择一个线程的队列；Chase-Lev队列只允许一个线程push，多个reactor同时append()时，
+    正在被别人push的队列直接跳过换下一个，不等待；所有队列都满时返回false
+*/
+template<typename T>
+bool threadpool<T>::push(T* request) {
+    unsigned start = m_next.fetch_add(1, std::memory_order_relaxed);
+    bool busy = true;
+    while(busy) {
+        busy = false;
+        for(int i = 0; i < m_thread_number; i++) {
+            worker_slot& slot = m_slots[(start + i) % m_thread_number];
+            if(slot.pushing.exchange(true, std::memory_order_acquire)) {
+                busy = true;
+                continue;
+            }
+            bool ok = slot.deque->push(request);
+            slot.pushing.store(false, std::memory_order_release);
+            if(ok) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /*线程的工作函数worker()的实现*/
 template<typename T>
-void* threadpool<T>::worker(void* arg) {   // 传入的this
-    threadpool* pool = (threadpool*) arg;
-    pool->run();
+void* threadpool<T>::worker(void* arg) {   // 传入的是本线程的worker_slot
+    worker_slot* slot = (worker_slot*) arg;
+    threadpool* pool = slot->pool;
+    pool->run(*slot);
     return pool;
 }
 
 /*线程池工作函数run()的实现*/
 template<typename T>
-void threadpool<T>::run() {
-    while(!m_stop) {                       // 循环从list中取出任务，直到m_stop为true才停止
-        m_queuestat.wait();                // 通过判断信号量是否有值来确定是否有任务可做，有的话不阻塞且信号量减1，没有的话就阻塞
-        m_queuelocker.lock();              // 有任务，要操作队列(共享资源)所以上锁
-        if(m_workqueue.empty()) {          // 判断请求队列是否为空，为空则解锁并继续查看队列中有无数据？
-            m_queuelocker.unlock();
-            continue;
-        }
-        T* request = m_workqueue.front();  // 队列中有数据，则获取队列头的任务request
-        m_workqueue.pop_front();           // 取出来以后删除队列头的任务
-        m_queuelocker.unlock();            // 任务队列解锁，允许其他线程操作
+void threadpool<T>::run(worker_slot& self) {
+    T* request;
+    while(take(self, request)) {           // 循环从队列中取出任务，直到m_stop为true才停止
         if(!request) {                     // 没获取到任务，继续
             continue;
         }
+        if(m_codel) {                      // 报告这个任务在队列中等待的时间
+            uint64_t now = codel::now_us();
+            m_codel->observe(now - request->enqueue_time(), now);
+        }
         request->process();                // 获取到了，执行线程的任务函数
+        self.executed.store(self.executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if(m_done) {
+            m_done(request, m_done_arg);
+        }
+    }
+}
+
+// 先取自己的队列，再从随机的位置开始依次偷其它线程的队列，每个队列最多看一次
+template<typename T>
+bool threadpool<T>::try_take(worker_slot& self, T*& request) {
+    if(!m_stealing) {
+        return m_workqueue.dequeue(request);
+    }
+    if(self.deque->steal(request)) {
+        return true;
+    }
+    self.seed ^= self.seed << 13;          // xorshift32
+    self.seed ^= self.seed >> 17;
+    self.seed ^= self.seed << 5;
+    int start = self.seed % m_thread_number;
+    for(int i = 0; i < m_thread_number; i++) {
+        worker_slot& victim = m_slots[(start + i) % m_thread_number];
+        if(&victim != &self && victim.deque->steal(request)) {
+            self.stolen.store(self.stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+bool threadpool<T>::take(worker_slot& self, T*& request) {
+    while(!m_stop.load(std::memory_order_relaxed)) {
+        // 任务通常一个接一个地到达，先自旋一会儿，避免刚睡下又被唤醒
+        for(int i = 0; i < m_spin; i++) {
+            if(try_take(self, request)) {
+                return true;
+            }
+            cpu_relax();
+        }
+        int key = m_queuestat.prepare_wait();
+        if(try_take(self, request)) {      // prepare_wait()之后再检查一次所有队列，之后入队的任务一定会唤醒一个线程
+            m_queuestat.cancel_wait();
+            return true;
+        }
+        if(m_stop.load(std::memory_order_relaxed)) {
+            m_queuestat.cancel_wait();
+            break;
+        }
+        if(m_codel) {                      // 队列空了，不再过载
+            m_codel->idle();
+        }
+        m_queuestat.wait(key);
+    }
+    return false;
+}
+
+template<typename T>
+void threadpool<T>::print_stats() const {
+    printf("threadpool: mode=%s threads=%d max_requests=%d\n", m_stealing ? "steal" : "fifo", m_thread_number, m_max_requests);
+    for(int i = 0; i < m_thread_number; i++) {
+        printf("  worker %d: executed=%ld stolen=%ld queued=%lu\n", i, m_slots[i].executed.load(), m_slots[i].stolen.load(),
+               m_stealing ? (unsigned long)m_slots[i].deque->size() : 0UL);
+    }
+    if(m_codel) {
+        m_codel->print_stats();
     }
 }
 
@@ -0,0 +1,131 @@
+#include "timer_wheel.h"
+#include <time.h>
+
+timer_wheel::timer_wheel(int tick_ms): m_tick_ms(tick_ms > 0 ? tick_ms : 1), m_count(0) {
+    for(int i = 0; i < LEVELS; i++) {
+        for(int j = 0; j < SLOTS; j++) {
+            m_slots[i][j].prev = m_slots[i] + j;
+            m_slots[i][j].next = m_slots[i] + j;
+        }
+    }
+    m_tick = now_ms() / m_tick_ms;
+}
+
+// 节点属于使用者，析构时只把它们从链表上取下
+timer_wheel::~timer_wheel() {
+    for(int i = 0; i < LEVELS; i++) {
+        for(int j = 0; j < SLOTS; j++) {
+            timer_node* head = m_slots[i] + j;
+            while(head->next != head) {
+                unlink(head->next);
+            }
+        }
+    }
+}
+
+unsigned long timer_wheel::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void timer_wheel::unlink(timer_node* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+void timer_wheel::push_back(timer_node* head, timer_node* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void timer_wheel::schedule(timer_node* node, long timeout_ms) {
+    if(node->pending()) {
+        unlink(node);
+        m_count--;
+    }
+    if(timeout_ms < 0) {
+        timeout_ms = 0;
+    }
+    // 向上取整到tick，保证不会早于timeout_ms到期(最多晚一个tick)
+    node->expire = m_tick + (timeout_ms + m_tick_ms - 1) / m_tick_ms;
+    insert(node);
+    m_count++;
+}
+
+void timer_wheel::cancel(timer_node* node) {
+    if(node->pending()) {
+        unlink(node);
+        m_count--;
+    }
+}
+
+// 按距离现在的tick数选择层: 差值在第k层的范围内时放到expire在第k层对应的槽
+void timer_wheel::insert(timer_node* node) {
+    if((long)(node->expire - m_tick) < 0) {  // 已经过期的在下一个tick处理
+        node->expire = m_tick;
+    }
+    unsigned long delta = node->expire - m_tick;
+    if(delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+        node->expire = m_tick + MAX_DELTA;
+    }
+    int level = 0;
+    while(delta >= (1UL << ((level + 1) * SLOT_BITS))) {
+        level++;
+    }
+    int index = (node->expire >> (level * SLOT_BITS)) & SLOT_MASK;
+    push_back(m_slots[level] + index, node);
+}
+
+void timer_wheel::cascade(int level, int index) {
+    timer_node* head = m_slots[level] + index;
+    while(head->next != head) {
+        timer_node* node = head->next;
+        unlink(node);
+        insert(node);  // 离到期已经不足上一层的一个槽，一定落到更低的层
+    }
+}
+
+int timer_wheel::advance(unsigned long now_ms, callback cb, void* arg) {
+    unsigned long target = now_ms / m_tick_ms;
+    int expired = 0;
+    while(m_tick <= target) {
+        if(m_count == 0) {  // 没有定时器时直接跳到现在
+            m_tick = target + 1;
+            break;
+        }
+        // 第0层转完一圈时从上一层取下一个槽，上一层也转完一圈时继续向上
+        int index = m_tick & SLOT_MASK;
+        for(int level = 1; index == 0 && level < LEVELS; level++) {
+            index = (m_tick >> (level * SLOT_BITS)) & SLOT_MASK;
+            cascade(level, index);
+        }
+        // 先把这个槽的链表整个取下并推进m_tick，回调中重新schedule的定时器不会落回这个槽
+        timer_node list;
+        timer_node* head = m_slots[0] + (m_tick & SLOT_MASK);
+        list.prev = &list;
+        list.next = &list;
+        if(head->next != head) {
+            list.next = head->next;
+            list.prev = head->prev;
+            list.next->prev = &list;
+            list.prev->next = &list;
+            head->next = head;
+            head->prev = head;
+        }
+        m_tick++;
+        while(list.next != &list) {
+            timer_node* node = list.next;
+            unlink(node);
+            m_count--;
+            expired++;
+            cb(node, arg);
+        }
+    }
+    return expired;
+}
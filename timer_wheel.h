@@ -0,0 +1,62 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+
+/*
+    定时器节点，嵌入在使用者的对象中(例如http_conn)，不需要单独分配
+    在时间轮上时prev/next非空，不在时都为NULL
+*/
+struct timer_node {
+    timer_node* prev;
+    timer_node* next;
+    unsigned long expire;                  // 到期的tick
+    void* data;                            // 使用者的对象，到期时交给回调函数
+    timer_node(): prev(NULL), next(NULL), expire(0), data(NULL) {}
+    bool pending() const { return prev != NULL; }
+};
+
+/*
+    分层时间轮: 4层，每层64个槽，第0层一个槽是一个tick，第k层一个槽是64^k个tick
+    1. 添加、重置和取消都是O(1)的链表操作，连接每次有活动时重置定时器不需要像有序链表那样查找位置
+    2. 每个tick只处理第0层的一个槽；第0层转完一圈时把上一层的一个槽重新分配到下层(cascade)
+    3. 超过最高层范围(64^4个tick)的定时器按最大范围处理
+    只能由一个线程使用(每个reactor一个)，不加锁
+*/
+class timer_wheel {
+public:
+    typedef void (*callback)(timer_node* node, void* arg);
+
+    explicit timer_wheel(int tick_ms);
+    ~timer_wheel();
+
+    // 从最近一次advance的时间起timeout_ms之后到期(精度为一个tick)，已经在时间轮上时先取消
+    void schedule(timer_node* node, long timeout_ms);
+    void cancel(timer_node* node);                       // 不在时间轮上时什么也不做
+    // 处理到now_ms为止到期的定时器，回调前节点已经取下，回调中可以重新schedule；返回到期的个数
+    int advance(unsigned long now_ms, callback cb, void* arg);
+    int size() const { return m_count; }
+    int tick_ms() const { return m_tick_ms; }
+    static unsigned long now_ms();                       // 单调时钟(毫秒)
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const unsigned long SLOT_MASK = SLOTS - 1;
+    static const unsigned long MAX_DELTA = (1UL << (LEVELS * SLOT_BITS)) - 1;
+
+    void insert(timer_node* node);
+    void cascade(int level, int index);                  // 把第level层的一个槽重新分配到下层
+
+    static void unlink(timer_node* node);
+    static void push_back(timer_node* head, timer_node* node);
+
+private:
+    timer_node m_slots[LEVELS][SLOTS];     // 每个槽是带哨兵的双向循环链表
+    unsigned long m_tick;                  // 下一个要处理的tick
+    int m_tick_ms;
+    int m_count;                           // 时间轮上的定时器个数
+};
+
+#endif
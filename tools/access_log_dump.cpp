@@ -0,0 +1,57 @@
+/*
+    把二进制格式的访问日志转换成CLF文本，每行末尾附加首字节和末字节时间(微秒)，中途关闭的连接标记aborted
+
+    编译: g++ -O2 -o access_log_dump access_log_dump.cpp ../access_log.cpp -pthread
+    用法: ./access_log_dump access.log [more.log ...]    (文件名为-时读标准输入)
+*/
+#include <stdio.h>
+#include <string.h>
+#include "../access_log.h"
+
+static bool dump(FILE* fp, const char* name) {
+    char magic[8];
+    if(fread(magic, 1, 8, fp) != 8 || memcmp(magic, ACCESS_LOG_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not a binary access log\n", name);
+        return false;
+    }
+    access_log::entry e;
+    char line[512];
+    long count = 0;
+    while(fread(&e.rec, 1, sizeof(e.rec), fp) == sizeof(e.rec)) {
+        if(e.rec.size != sizeof(e.rec) + e.rec.url_len || e.rec.url_len > access_log::URL_MAX) {
+            fprintf(stderr, "%s: corrupt record #%ld\n", name, count + 1);
+            return false;
+        }
+        if(fread(e.url, 1, e.rec.url_len, fp) != e.rec.url_len) {
+            fprintf(stderr, "%s: truncated record #%ld\n", name, count + 1);
+            return false;
+        }
+        int n = access_log::format_clf(e.rec, e.url, line, sizeof(line));
+        fwrite(line, 1, n, stdout);
+        count++;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        printf("usage: %s access.log [more.log ...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; i++) {
+        FILE* fp = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+        if(!fp) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if(!dump(fp, argv[i])) {
+            ret = 1;
+        }
+        if(fp != stdin) {
+            fclose(fp);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,194 @@
+#include "topology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "log.h"
+
+int topology::m_cpu_count = 0;
+int topology::m_node_count = 1;
+int topology::m_cpus[topology::MAX_CPUS];
+signed char topology::m_node[topology::MAX_CPUS];
+
+// 解析"0-3,8"格式的CPU列表(/sys中的格式)，不检查是否在线
+static bool parse_range_list(const char* list, int* cpus, int max, int* count) {
+    *count = 0;
+    const char* p = list;
+    while(*p && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if(end == p || first < 0 || first >= topology::MAX_CPUS) {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if(*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if(end == p + 1 || last < first || last >= topology::MAX_CPUS) {
+                return false;
+            }
+            p = end;
+        }
+        for(long cpu = first; cpu <= last; cpu++) {
+            if(*count >= max) {
+                return false;
+            }
+            cpus[(*count)++] = cpu;
+        }
+        if(*p == ',') {
+            p++;
+        } else if(*p && *p != '\n') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool topology::read_list(const char* path, int* cpus, int max, int* count) {
+    FILE* fp = fopen(path, "r");
+    if(!fp) {
+        return false;
+    }
+    char line[4096];
+    bool ok = fgets(line, sizeof(line), fp) != NULL && parse_range_list(line, cpus, max, count);
+    fclose(fp);
+    return ok;
+}
+
+bool topology::init() {
+    memset(m_node, -1, sizeof(m_node));
+    if(!read_list("/sys/devices/system/cpu/online", m_cpus, MAX_CPUS, &m_cpu_count) || m_cpu_count == 0) {
+        // 读不到时按sysconf认为0..n-1在线
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        m_cpu_count = n > 0 && n <= MAX_CPUS ? n : 1;
+        for(int i = 0; i < m_cpu_count; i++) {
+            m_cpus[i] = i;
+        }
+    }
+    for(int i = 0; i < m_cpu_count; i++) {
+        m_node[m_cpus[i]] = 0;
+    }
+    m_node_count = 1;
+    int nodes[MAX_NODES];
+    int node_count = 0;
+    if(!read_list("/sys/devices/system/node/online", nodes, MAX_NODES, &node_count) || node_count == 0) {
+        return false;
+    }
+    int max_node = 0;
+    for(int i = 0; i < node_count; i++) {
+        char path[64];
+        if(nodes[i] >= MAX_NODES) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+        int cpus[MAX_CPUS];
+        int count = 0;
+        if(!read_list(path, cpus, MAX_CPUS, &count)) {
+            continue;
+        }
+        for(int j = 0; j < count; j++) {
+            if(m_node[cpus[j]] >= 0) {  // 只记录在线的CPU
+                m_node[cpus[j]] = nodes[i];
+            }
+        }
+        if(nodes[i] > max_node) {
+            max_node = nodes[i];
+        }
+    }
+    m_node_count = max_node + 1;
+    return true;
+}
+
+int topology::node_of(int cpu) {
+    return cpu >= 0 && cpu < MAX_CPUS ? m_node[cpu] : -1;
+}
+
+int topology::parse_cpus(const char* list, int* cpus, int max) {
+    int count = 0;
+    if(strcmp(list, "auto") == 0) {
+        // 依次从每个节点取一个CPU，前几个线程分散到不同的节点上
+        bool used[MAX_CPUS] = {false};
+        while(count < m_cpu_count && count < max) {
+            for(int node = 0; node < m_node_count && count < max; node++) {
+                for(int i = 0; i < m_cpu_count; i++) {
+                    int cpu = m_cpus[i];
+                    if(!used[cpu] && m_node[cpu] == node) {
+                        used[cpu] = true;
+                        cpus[count++] = cpu;
+                        break;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+    if(!parse_range_list(list, cpus, max, &count) || count == 0) {
+        return -1;
+    }
+    for(int i = 0; i < count; i++) {
+        if(m_node[cpus[i]] < 0) {  // 不在线
+            return -1;
+        }
+    }
+    return count;
+}
+
+bool topology::pin_self(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool topology::set_affinity(pthread_attr_t* attr, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+}
+
+void* topology::alloc(size_t size, const int* nodes, int count) {
+    long page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) {
+        return NULL;
+    }
+    if(count > 0 && m_node_count > 1) {
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        for(int i = 0; i < count; i++) {
+            mask[nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+        }
+        int mode = count == 1 ? MPOL_PREFERRED : MPOL_INTERLEAVE;
+        // 在页被首次访问之前设置策略；失败时(例如内核不支持)保持默认的首次访问策略
+        if(syscall(SYS_mbind, p, size, mode, mask, MAX_NODES + 1, 0) < 0) {
+            LOG_WARN("mbind failure: %s", strerror(errno));
+        }
+    }
+    return p;
+}
+
+void topology::release(void* p, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    munmap(p, (size + page - 1) / page * page);
+}
+
+void topology::print() {
+    printf("topology: %d cpus, %d numa nodes\n", m_cpu_count, m_node_count);
+    for(int node = 0; node < m_node_count; node++) {
+        printf("  node %d: cpus", node);
+        int count = 0;
+        for(int i = 0; i < m_cpu_count; i++) {
+            if(m_node[m_cpus[i]] == node) {
+                printf(" %d", m_cpus[i]);
+                count++;
+            }
+        }
+        printf(count ? "\n" : " (none)\n");
+    }
+}
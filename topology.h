@@ -0,0 +1,51 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+    CPU和NUMA拓扑: 从/sys/devices/system读取在线的CPU和每个CPU所在的节点，不依赖libnuma
+    1. 线程绑定: 把reactor线程和工作线程固定到指定的CPU上，不在核之间迁移
+    2. NUMA内存: 用mbind系统调用把大块内存(连接数组)绑定到线程所在的节点，或者在多个节点之间交错分配
+    读不到节点信息(没有NUMA的内核或容器)时，所有CPU都当作在节点0上
+    只在启动时由主线程初始化，之后只读
+*/
+class topology {
+public:
+    static const int MAX_CPUS = 1024;
+    static const int MAX_NODES = 64;
+
+    static bool init();                          // 读取拓扑，失败时返回false(只有节点0)
+    static int cpu_count() { return m_cpu_count; }   // 在线的CPU个数
+    static int node_count() { return m_node_count; }
+    static int node_of(int cpu);                 // CPU所在的节点，CPU不在线时返回-1
+
+    // 解析CPU列表，例如"0-3,8,10-11"；"auto"为所有在线的CPU，按节点交错排列(依次取每个节点的一个CPU)
+    // 列表中的CPU必须在线；返回CPU个数，格式错误时返回-1
+    static int parse_cpus(const char* list, int* cpus, int max);
+
+    static bool pin_self(int cpu);               // 把当前线程绑定到cpu
+    static bool set_affinity(pthread_attr_t* attr, int cpu);  // 让之后用attr创建的线程从一开始就在cpu上运行
+
+    /*
+        分配size字节(按页对齐)的匿名内存，按nodes中的节点放置: 一个节点时优先放在这个节点上，
+        多个节点时按页交错，count为0时不指定(首次访问的线程所在的节点)；返回NULL为失败
+        要用release()释放
+    */
+    static void* alloc(size_t size, const int* nodes, int count);
+    static void release(void* p, size_t size);
+
+    static void print();                         // 打印节点和CPU
+
+private:
+    static bool read_list(const char* path, int* cpus, int max, int* count);
+
+private:
+    static int m_cpu_count;
+    static int m_node_count;
+    static int m_cpus[MAX_CPUS];                 // 在线的CPU
+    static signed char m_node[MAX_CPUS];         // 每个CPU所在的节点，-1为不在线
+};
+
+#endif
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include "uring_reactor.h"
+#include "log.h"
+
+#ifdef IORING_RECV_MULTISHOT
+
+// user_data的高32位是请求类型，低32位是fd
+enum URING_OP {OP_ACCEPT = 1, OP_RECV, OP_WRITE, OP_SHUTDOWN, OP_TIMER, OP_WAKE, OP_SIGNAL};
+
+static inline uint64_t make_data(int op, int fd) {
+    return ((uint64_t)op << 32) | (uint32_t)fd;
+}
+
+uring_reactor::uring_reactor(conn_table* table):
+    reactor(table, NULL), m_ringfd(-1),
+    m_sq_ptr(MAP_FAILED), m_sq_size(0), m_cq_ptr(MAP_FAILED), m_cq_size(0),
+    m_sqes((struct io_uring_sqe*)MAP_FAILED),
+    m_sq_local_tail(0), m_sq_pending(0),
+    m_buf_ring((struct io_uring_buf_ring*)MAP_FAILED), m_bufs(NULL), m_buf_tail(0),
+    m_conn_flags(NULL), m_timer_expirations(0), m_reserve_released(false) {
+    memset(&m_params, 0, sizeof(m_params));
+}
+
+uring_reactor::~uring_reactor() {
+    if(m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_params.sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if(m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) {
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    if(m_sq_ptr != MAP_FAILED) {
+        munmap(m_sq_ptr, m_sq_size);
+    }
+    if(m_buf_ring != MAP_FAILED) {
+        munmap(m_buf_ring, BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    if(m_ringfd != -1) {
+        close(m_ringfd);
+    }
+    delete[] m_bufs;
+    delete[] m_conn_flags;
+}
+
+bool uring_reactor::init(const config& cfg, bool reuse_port) {
+    // timerfd用阻塞模式，io_uring对可poll的文件会等到可读再完成read
+    if(!create_listen(cfg, reuse_port) || !create_timer(cfg, false) || !create_wakeup(true)) {
+        return false;
+    }
+
+    // 1.创建io_uring实例，完成队列开大一些，避免大量multishot完成事件溢出
+    m_params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    m_params.cq_entries = RING_ENTRIES * 4;
+    m_ringfd = syscall(__NR_io_uring_setup, RING_ENTRIES, &m_params);
+    if(m_ringfd < 0 && errno == EINVAL) {  // 老内核不支持后两个标志
+        memset(&m_params, 0, sizeof(m_params));
+        m_params.flags = IORING_SETUP_CQSIZE;
+        m_params.cq_entries = RING_ENTRIES * 4;
+        m_ringfd = syscall(__NR_io_uring_setup, RING_ENTRIES, &m_params);
+    }
+    if(m_ringfd < 0) {
+        LOG_ERROR("io_uring_setup failure: %s", strerror(errno));
+        return false;
+    }
+
+    // 2.把提交队列、完成队列和提交项数组映射到用户态
+    m_sq_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+    m_cq_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+    if(m_params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(m_cq_size > m_sq_size) {
+            m_sq_size = m_cq_size;
+        }
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if(m_sq_ptr == MAP_FAILED) {
+        return false;
+    }
+    if(m_params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cq_ptr = m_sq_ptr;
+    } else {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+        if(m_cq_ptr == MAP_FAILED) {
+            return false;
+        }
+    }
+    m_sqes = (struct io_uring_sqe*)mmap(0, m_params.sq_entries * sizeof(struct io_uring_sqe),
+                                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED) {
+        return false;
+    }
+
+    char* sq = (char*)m_sq_ptr;
+    m_sq_head = (unsigned*)(sq + m_params.sq_off.head);
+    m_sq_tail = (unsigned*)(sq + m_params.sq_off.tail);
+    m_sq_mask = (unsigned*)(sq + m_params.sq_off.ring_mask);
+    m_sq_array = (unsigned*)(sq + m_params.sq_off.array);
+    char* cq = (char*)m_cq_ptr;
+    m_cq_head = (unsigned*)(cq + m_params.cq_off.head);
+    m_cq_tail = (unsigned*)(cq + m_params.cq_off.tail);
+    m_cq_mask = (unsigned*)(cq + m_params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe*)(cq + m_params.cq_off.cqes);
+    m_sq_local_tail = *m_sq_tail;
+    // sq array和提交项一一对应，初始化一次即可
+    for(unsigned i = 0; i < m_params.sq_entries; i++) {
+        m_sq_array[i] = i;
+    }
+
+    // 3.注册provided buffer ring，multishot recv从中取缓冲区
+    m_buf_ring = (struct io_uring_buf_ring*)mmap(0, BUF_COUNT * sizeof(struct io_uring_buf),
+                                                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m_buf_ring == MAP_FAILED) {
+        return false;
+    }
+    memset(m_buf_ring, 0, BUF_COUNT * sizeof(struct io_uring_buf));  // 注册前先触碰页面，否则内核固定的可能是零页
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if(syscall(__NR_io_uring_register, m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG_ERROR("io_uring register buffer ring failure: %s", strerror(errno));
+        return false;
+    }
+    m_bufs = new char[BUF_COUNT * BUF_SIZE];
+    for(unsigned i = 0; i < BUF_COUNT; i++) {
+        recycle_buffer(i);
+    }
+
+    m_conn_flags = new unsigned char[m_max_fd];
+    memset(m_conn_flags, 0, m_max_fd);
+
+    arm_accept();
+    if(m_timerfd != -1) {
+        arm_timer();
+    }
+    arm_poll(m_wakefd, OP_WAKE);
+    return true;
+}
+
+bool uring_reactor::handle_signals(const sigset_t& set, void (*handler)(int)) {
+    m_signalfd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    if(m_signalfd < 0) {
+        LOG_ERROR("signalfd failure: %s", strerror(errno));
+        return false;
+    }
+    m_signal_handler = handler;
+    arm_poll(m_signalfd, OP_SIGNAL);
+    return true;
+}
+
+int uring_reactor::enter(unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    return syscall(__NR_io_uring_enter, m_ringfd, to_submit, min_complete, flags, NULL, 0);
+}
+
+void uring_reactor::flush_sq() {
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+}
+
+// 获取一个空闲的提交项。保证至少还留有两个空位，使writev和链接在它后面的shutdown不会被拆到两次提交中
+struct io_uring_sqe* uring_reactor::get_sqe() {
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if(m_sq_local_tail - head + 2 > m_params.sq_entries) {
+        flush_sq();
+        int ret = enter(m_sq_pending, 0);
+        if(ret > 0) {
+            m_sq_pending -= ret;
+        }
+    }
+    struct io_uring_sqe* sqe = &m_sqes[m_sq_local_tail & *m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_local_tail++;
+    m_sq_pending++;
+    return sqe;
+}
+
+void uring_reactor::recycle_buffer(unsigned bid) {
+    // 不能用m_buf_ring->bufs: 内核头文件里的柔性数组在C++下偏移是8而不是0
+    struct io_uring_buf* buf = (struct io_uring_buf*)m_buf_ring + (m_buf_tail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t)(uintptr_t)(m_bufs + bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    m_buf_tail++;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_reactor::arm_accept() {
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = make_data(OP_ACCEPT, m_listenfd);
+}
+
+void uring_reactor::arm_recv(int fd) {
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = make_data(OP_RECV, fd);
+    m_conn_flags[fd] |= RECV_ARMED;
+}
+
+void uring_reactor::arm_timer() {
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_timerfd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_timer_expirations;
+    sqe->len = sizeof(m_timer_expirations);
+    sqe->user_data = make_data(OP_TIMER, m_timerfd);
+}
+
+// eventfd和signalfd只等待可读，读由本线程完成: signalfd读的是调用者的挂起信号，不能交给内核的工作线程
+void uring_reactor::arm_poll(int fd, int op) {
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = make_data(op, fd);
+}
+
+// 提交应答，短连接在最后一段writev之后链接一个shutdown，写完即关闭，不必再回到用户态
+// 大文件的窗口映射失败时返回false
+bool uring_reactor::submit_write(int fd) {
+    int count = 0;
+    bool last = false;
+    struct iovec* iov = m_users[fd].get_iov(count, &last);
+    if(!iov) {
+        return false;
+    }
+    bool linger = m_users[fd].is_linger();
+
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = count;
+    sqe->user_data = make_data(OP_WRITE, fd);
+    m_conn_flags[fd] |= WRITING;
+    if(!linger && last) {
+        // writev发生短写时内核会取消后面链接的shutdown(-ECANCELED)，由on_write重新提交剩余数据
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = get_sqe();
+        sqe->opcode = IORING_OP_SHUTDOWN;
+        sqe->fd = fd;
+        sqe->len = SHUT_RDWR;
+        sqe->user_data = make_data(OP_SHUTDOWN, fd);
+        m_conn_flags[fd] |= SHUTTING;
+    }
+    return true;
+}
+
+// 处理读缓冲区中的请求并提交应答
+void uring_reactor::process(int fd) {
+    http_conn::HTTP_CODE ret = m_users[fd].process_request();
+    if(ret == http_conn::CLOSED_CONNECTION) {
+        m_conn_flags[fd] |= CLOSING;
+    }
+    else if(ret != http_conn::NO_REQUEST && !submit_write(fd)) {
+        m_conn_flags[fd] |= CLOSING;
+    }
+}
+
+/*
+    数据依次追加到连接的读缓冲区，不在写应答时读缓冲区满了就先处理其中完整的请求腾出空间；
+    正在写应答时放不下的数据暂存到m_overflow，写完后再交给连接，客户端流水线发来的请求不会丢失
+    处理之后读缓冲区仍然是满的，连接会换成更大的读缓冲区；已经增长到read_buffer_max时关闭连接
+*/
+void uring_reactor::feed(int fd, const char* data, int len) {
+    std::unordered_map<int, std::string>::iterator it = m_overflow.find(fd);
+    if(it != m_overflow.end()) {  // 前面还有暂存的数据，保持顺序
+        it->second.append(data, len);
+        if(it->second.size() > (size_t)http_conn::m_read_buffer_max) {
+            m_conn_flags[fd] |= CLOSING;
+        }
+        return;
+    }
+    bool processed = false;
+    while(true) {
+        int n = m_users[fd].append_read(data, len);
+        data += n;
+        len -= n;
+        if(m_conn_flags[fd] & WRITING) {
+            if(len > 0) {
+                m_overflow[fd].assign(data, len);
+            }
+            return;
+        }
+        if(len == 0) {
+            process(fd);
+            return;
+        }
+        if(n == 0 && processed) {
+            m_conn_flags[fd] |= CLOSING;
+            return;
+        }
+        process(fd);
+        processed = true;
+        if(m_conn_flags[fd] & CLOSING) {
+            return;
+        }
+    }
+}
+
+void uring_reactor::on_accept(struct io_uring_cqe* cqe) {
+    if(!(cqe->flags & IORING_CQE_F_MORE)) {  // multishot被内核终止了，重新提交
+        arm_accept();
+    }
+    int connfd = cqe->res;
+    if(connfd < 0) {
+        // fd用完时连接留在监听队列中，重新提交的accept立即又失败；关掉预留的fd腾出一个位置给下一个连接
+        if((connfd == -EMFILE || connfd == -ENFILE) && m_reserve_fd != -1) {
+            close(m_reserve_fd);
+            m_reserve_fd = -1;
+            m_reserve_released = true;
+        }
+        return;
+    }
+    if(m_reserve_released) {            // 这个连接用的是预留的位置，回答503后关闭
+        m_reserve_released = false;
+        http_conn::reject(connfd);
+        reopen_reserve();
+        fd_exhausted();
+        return;
+    }
+    if(connfd >= m_max_fd) {            // 连接表已满
+        http_conn::reject(connfd);
+        return;
+    }
+    // multishot accept的所有完成事件共用一个地址参数，所以单独获取客户端地址
+    struct sockaddr_in client_address;
+    socklen_t client_addrlen = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(connfd, (struct sockaddr*)&client_address, &client_addrlen);
+    m_table->prepare(connfd);
+    m_users[connfd].init_conn(connfd, client_address, -1, m_wheel);
+    m_conn_flags[connfd] = 0;
+    arm_recv(connfd);
+}
+
+void uring_reactor::on_recv(int fd, struct io_uring_cqe* cqe) {
+    if(!(cqe->flags & IORING_CQE_F_MORE)) {
+        m_conn_flags[fd] &= ~RECV_ARMED;
+    }
+    int res = cqe->res;
+    if(res > 0) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if(!(m_conn_flags[fd] & CLOSING)) {
+            feed(fd, m_bufs + bid * BUF_SIZE, res);
+        }
+        recycle_buffer(bid);  // 数据已经拷贝走了，立即归还
+    }
+    else if(res != -ENOBUFS) {  // 对方关闭连接或者出错；-ENOBUFS表示buffer暂时用完了，重新提交即可
+        m_conn_flags[fd] |= CLOSING;
+    }
+
+    if(m_conn_flags[fd] & CLOSING) {
+        try_close(fd);
+        return;
+    }
+    if(!(m_conn_flags[fd] & RECV_ARMED)) {
+        arm_recv(fd);
+    }
+    m_users[fd].update_timer();
+}
+
+void uring_reactor::on_write(int fd, struct io_uring_cqe* cqe) {
+    m_conn_flags[fd] &= ~WRITING;
+    if(cqe->res < 0) {
+        m_conn_flags[fd] |= CLOSING;
+    }
+    else if(m_conn_flags[fd] & CLOSING) {
+        // 写的过程中连接已经断开
+    }
+    else if(!m_users[fd].sent(cqe->res)) {
+        if(submit_write(fd)) {  // 短写或大文件的下一个窗口，继续发送剩余的数据
+            m_users[fd].update_timer();
+            return;
+        }
+        m_conn_flags[fd] |= CLOSING;
+    }
+    else if(!m_users[fd].finish_write()) {
+        m_conn_flags[fd] |= CLOSING;  // 短连接，链接的shutdown会使recv结束
+    }
+    else {
+        // 读缓冲区中还有流水线请求，或者写的期间收到了数据
+        std::unordered_map<int, std::string>::iterator it = m_overflow.find(fd);
+        if(it != m_overflow.end()) {
+            std::string data;
+            data.swap(it->second);
+            m_overflow.erase(it);
+            feed(fd, data.data(), data.size());
+        }
+        else if(m_users[fd].pipelined()) {
+            process(fd);
+        }
+    }
+    if(m_conn_flags[fd] & CLOSING) {
+        try_close(fd);
+    }
+    else {
+        m_users[fd].update_timer();
+    }
+}
+
+// shutdown使挂着的recv以0结束、没写完的writev出错返回，两者都结束后再关闭
+void uring_reactor::on_timeout(int fd) {
+    if(m_users[fd].expire()) {
+        m_conn_flags[fd] |= CLOSING;
+        shutdown(fd, SHUT_RDWR);
+        try_close(fd);
+    }
+}
+
+/*
+    链接的shutdown在writev完成之后才由内核执行，fd也是那时才解析，writev的完成事件可能先于它到达；
+    这时关闭fd，multishot accept会把同一个fd号分给新连接，shutdown就落到了新连接上，所以也要等它结束
+*/
+void uring_reactor::on_shutdown(int fd, struct io_uring_cqe* cqe) {
+    if(cqe->res == -ECANCELED && (m_conn_flags[fd] & WRITING)) {
+        return;  // writev短写被取消，剩余数据的writev又链接了一个shutdown
+    }
+    m_conn_flags[fd] &= ~SHUTTING;
+    if(m_conn_flags[fd] & CLOSING) {
+        try_close(fd);
+    }
+}
+
+// recv、writev和链接的shutdown都结束后才能关闭fd，否则fd被新连接复用后会收到旧连接的完成事件
+void uring_reactor::try_close(int fd) {
+    if(m_conn_flags[fd] & (WRITING | SHUTTING)) {
+        return;
+    }
+    if(m_conn_flags[fd] & RECV_ARMED) {
+        shutdown(fd, SHUT_RDWR);  // 让multishot recv以0结束
+        return;
+    }
+    m_conn_flags[fd] = 0;
+    m_overflow.erase(fd);
+    m_users[fd].close_conn();
+}
+
+void uring_reactor::loop() {
+    while(m_running) {
+        flush_sq();
+        int ret = enter(m_sq_pending, 1);  // 提交上一轮产生的请求并等待至少一个完成事件
+        if(ret < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            LOG_ERROR("io_uring_enter failure: %s", strerror(errno));
+            break;
+        }
+        m_sq_pending -= ret;
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for( ; head != tail; head++) {
+            struct io_uring_cqe* cqe = &m_cqes[head & *m_cq_mask];
+            int op = cqe->user_data >> 32;
+            int fd = (int)(cqe->user_data & 0xffffffff);
+            switch(op) {
+                case OP_ACCEPT:
+                    on_accept(cqe);
+                    break;
+                case OP_RECV:
+                    on_recv(fd, cqe);
+                    break;
+                case OP_WRITE:
+                    on_write(fd, cqe);
+                    break;
+                case OP_SHUTDOWN:
+                    on_shutdown(fd, cqe);
+                    break;
+                case OP_TIMER:
+                    if(cqe->res > 0) {
+                        expire_timers();
+                    }
+                    if(cqe->res > 0 || cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                        arm_timer();
+                    } else {
+                        LOG_ERROR("timerfd read failure: %s", strerror(-cqe->res));
+                    }
+                    break;
+                case OP_WAKE: {           // stop()，循环条件会检查m_running
+                    uint64_t count;
+                    if(read(m_wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                        LOG_ERROR("eventfd read failure: %s", strerror(errno));
+                    }
+                    arm_poll(m_wakefd, OP_WAKE);
+                    break;
+                }
+                case OP_SIGNAL:
+                    read_signals();
+                    arm_poll(m_signalfd, OP_SIGNAL);
+                    break;
+                default:
+                    break;
+            }
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+#else
+
+// 内核头文件太旧，不支持multishot recv和provided buffer ring
+uring_reactor::uring_reactor(conn_table* table): reactor(table, NULL) {}
+uring_reactor::~uring_reactor() {}
+
+bool uring_reactor::init(const config& cfg, bool reuse_port) {
+    LOG_ERROR("io_uring backend is not supported by this build");
+    return false;
+}
+
+void uring_reactor::loop() {}
+void uring_reactor::on_timeout(int fd) {}
+bool uring_reactor::handle_signals(const sigset_t& set, void (*handler)(int)) { return false; }
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <linux/io_uring.h>
+#include <string>
+#include <unordered_map>
+#include "reactor.h"
+
+/*
+    io_uring后端的reactor，替代epoll_wait + recv + epoll_ctl + writev的组合
+    1. 监听socket上挂一个multishot accept，一次提交持续产生新连接
+    2. 每个连接挂一个multishot recv，从provided buffer ring中取缓冲区，数据拷贝到http_conn的读缓冲区后立即归还
+    3. 应答用writev提交，短连接在writev后链接(IOSQE_IO_LINK)一个shutdown，由recv结束时关闭fd
+    4. timerfd上挂一个read，每次完成时处理时间轮上到期的定时器并重新提交
+    一轮事件循环只调用一次io_uring_enter，既提交上一轮产生的所有请求，又等待新的完成事件
+    io_uring后端总是在本线程内调用process_request()，不使用线程池
+    编译时内核头文件不支持multishot recv时，init()直接返回false
+*/
+class uring_reactor : public reactor {
+public:
+    uring_reactor(conn_table* table);
+    virtual ~uring_reactor();
+
+    virtual bool init(const config& cfg, bool reuse_port);  // 创建监听socket、io_uring实例和provided buffer ring
+    virtual void loop();                           // 事件循环
+    virtual bool handle_signals(const sigset_t& set, void (*handler)(int));
+
+private:
+    static const unsigned RING_ENTRIES = 4096;     // 提交队列的大小
+    static const unsigned BUF_COUNT = 1024;        // provided buffer的个数，必须是2的幂
+    static const unsigned BUF_SIZE = 2048;         // 每个provided buffer的大小
+    static const unsigned BUF_GROUP = 0;           // buffer group id
+
+    // 每个连接在本reactor中的状态，以fd为下标
+    enum CONN_FLAG {RECV_ARMED = 1, WRITING = 2, CLOSING = 4, SHUTTING = 8};
+
+    struct io_uring_sqe* get_sqe();                // 获取一个空闲的提交项，队列满时先提交
+    int enter(unsigned to_submit, unsigned min_complete);
+    void flush_sq();                               // 把本地的sq tail发布给内核
+
+    void arm_accept();
+    void arm_recv(int fd);
+    void arm_timer();
+    void arm_poll(int fd, int op);                 // 单次的POLL_ADD，完成后在本线程中读
+    bool submit_write(int fd);
+    void process(int fd);                          // 处理读缓冲区中的请求并提交应答
+    void feed(int fd, const char* data, int len);  // 把收到的数据交给连接，读缓冲区满时先处理已有的请求
+    void recycle_buffer(unsigned bid);             // 把用完的provided buffer还给内核
+
+    void on_accept(struct io_uring_cqe* cqe);
+    void on_recv(int fd, struct io_uring_cqe* cqe);
+    void on_write(int fd, struct io_uring_cqe* cqe);
+    void on_shutdown(int fd, struct io_uring_cqe* cqe);
+    void try_close(int fd);                        // 没有未完成的请求时关闭连接
+    virtual void on_timeout(int fd);
+
+private:
+    int m_ringfd;
+    struct io_uring_params m_params;
+
+    // 提交队列(SQ)和完成队列(CQ)在用户态的映射
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    void* m_cq_ptr;
+    size_t m_cq_size;
+    struct io_uring_sqe* m_sqes;
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned* m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned* m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+    unsigned m_sq_local_tail;                      // 尚未发布给内核的sq tail
+    unsigned m_sq_pending;                         // 尚未提交的请求个数
+
+    // provided buffer ring
+    struct io_uring_buf_ring* m_buf_ring;
+    char* m_bufs;
+    unsigned short m_buf_tail;
+
+    unsigned char* m_conn_flags;                   // 每个连接的CONN_FLAG
+    uint64_t m_timer_expirations;                  // timerfd的read读到这里
+    bool m_reserve_released;                       // fd用完时关掉了预留的fd，下一个accept到的连接要拒绝
+    // 正在写应答时收到的、读缓冲区放不下的流水线数据，写完后再交给连接；只有这种连接才有条目
+    std::unordered_map<int, std::string> m_overflow;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+
+/*
+    有界的Chase-Lev work stealing双端队列
+    1. push()只能由一个线程(队列的拥有者)调用，在bottom端写入，不需要CAS
+    2. steal()可以由任意线程调用，在top端用CAS取走最早的元素，所以拥有者之外的线程取出的顺序仍然是FIFO
+    3. 容量固定(2的幂)，满时push()返回false，由调用者换一个队列
+    线程池中拥有者是往这个工作线程派发任务的reactor，工作线程自己和其它空闲的工作线程都从top端取
+*/
+template<typename T>
+class ws_deque {
+public:
+    explicit ws_deque(size_t capacity);  // 向上取2的幂
+    ~ws_deque();
+
+    bool push(const T& value);           // 只能由拥有者调用，满时返回false
+    bool steal(T& value);                // 任意线程调用，空时返回false；和其它线程竞争失败时重试
+    size_t size() const;                 // 近似值
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    ws_deque(const ws_deque&);
+    ws_deque& operator=(const ws_deque&);
+
+private:
+    std::atomic<T>* m_buffer;
+    size_t m_mask;
+    std::atomic<long> m_top __attribute__((aligned(CACHE_LINE)));     // 下一个被偷走的位置
+    std::atomic<long> m_bottom __attribute__((aligned(CACHE_LINE)));  // 下一个写入的位置
+};
+
+template<typename T>
+ws_deque<T>::ws_deque(size_t capacity): m_buffer(NULL), m_mask(0), m_top(0), m_bottom(0) {
+    size_t size = 2;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_buffer = new std::atomic<T>[size];
+    if(!m_buffer) {
+        throw std::exception();
+    }
+    m_mask = size - 1;
+}
+
+template<typename T>
+ws_deque<T>::~ws_deque() {
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool ws_deque<T>::push(const T& value) {
+    long b = m_bottom.load(std::memory_order_relaxed);
+    long t = m_top.load(std::memory_order_acquire);
+    if(b - t > (long)m_mask) {  // 满了
+        return false;
+    }
+    m_buffer[b & m_mask].store(value, std::memory_order_relaxed);
+    m_bottom.store(b + 1, std::memory_order_release);  // 发布元素
+    return true;
+}
+
+template<typename T>
+bool ws_deque<T>::steal(T& value) {
+    while(true) {
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b) {
+            return false;
+        }
+        // 先读出元素再CAS: CAS成功说明这期间没有别人取走它，拥有者也不会覆盖还没取走的位置
+        value = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        if(m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+template<typename T>
+size_t ws_deque<T>::size() const {
+    long b = m_bottom.load(std::memory_order_relaxed);
+    long t = m_top.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+#endif